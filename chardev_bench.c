@@ -0,0 +1,1049 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Throughput and latency benchmark for the character device family
+ *
+ * Drives /dev/pcdev-* (pseudo character devices), /dev/bmp280 and V4L2
+ * sub-device nodes such as the ov9282 one with read, write, ioctl, mmap
+ * and poll patterns, sweeping the thread count and the buffer size. Every
+ * run prints one JSON object per line with syscalls/s, bytes/s and
+ * p50/p99/p999 latency so results can be diffed between builds. The tool
+ * only needs the device node, so it runs the same against emulated
+ * backends under QEMU or UML.
+ *
+ * The memcpy op copies between two private buffers with the same sizes
+ * and threads, as the memory bandwidth reference that read and write on
+ * memory-backed devices are measured against.
+ *
+ * The copy-mmap preset compares copying through read()/write() with
+ * loads and stores through a shared mapping, for buffers from 4 KiB to
+ * 1 GiB. Every thread works on its own buffer-sized window of the device,
+ * so the device must be at least threads x 1 GiB for the last sizes.
+ *
+ * The percpu-scaling preset runs small writes from 1 to N threads, each
+ * pinned to its own CPU, the pattern PCDEV_MODE_PERCPU instances shard
+ * for. Every run reports its speedup over the single-thread run of the
+ * same op and size, which stays near the thread count while writers do
+ * not contend.
+ *
+ * With -p the subdev-g-fmt ioctl of thread i queries pad i % PADS, so that
+ * format queries spread over the pads of a multi-pad subdev can be
+ * compared with all threads on pad 0. The ioctl path still takes the whole
+ * state lock, so per-pad state locks do not show up here: only in-kernel
+ * callers of v4l2_subdev_call_state_active_pad() take them.
+ *
+ * With -N every run is repeated for each listed NUMA node, with the
+ * threads pinned to the CPUs of that node and their buffers allocated
+ * there. Against an instance placed on one node (the numa_node and flags
+ * attributes of its configfs item), the node runs give local and remote
+ * bandwidth.
+ *
+ * Build: gcc -O2 -pthread -o chardev_bench chardev_bench.c
+ *
+ * Examples:
+ *   chardev_bench -d /dev/pcdev-0 -o read,write,mmap -t 1,2,4 -s 4k,64k,1m
+ *   chardev_bench -d /dev/pcdev-0 -o memcpy,read,write -t 1,4 -s 64k,1m
+ *   chardev_bench -d /dev/pcdev-0 -P copy-mmap
+ *   chardev_bench -d /dev/pcdev-2 -P percpu-scaling
+ *   chardev_bench -d /dev/pcdev-3 -o read,write -s 1m -t 1,4 -N 0,1
+ *   chardev_bench -d /dev/pcdev-1 -o poll -s 64
+ *   chardev_bench -d /dev/v4l-subdev0 -o ioctl -i subdev-g-fmt -t 1,4
+ *   chardev_bench -d /dev/v4l-subdev1 -o ioctl -i subdev-g-fmt -t 1,2,4 -p 4
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/v4l2-subdev.h>
+
+#include "pcdev_ioctl.h"
+
+#define BENCH_MAX_SWEEP		32
+#define BENCH_MAX_SAMPLES	(1 << 20)
+
+enum bench_op {
+	BENCH_OP_READ,
+	BENCH_OP_WRITE,
+	BENCH_OP_IOCTL,
+	BENCH_OP_MMAP,
+	BENCH_OP_MMAP_WRITE,
+	BENCH_OP_POLL,
+	BENCH_OP_MEMCPY,
+};
+
+static const char * const bench_op_names[] = {
+	[BENCH_OP_READ] = "read",
+	[BENCH_OP_WRITE] = "write",
+	[BENCH_OP_IOCTL] = "ioctl",
+	[BENCH_OP_MMAP] = "mmap",
+	[BENCH_OP_MMAP_WRITE] = "mmap-write",
+	[BENCH_OP_POLL] = "poll",
+	[BENCH_OP_MEMCPY] = "memcpy",
+};
+
+enum bench_ioctl {
+	BENCH_IOCTL_SUBDEV_G_FMT,
+	BENCH_IOCTL_EXPORT_DMABUF,
+};
+
+/**
+ * struct bench_config - benchmark parameters shared by all runs
+ * @path: Device node under test
+ * @ops: Bitmask of enum bench_op to run
+ * @ioctl: ioctl issued by BENCH_OP_IOCTL
+ * @pads: Pads the BENCH_IOCTL_SUBDEV_G_FMT threads spread over
+ * @threads: Thread counts to sweep
+ * @nr_threads: Number of entries in @threads
+ * @sizes: Buffer sizes to sweep, in bytes
+ * @nr_sizes: Number of entries in @sizes
+ * @span: Device range the offsets of read, write and mmap rotate over, 0
+ *	  for one buffer per thread
+ * @duration_ns: Length of each run
+ * @pin: Pin worker threads to distinct CPUs of @cpus
+ * @cpus: CPUs the process may run on, in ascending order
+ * @nr_cpus: Number of entries in @cpus
+ * @nodes: NUMA nodes to repeat every run on
+ * @nr_nodes: Number of entries in @nodes, 0 to run without node binding
+ * @node: Node of the current runs, -1 if none
+ */
+struct bench_config {
+	const char *path;
+	unsigned int ops;
+	enum bench_ioctl ioctl;
+	unsigned int pads;
+	unsigned int threads[BENCH_MAX_SWEEP];
+	unsigned int nr_threads;
+	size_t sizes[BENCH_MAX_SWEEP];
+	unsigned int nr_sizes;
+	size_t span;
+	uint64_t duration_ns;
+	bool pin;
+	int cpus[CPU_SETSIZE];
+	unsigned int nr_cpus;
+	int nodes[BENCH_MAX_SWEEP];
+	unsigned int nr_nodes;
+	int node;
+};
+
+/**
+ * struct bench_worker - per-thread state of one run
+ * @cfg: Benchmark parameters
+ * @op: Operation to issue
+ * @size: Buffer size of the run
+ * @threads: Number of threads of the run
+ * @index: Thread index, selects the device window of the thread
+ * @span: Device range of the run, see bench_config.span
+ * @cpu: CPU the thread is pinned to, -1 if not pinned
+ * @fd: File descriptor of the device, private to the thread
+ * @buf: I/O buffer of @size bytes
+ * @map: Device mapping for BENCH_OP_MMAP and BENCH_OP_MMAP_WRITE
+ * @src: Source buffer of @size bytes for BENCH_OP_MEMCPY
+ * @ops: Completed operations
+ * @bytes: Bytes moved by the completed operations
+ * @samples: Per-operation latencies in ns, the first BENCH_MAX_SAMPLES ops
+ * @nr_samples: Number of entries in @samples
+ * @error: errno of the failure that stopped the thread, 0 if none
+ */
+struct bench_worker {
+	const struct bench_config *cfg;
+	enum bench_op op;
+	size_t size;
+	unsigned int threads;
+	unsigned int index;
+	size_t span;
+	int cpu;
+	int fd;
+	char *buf;
+	char *map;
+	char *src;
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t *samples;
+	size_t nr_samples;
+	int error;
+};
+
+/**
+ * struct bench_result - aggregated result of one run
+ * @ops: Completed operations of all threads
+ * @bytes: Bytes moved by all threads
+ * @seconds: Wall time of the run
+ * @p50_ns: Median operation latency
+ * @p99_ns: 99th percentile operation latency
+ * @p999_ns: 99.9th percentile operation latency
+ * @error: First errno reported by a thread, 0 if none
+ */
+struct bench_result {
+	uint64_t ops;
+	uint64_t bytes;
+	double seconds;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	int error;
+};
+
+static pthread_barrier_t bench_start;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_sample(struct bench_worker *w, uint64_t ns)
+{
+	if (w->nr_samples < BENCH_MAX_SAMPLES)
+		w->samples[w->nr_samples++] = ns;
+}
+
+/* Offset of the next transfer, threads rotate over disjoint windows */
+static off_t bench_offset(struct bench_worker *w)
+{
+	size_t window = w->span / w->threads;
+	size_t slots = window / w->size;
+
+	if (!slots)
+		return 0;
+
+	return (off_t)(w->index * window + (w->ops % slots) * w->size);
+}
+
+/**
+ * bench_rw() - Issue one read or write
+ * @w: worker
+ *
+ * Seekable devices get positional I/O, stream devices (FIFO and per-CPU
+ * pcdev modes, bmp280) fall back to plain read()/write().
+ *
+ * Return: bytes moved or -errno.
+ */
+static ssize_t bench_rw(struct bench_worker *w)
+{
+	bool write_op = w->op == BENCH_OP_WRITE;
+	off_t off = bench_offset(w);
+	ssize_t ret;
+
+	if (write_op)
+		ret = pwrite(w->fd, w->buf, w->size, off);
+	else
+		ret = pread(w->fd, w->buf, w->size, off);
+
+	/* The span does not fit in the device */
+	if (!ret && w->size)
+		return -EFBIG;
+
+	if (ret < 0 && errno == ESPIPE) {
+		if (write_op)
+			ret = write(w->fd, w->buf, w->size);
+		else
+			ret = read(w->fd, w->buf, w->size);
+	}
+
+	return ret < 0 ? -errno : ret;
+}
+
+/**
+ * bench_ioctl() - Issue one ioctl
+ * @w: worker
+ *
+ * Return: 0 or -errno.
+ */
+static int bench_ioctl(struct bench_worker *w)
+{
+	struct v4l2_subdev_format fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+		.pad = w->index % w->cfg->pads,
+	};
+	struct pcdev_export_dmabuf exp = {
+		.flags = O_RDONLY | O_CLOEXEC,
+	};
+
+	switch (w->cfg->ioctl) {
+	case BENCH_IOCTL_SUBDEV_G_FMT:
+		if (ioctl(w->fd, VIDIOC_SUBDEV_G_FMT, &fmt))
+			return -errno;
+		return 0;
+	case BENCH_IOCTL_EXPORT_DMABUF:
+		if (ioctl(w->fd, PCDEV_IOC_EXPORT_DMABUF, &exp))
+			return -errno;
+		close(exp.fd);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * bench_reopen_truncated() - Empty a full per-CPU pcdev log
+ * @w: worker
+ *
+ * Return: 0 or -errno.
+ */
+static int bench_reopen_truncated(struct bench_worker *w)
+{
+	close(w->fd);
+	w->fd = open(w->cfg->path, O_RDWR | O_TRUNC);
+
+	return w->fd < 0 ? -errno : 0;
+}
+
+static void bench_pin(struct bench_worker *w)
+{
+	cpu_set_t set;
+
+	if (w->cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	w->error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *bench_worker_fn(void *arg)
+{
+	struct bench_worker *w = arg;
+	uint64_t end, t0, t1;
+	ssize_t ret = 0;
+
+	bench_pin(w);
+	pthread_barrier_wait(&bench_start);
+	if (w->error)
+		return NULL;
+
+	t0 = bench_now();
+	end = t0 + w->cfg->duration_ns;
+
+	while (t0 < end) {
+		switch (w->op) {
+		case BENCH_OP_READ:
+		case BENCH_OP_WRITE:
+			ret = bench_rw(w);
+			break;
+		case BENCH_OP_IOCTL:
+			ret = bench_ioctl(w);
+			break;
+		case BENCH_OP_MMAP:
+			memcpy(w->buf, w->map + bench_offset(w), w->size);
+			ret = w->size;
+			break;
+		case BENCH_OP_MMAP_WRITE:
+			memcpy(w->map + bench_offset(w), w->buf, w->size);
+			ret = w->size;
+			break;
+		case BENCH_OP_MEMCPY:
+			memcpy(w->buf, w->src, w->size);
+			ret = w->size;
+			break;
+		case BENCH_OP_POLL:
+			ret = -EINVAL;
+			break;
+		}
+
+		t1 = bench_now();
+
+		if (ret == -ENOSPC && w->op == BENCH_OP_WRITE) {
+			/* Untimed: the log reset is not part of the pattern */
+			ret = bench_reopen_truncated(w);
+			t0 = bench_now();
+			if (!ret)
+				continue;
+		}
+
+		if (ret < 0) {
+			w->error = -ret;
+			break;
+		}
+
+		bench_sample(w, t1 - t0);
+		w->bytes += ret;
+		w->ops++;
+		t0 = t1;
+	}
+
+	return NULL;
+}
+
+/**
+ * struct bench_pingpong - shared state of a poll handoff run
+ * @w: Consumer worker, collects the samples
+ * @wfd: Producer file descriptor
+ * @sent: Messages written by the producer
+ * @received: Messages consumed by the consumer
+ * @stop: Set by the consumer when the run is over
+ */
+struct bench_pingpong {
+	struct bench_worker *w;
+	int wfd;
+	uint64_t sent;
+	uint64_t received;
+	bool stop;
+};
+
+/*
+ * Producer side of a handoff run: writes a message stamped with the send
+ * time, then waits for the consumer to take it so that every sample
+ * measures one isolated producer-to-consumer wakeup.
+ */
+static void *bench_producer_fn(void *arg)
+{
+	struct bench_pingpong *pp = arg;
+	struct bench_worker *w = pp->w;
+	char *msg;
+	uint64_t ts;
+
+	msg = calloc(1, w->size);
+	if (!msg)
+		return NULL;
+
+	pthread_barrier_wait(&bench_start);
+
+	while (!__atomic_load_n(&pp->stop, __ATOMIC_ACQUIRE)) {
+		ts = bench_now();
+		memcpy(msg, &ts, sizeof(ts));
+		if (write(pp->wfd, msg, w->size) != (ssize_t)w->size)
+			break;
+		__atomic_add_fetch(&pp->sent, 1, __ATOMIC_RELEASE);
+
+		while (__atomic_load_n(&pp->received, __ATOMIC_ACQUIRE) !=
+		       __atomic_load_n(&pp->sent, __ATOMIC_RELAXED) &&
+		       !__atomic_load_n(&pp->stop, __ATOMIC_ACQUIRE))
+			;
+	}
+
+	free(msg);
+
+	return NULL;
+}
+
+/**
+ * bench_run_poll() - Measure poll()/read() handoff latency
+ * @w: consumer worker, opened non-blocking on the device
+ *
+ * One producer and one consumer, the consumer sleeps in poll() and reads
+ * the message once woken up. Sample latency is send time to read return.
+ */
+static void bench_run_poll(struct bench_worker *w)
+{
+	struct bench_pingpong pp = { .w = w };
+	struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+	pthread_t producer;
+	uint64_t end, ts, now;
+	size_t got;
+	ssize_t ret;
+
+	pp.wfd = open(w->cfg->path, O_WRONLY);
+	if (pp.wfd < 0) {
+		w->error = errno;
+		pthread_barrier_wait(&bench_start);
+		return;
+	}
+
+	pthread_create(&producer, NULL, bench_producer_fn, &pp);
+	pthread_barrier_wait(&bench_start);
+
+	end = bench_now() + w->cfg->duration_ns;
+
+	while (bench_now() < end) {
+		if (poll(&pfd, 1, 100) < 0) {
+			w->error = errno;
+			break;
+		}
+
+		for (got = 0; got < w->size; got += ret) {
+			ret = read(w->fd, w->buf + got, w->size - got);
+			if (ret < 0 && errno == EAGAIN) {
+				poll(&pfd, 1, 100);
+				ret = 0;
+				continue;
+			}
+			if (ret <= 0) {
+				w->error = ret ? errno : EIO;
+				goto out;
+			}
+		}
+
+		now = bench_now();
+		memcpy(&ts, w->buf, sizeof(ts));
+		bench_sample(w, now - ts);
+		w->bytes += w->size;
+		w->ops++;
+		__atomic_add_fetch(&pp.received, 1, __ATOMIC_RELEASE);
+	}
+
+out:
+	__atomic_store_n(&pp.stop, true, __ATOMIC_RELEASE);
+	pthread_join(producer, NULL);
+	close(pp.wfd);
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, size_t n, double p)
+{
+	size_t i;
+
+	if (!n)
+		return 0;
+
+	i = (size_t)(p * (n - 1) + 0.5);
+
+	return sorted[i < n ? i : n - 1];
+}
+
+/**
+ * bench_worker_init() - Open the device and allocate buffers for a worker
+ * @w: worker, cfg/op/size/threads/index already set
+ *
+ * Return: 0 or -errno.
+ */
+static int bench_worker_init(struct bench_worker *w)
+{
+	int flags;
+
+	switch (w->op) {
+	case BENCH_OP_READ:
+	case BENCH_OP_MMAP:
+		flags = O_RDONLY;
+		break;
+	case BENCH_OP_WRITE:
+		flags = O_WRONLY;
+		break;
+	case BENCH_OP_POLL:
+		flags = O_RDONLY | O_NONBLOCK;
+		break;
+	default:
+		flags = O_RDWR;
+		break;
+	}
+
+	if (w->op != BENCH_OP_MEMCPY) {
+		w->fd = open(w->cfg->path, flags);
+		if (w->fd < 0 && w->op == BENCH_OP_IOCTL)
+			w->fd = open(w->cfg->path, O_RDONLY);
+		if (w->fd < 0)
+			return -errno;
+	}
+
+	w->buf = aligned_alloc(4096, (w->size + 4095) & ~(size_t)4095);
+	w->samples = malloc(BENCH_MAX_SAMPLES * sizeof(*w->samples));
+	if (!w->buf || !w->samples)
+		return -ENOMEM;
+	memset(w->buf, 0xa5, w->size);
+
+	if (w->op == BENCH_OP_MEMCPY) {
+		w->src = aligned_alloc(4096, (w->size + 4095) & ~(size_t)4095);
+		if (!w->src)
+			return -ENOMEM;
+		memset(w->src, 0x5a, w->size);
+	}
+
+	if (w->op == BENCH_OP_MMAP || w->op == BENCH_OP_MMAP_WRITE) {
+		w->map = mmap(NULL, w->span, w->op == BENCH_OP_MMAP ?
+			      PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED,
+			      w->fd, 0);
+		if (w->map == MAP_FAILED) {
+			w->map = NULL;
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+static void bench_worker_fini(struct bench_worker *w)
+{
+	if (w->map)
+		munmap(w->map, w->span);
+	if (w->fd >= 0)
+		close(w->fd);
+	free(w->src);
+	free(w->buf);
+	free(w->samples);
+}
+
+/**
+ * bench_run() - Run one operation with one thread count and buffer size
+ * @cfg: benchmark parameters
+ * @op: operation
+ * @threads: number of threads
+ * @size: buffer size in bytes
+ * @res: aggregated result
+ */
+static void bench_run(const struct bench_config *cfg, enum bench_op op,
+		      unsigned int threads, size_t size,
+		      struct bench_result *res)
+{
+	struct bench_worker *workers;
+	pthread_t *tids;
+	uint64_t *all, start;
+	size_t nr_all = 0;
+	unsigned int i;
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+
+	if (op == BENCH_OP_POLL)
+		threads = 1;
+
+	workers = calloc(threads, sizeof(*workers));
+	tids = calloc(threads, sizeof(*tids));
+	if (!workers || !tids) {
+		res->error = ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < threads; i++) {
+		workers[i] = (struct bench_worker) {
+			.cfg = cfg,
+			.op = op,
+			.size = size,
+			.threads = threads,
+			.index = i,
+			.span = cfg->span ? cfg->span : size * threads,
+			.cpu = cfg->pin ? cfg->cpus[i % cfg->nr_cpus] : -1,
+			.fd = -1,
+		};
+		ret = bench_worker_init(&workers[i]);
+		if (ret) {
+			res->error = -ret;
+			threads = i + 1;
+			goto out_fini;
+		}
+	}
+
+	pthread_barrier_init(&bench_start, NULL,
+			     op == BENCH_OP_POLL ? 2 : threads + 1);
+
+	if (op == BENCH_OP_POLL) {
+		start = bench_now();
+		bench_run_poll(&workers[0]);
+	} else {
+		for (i = 0; i < threads; i++)
+			pthread_create(&tids[i], NULL, bench_worker_fn,
+				       &workers[i]);
+		pthread_barrier_wait(&bench_start);
+		start = bench_now();
+		for (i = 0; i < threads; i++)
+			pthread_join(tids[i], NULL);
+	}
+
+	res->seconds = (bench_now() - start) / 1e9;
+	pthread_barrier_destroy(&bench_start);
+
+	for (i = 0; i < threads; i++) {
+		res->ops += workers[i].ops;
+		res->bytes += workers[i].bytes;
+		nr_all += workers[i].nr_samples;
+		if (!res->error)
+			res->error = workers[i].error;
+	}
+
+	all = malloc((nr_all ? nr_all : 1) * sizeof(*all));
+	if (all) {
+		nr_all = 0;
+		for (i = 0; i < threads; i++) {
+			memcpy(all + nr_all, workers[i].samples,
+			       workers[i].nr_samples * sizeof(*all));
+			nr_all += workers[i].nr_samples;
+		}
+		qsort(all, nr_all, sizeof(*all), bench_cmp_u64);
+		res->p50_ns = bench_percentile(all, nr_all, 0.50);
+		res->p99_ns = bench_percentile(all, nr_all, 0.99);
+		res->p999_ns = bench_percentile(all, nr_all, 0.999);
+		free(all);
+	}
+
+out_fini:
+	for (i = 0; i < threads; i++)
+		bench_worker_fini(&workers[i]);
+out_free:
+	free(workers);
+	free(tids);
+}
+
+static double bench_rate(const struct bench_result *res)
+{
+	return res->ops / (res->seconds > 0 ? res->seconds : 1);
+}
+
+/*
+ * Print one run. @base is the single-thread run of the same op and size,
+ * NULL if there is none, and gives the speedup.
+ */
+static void bench_print(const struct bench_config *cfg, enum bench_op op,
+			unsigned int threads, size_t size,
+			const struct bench_result *res,
+			const struct bench_result *base)
+{
+	double secs = res->seconds > 0 ? res->seconds : 1;
+	double speedup = 0;
+
+	if (base && bench_rate(base) > 0)
+		speedup = bench_rate(res) / bench_rate(base);
+
+	printf("{\"target\":\"%s\",\"op\":\"%s\",\"threads\":%u,"
+	       "\"node\":%d,"
+	       "\"size\":%zu,\"ops\":%llu,\"seconds\":%.6f,"
+	       "\"ops_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+	       "\"speedup\":%.2f,"
+	       "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+	       "\"error\":\"%s\"}\n",
+	       cfg->path, bench_op_names[op], threads, cfg->node, size,
+	       (unsigned long long)res->ops, res->seconds,
+	       res->ops / secs, res->bytes / secs, speedup,
+	       (unsigned long long)res->p50_ns,
+	       (unsigned long long)res->p99_ns,
+	       (unsigned long long)res->p999_ns,
+	       res->error ? strerror(res->error) : "");
+	fflush(stdout);
+}
+
+/* Parse "4k,64k,1m" style lists, returns the number of entries or -1 */
+static int bench_parse_sizes(const char *arg, size_t *out)
+{
+	char *list = strdup(arg), *save = NULL, *tok, *end;
+	unsigned long long v;
+	int n = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok && n < BENCH_MAX_SWEEP;
+	     tok = strtok_r(NULL, ",", &save)) {
+		v = strtoull(tok, &end, 0);
+		switch (*end) {
+		case 'g': case 'G':
+			v <<= 10;
+			/* fall through */
+		case 'm': case 'M':
+			v <<= 10;
+			/* fall through */
+		case 'k': case 'K':
+			v <<= 10;
+			end++;
+			break;
+		}
+		if (*end || !v) {
+			n = -1;
+			break;
+		}
+		out[n++] = v;
+	}
+
+	free(list);
+
+	return n;
+}
+
+/* Parse "0,1" style node lists, returns the number of entries or -1 */
+static int bench_parse_nodes(const char *arg, int *out)
+{
+	char *list = strdup(arg), *save = NULL, *tok, *end;
+	long v;
+	int n = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok && n < BENCH_MAX_SWEEP;
+	     tok = strtok_r(NULL, ",", &save)) {
+		v = strtol(tok, &end, 0);
+		if (*end || v < 0 || v >= 1024) {
+			n = -1;
+			break;
+		}
+		out[n++] = v;
+	}
+
+	free(list);
+
+	return n;
+}
+
+static int bench_parse_ops(const char *arg, unsigned int *ops)
+{
+	char *list = strdup(arg), *save = NULL, *tok;
+	unsigned int i;
+	int ret = 0;
+
+	*ops = 0;
+	for (tok = strtok_r(list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i <= BENCH_OP_MEMCPY; i++)
+			if (!strcmp(tok, bench_op_names[i]))
+				break;
+		if (i > BENCH_OP_MEMCPY) {
+			ret = -1;
+			break;
+		}
+		*ops |= 1u << i;
+	}
+
+	free(list);
+
+	return ret;
+}
+
+/**
+ * bench_bind_node() - Restrict a configuration to the CPUs of a NUMA node
+ * @cfg: configuration, @cfg->cpus holds the CPUs the process may run on
+ * @node: NUMA node
+ *
+ * The calling thread is bound to the node too, so that the buffers it
+ * allocates and touches for the workers come from the node.
+ *
+ * Return: 0 or -errno.
+ */
+static int bench_bind_node(struct bench_config *cfg, int node)
+{
+	unsigned int i, n = 0;
+	char path[64], *list, *tok;
+	cpu_set_t node_set, set;
+	int first, last;
+	size_t len = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	list = NULL;
+	if (getline(&list, &len, f) < 0) {
+		free(list);
+		fclose(f);
+		return -EINVAL;
+	}
+	fclose(f);
+
+	/* "0-7,16-23" */
+	CPU_ZERO(&node_set);
+	for (tok = strtok(list, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+		if (sscanf(tok, "%d-%d", &first, &last) != 2)
+			last = first = atoi(tok);
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, &node_set);
+	}
+	free(list);
+
+	CPU_ZERO(&set);
+	for (i = 0; i < cfg->nr_cpus; i++) {
+		if (CPU_ISSET(cfg->cpus[i], &node_set)) {
+			cfg->cpus[n++] = cfg->cpus[i];
+			CPU_SET(cfg->cpus[i], &set);
+		}
+	}
+	if (!n)
+		return -ENODEV;
+
+	cfg->nr_cpus = n;
+	cfg->pin = true;
+	cfg->node = node;
+
+	return sched_setaffinity(0, sizeof(set), &set) ? -errno : 0;
+}
+
+/* Apply a named set of options, later options override it */
+static int bench_preset(struct bench_config *cfg, const char *name)
+{
+	unsigned int i;
+
+	if (!strcmp(name, "copy-mmap")) {
+		cfg->ops = 1u << BENCH_OP_READ | 1u << BENCH_OP_WRITE |
+			   1u << BENCH_OP_MMAP | 1u << BENCH_OP_MMAP_WRITE;
+		/* 4 KiB to 1 GiB in steps of 4 */
+		for (i = 0; i < 10; i++)
+			cfg->sizes[i] = (size_t)4096 << (2 * i);
+		cfg->nr_sizes = i;
+		cfg->span = 0;
+		return 0;
+	}
+
+	if (!strcmp(name, "percpu-scaling")) {
+		cfg->ops = 1u << BENCH_OP_WRITE;
+		cfg->sizes[0] = 64;
+		cfg->nr_sizes = 1;
+		/* Powers of two up to the CPU count, then the CPU count */
+		cfg->nr_threads = 0;
+		for (i = 1; i < cfg->nr_cpus && cfg->nr_threads < BENCH_MAX_SWEEP - 1;
+		     i *= 2)
+			cfg->threads[cfg->nr_threads++] = i;
+		cfg->threads[cfg->nr_threads++] = cfg->nr_cpus;
+		cfg->pin = true;
+		return 0;
+	}
+
+	return -1;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d DEVICE [options]\n"
+		"  -d DEVICE   device node under test\n"
+		"  -o OPS      read,write,ioctl,mmap,mmap-write,poll,memcpy\n"
+		"              (default read)\n"
+		"  -i IOCTL    subdev-g-fmt or export-dmabuf (default subdev-g-fmt)\n"
+		"  -p PADS     subdev-g-fmt thread i uses pad i %% PADS (default 1)\n"
+		"  -t LIST     thread counts, e.g. 1,2,4,8 (default 1)\n"
+		"  -s LIST     buffer sizes, e.g. 4k,64k,1m (default 4k)\n"
+		"  -S SPAN     device range used by read/write/mmap (default one\n"
+		"              buffer per thread)\n"
+		"  -D SECONDS  duration of each run (default 1)\n"
+		"  -a          pin threads to distinct CPUs\n"
+		"  -N LIST     repeat every run on each NUMA node, e.g. 0,1\n"
+		"  -P PRESET   copy-mmap: read,write,mmap,mmap-write from 4k to 1g\n"
+		"              percpu-scaling: 64-byte writes, 1 to N pinned threads\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_config cfg = {
+		.ops = 1u << BENCH_OP_READ,
+		.ioctl = BENCH_IOCTL_SUBDEV_G_FMT,
+		.pads = 1,
+		.threads = { 1 },
+		.nr_threads = 1,
+		.sizes = { 4096 },
+		.nr_sizes = 1,
+		.duration_ns = 1000000000ull,
+		.node = -1,
+	};
+	struct bench_config run_cfg;
+	struct bench_result res, base;
+	size_t sizes[BENCH_MAX_SWEEP];
+	unsigned int op, t, s, i;
+	cpu_set_t set;
+	int opt, n, ret;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		CPU_ZERO(&set);
+	for (n = 0; n < CPU_SETSIZE; n++)
+		if (CPU_ISSET(n, &set))
+			cfg.cpus[cfg.nr_cpus++] = n;
+	if (!cfg.nr_cpus)
+		cfg.cpus[cfg.nr_cpus++] = 0;
+
+	while ((opt = getopt(argc, argv, "d:o:i:p:t:s:S:D:aN:P:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.path = optarg;
+			break;
+		case 'o':
+			if (bench_parse_ops(optarg, &cfg.ops))
+				goto usage;
+			break;
+		case 'i':
+			if (!strcmp(optarg, "subdev-g-fmt"))
+				cfg.ioctl = BENCH_IOCTL_SUBDEV_G_FMT;
+			else if (!strcmp(optarg, "export-dmabuf"))
+				cfg.ioctl = BENCH_IOCTL_EXPORT_DMABUF;
+			else
+				goto usage;
+			break;
+		case 'p':
+			cfg.pads = strtoul(optarg, NULL, 0);
+			if (!cfg.pads)
+				goto usage;
+			break;
+		case 't':
+			n = bench_parse_sizes(optarg, sizes);
+			if (n <= 0)
+				goto usage;
+			for (t = 0; t < (unsigned int)n; t++)
+				cfg.threads[t] = sizes[t];
+			cfg.nr_threads = n;
+			break;
+		case 's':
+			n = bench_parse_sizes(optarg, cfg.sizes);
+			if (n <= 0)
+				goto usage;
+			cfg.nr_sizes = n;
+			break;
+		case 'S':
+			if (bench_parse_sizes(optarg, sizes) != 1)
+				goto usage;
+			cfg.span = sizes[0];
+			break;
+		case 'D':
+			cfg.duration_ns = strtod(optarg, NULL) * 1e9;
+			break;
+		case 'a':
+			cfg.pin = true;
+			break;
+		case 'N':
+			n = bench_parse_nodes(optarg, cfg.nodes);
+			if (n <= 0)
+				goto usage;
+			cfg.nr_nodes = n;
+			break;
+		case 'P':
+			if (bench_preset(&cfg, optarg))
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (!cfg.path || !cfg.duration_ns)
+		goto usage;
+
+	for (i = 0; i < (cfg.nr_nodes ? cfg.nr_nodes : 1); i++) {
+		run_cfg = cfg;
+		if (cfg.nr_nodes) {
+			ret = bench_bind_node(&run_cfg, cfg.nodes[i]);
+			if (ret) {
+				fprintf(stderr, "node %d: %s\n", cfg.nodes[i],
+					strerror(-ret));
+				return 1;
+			}
+		}
+
+		for (op = 0; op <= BENCH_OP_MEMCPY; op++) {
+			if (!(cfg.ops & (1u << op)))
+				continue;
+
+			for (s = 0; s < cfg.nr_sizes; s++) {
+				base.ops = 0;
+				for (t = 0; t < cfg.nr_threads; t++) {
+					bench_run(&run_cfg, op, cfg.threads[t],
+						  cfg.sizes[s], &res);
+					if (cfg.threads[t] == 1 && !res.error)
+						base = res;
+					bench_print(&run_cfg, op,
+						    op == BENCH_OP_POLL ?
+						    1 : cfg.threads[t],
+						    cfg.sizes[s], &res,
+						    base.ops ? &base : NULL);
+					if (op == BENCH_OP_POLL)
+						break;
+				}
+			}
+		}
+	}
+
+	return 0;
+
+usage:
+	bench_usage(argv[0]);
+
+	return 1;
+}
@@ -55,6 +55,9 @@
 #define OV9282_REG_MIN		0x00
 #define OV9282_REG_MAX		0xfffff
 
+/* Maximum number of register writes collected in one control batch */
+#define OV9282_BATCH_MAX	16
+
 /**
  * struct ov9282_reg - ov9282 sensor register
  * @address: Register address
@@ -109,6 +112,7 @@ struct ov9282_mode {
  * @pad: Media pad. Only one pad supported
  * @reset_gpio: Sensor reset gpio
  * @inclk: Sensor input clock
+ * @ep_cfg: Shared description of the CSI-2 endpoint
  * @ctrl_handler: V4L2 control handler
  * @link_freq_ctrl: Pointer to link frequency control
  * @pclk_ctrl: Pointer to pixel clock control
@@ -120,6 +124,10 @@ struct ov9282_mode {
  * @cur_mode: Pointer to current selected sensor mode
  * @mutex: Mutex for serializing sensor controls
  * @streaming: Flag indicating streaming state
+ * @batch_msgs: I2C messages collected between batch_begin and batch_end
+ * @batch_buf: Payloads of @batch_msgs
+ * @batch_len: Number of collected messages
+ * @batch_active: Register writes are collected instead of sent
  */
 struct ov9282 {
 	struct device *dev;
@@ -128,6 +136,7 @@ struct ov9282 {
 	struct media_pad pad;
 	struct gpio_desc *reset_gpio;
 	struct clk *inclk;
+	const struct v4l2_fwnode_endpoint *ep_cfg;
 	struct v4l2_ctrl_handler ctrl_handler;
 	struct v4l2_ctrl *link_freq_ctrl;
 	struct v4l2_ctrl *pclk_ctrl;
@@ -141,6 +150,10 @@ struct ov9282 {
 	const struct ov9282_mode *cur_mode;
 	struct mutex mutex;
 	bool streaming;
+	struct i2c_msg batch_msgs[OV9282_BATCH_MAX];
+	u8 batch_buf[OV9282_BATCH_MAX][6];
+	u32 batch_len;
+	bool batch_active;
 };
 
 static const s64 link_freq[] = {
@@ -267,6 +280,83 @@ static const struct ov9282_mode supported_mode = {
 	},
 };
 
+/**
+ * to_ov9282() - ov9282 V4L2 sub-device to ov9282 device.
+ * @subdev: pointer to ov9282 V4L2 sub-device
+ *
+ * Return: pointer to ov9282 device
+ */
+static inline struct ov9282 *to_ov9282(struct v4l2_subdev *subdev)
+{
+	return container_of(subdev, struct ov9282, sd);
+}
+
+/**
+ * ov9282_parse_hw_config() - Parse HW configuration and check if supported
+ * @ov9282: pointer to ov9282 device
+ *
+ * The endpoint is obtained from the shared fwnode endpoint cache, so that
+ * the CSI-2 receiver reading the same endpoint does not parse it again.
+ * The reference is kept in @ov9282->ep_cfg until the device is unbound.
+ * A device without a graph endpoint is left unchecked, as before the
+ * endpoint was parsed, and @ov9282->ep_cfg stays NULL.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int ov9282_parse_hw_config(struct ov9282 *ov9282)
+{
+	struct fwnode_handle *fwnode = dev_fwnode(ov9282->dev);
+	const struct v4l2_fwnode_endpoint *bus_cfg;
+	struct fwnode_handle *ep;
+	unsigned int i;
+	int ret;
+
+	if (!fwnode)
+		return 0;
+
+	ep = fwnode_graph_get_next_endpoint(fwnode, NULL);
+	if (!ep) {
+		dev_dbg(ov9282->dev, "no endpoint, bus configuration not checked");
+		return 0;
+	}
+
+	bus_cfg = v4l2_fwnode_endpoint_get(ep, V4L2_MBUS_CSI2_DPHY);
+	fwnode_handle_put(ep);
+	if (IS_ERR(bus_cfg))
+		return PTR_ERR(bus_cfg);
+
+	if (bus_cfg->bus.mipi_csi2.num_data_lanes != OV9282_NUM_DATA_LANES) {
+		dev_err(ov9282->dev,
+			"number of CSI2 data lanes %d is not supported",
+			bus_cfg->bus.mipi_csi2.num_data_lanes);
+		ret = -EINVAL;
+		goto error_endpoint_put;
+	}
+
+	if (!bus_cfg->nr_of_link_frequencies) {
+		dev_err(ov9282->dev, "no link frequencies defined");
+		ret = -EINVAL;
+		goto error_endpoint_put;
+	}
+
+	for (i = 0; i < bus_cfg->nr_of_link_frequencies; i++) {
+		if (bus_cfg->link_frequencies[i] == OV9282_LINK_FREQ) {
+			ov9282->ep_cfg = bus_cfg;
+			return 0;
+		}
+	}
+
+	ret = -EINVAL;
+
+error_endpoint_put:
+	v4l2_fwnode_endpoint_put(bus_cfg);
+
+	return ret;
+}
+
+static const struct v4l2_subdev_ops ov9282_subdev_ops = {
+};
+
 /**
  * ov9282_probe() - I2C client device binding
  * @client: pointer to i2c client device
@@ -275,7 +365,27 @@ static const struct ov9282_mode supported_mode = {
  */
 static int ov9282_probe(struct i2c_client *client)
 {
+	struct ov9282 *ov9282;
+	int ret;
+
 	printk("hello kernel");
+
+	ov9282 = devm_kzalloc(&client->dev, sizeof(*ov9282), GFP_KERNEL);
+	if (!ov9282)
+		return -ENOMEM;
+
+	ov9282->dev = &client->dev;
+	ov9282->client = client;
+
+	/* Also stores the subdev as client data for the runtime PM callbacks */
+	v4l2_i2c_subdev_init(&ov9282->sd, client, &ov9282_subdev_ops);
+
+	ret = ov9282_parse_hw_config(ov9282);
+	if (ret) {
+		dev_err(ov9282->dev, "HW configuration is not supported");
+		return ret;
+	}
+
 	return 0;
 }
 
@@ -287,8 +397,13 @@ static int ov9282_probe(struct i2c_client *client)
  */
 static int ov9282_remove(struct i2c_client *client)
 {
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ov9282 *ov9282 = to_ov9282(sd);
+
 	printk("goodbye kernel");
 
+	v4l2_fwnode_endpoint_put(ov9282->ep_cfg);
+
 	return 0;
 }
 
@@ -297,17 +412,258 @@ static const struct of_device_id ov9282_of_match[] = {
 	{ .compatible = "qcom,msm-cdc-pinctrl" },
 	{ }
 };
+
 /**
- * to_ov9282() - ov9282 V4L2 sub-device to ov9282 device.
- * @subdev: pointer to ov9282 V4L2 sub-device
+ * ov9282_flush_batch() - Send the collected register writes
+ * @ov9282: pointer to ov9282 device
  *
- * Return: pointer to ov9282 device
+ * All collected writes go out in a single I2C transfer.
+ *
+ * Return: 0 if successful, error code otherwise.
  */
-static inline struct ov9282 *to_ov9282(struct v4l2_subdev *subdev)
+static int ov9282_flush_batch(struct ov9282 *ov9282)
 {
-	return container_of(subdev, struct ov9282, sd);
+	int num = ov9282->batch_len;
+	int ret;
+
+	if (!num)
+		return 0;
+
+	ov9282->batch_len = 0;
+	ret = i2c_transfer(ov9282->client->adapter, ov9282->batch_msgs, num);
+	if (ret != num)
+		return ret < 0 ? ret : -EIO;
+
+	return 0;
 }
 
+/**
+ * ov9282_write_reg() - Write register
+ * @ov9282: pointer to ov9282 device
+ * @reg: register address
+ * @len: length of bytes. Max supported bytes is 4
+ * @val: register value
+ *
+ * Between ov9282_ctrl_batch_begin() and ov9282_ctrl_batch_end() the write
+ * is only queued.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int ov9282_write_reg(struct ov9282 *ov9282, u16 reg, u32 len, u32 val)
+{
+	struct i2c_msg *msg;
+	u8 buf[6] = {0};
+	int ret;
+
+	if (WARN_ON(len > 4))
+		return -EINVAL;
+
+	put_unaligned_be16(reg, buf);
+	put_unaligned_be32(val << (8 * (4 - len)), buf + 2);
+
+	if (!ov9282->batch_active) {
+		if (i2c_master_send(ov9282->client, buf, len + 2) != len + 2)
+			return -EIO;
+
+		return 0;
+	}
+
+	if (ov9282->batch_len == OV9282_BATCH_MAX) {
+		ret = ov9282_flush_batch(ov9282);
+		if (ret)
+			return ret;
+	}
+
+	msg = &ov9282->batch_msgs[ov9282->batch_len];
+	memcpy(ov9282->batch_buf[ov9282->batch_len], buf, sizeof(buf));
+	msg->addr = ov9282->client->addr;
+	msg->flags = 0;
+	msg->len = len + 2;
+	msg->buf = ov9282->batch_buf[ov9282->batch_len];
+	ov9282->batch_len++;
+
+	return 0;
+}
+
+/**
+ * ov9282_update_exp_gain() - Set updated frame length, exposure and gain
+ * @ov9282: pointer to ov9282 device
+ * @exposure: updated exposure value
+ * @gain: updated analog gain value
+ *
+ * The frame length follows the current vertical blanking. Outside of a
+ * control batch the registers are written under their own group hold,
+ * inside a batch the batch group hold covers them.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int ov9282_update_exp_gain(struct ov9282 *ov9282, u32 exposure, u32 gain)
+{
+	bool hold = !ov9282->batch_active;
+	u32 lpfr;
+	int ret;
+
+	lpfr = ov9282->vblank + ov9282->cur_mode->height;
+
+	dev_dbg(ov9282->dev, "Set exp %u, analog gain %u, lpfr %u",
+		exposure, gain, lpfr);
+
+	if (hold) {
+		ret = ov9282_write_reg(ov9282, OV9282_REG_HOLD, 1, 1);
+		if (ret)
+			return ret;
+	}
+
+	ret = ov9282_write_reg(ov9282, OV9282_REG_LPFR, 2, lpfr);
+	if (ret)
+		goto error_release_group_hold;
+
+	ret = ov9282_write_reg(ov9282, OV9282_REG_EXPOSURE, 3, exposure << 4);
+	if (ret)
+		goto error_release_group_hold;
+
+	ret = ov9282_write_reg(ov9282, OV9282_REG_AGAIN, 1, gain);
+
+error_release_group_hold:
+	if (hold)
+		ov9282_write_reg(ov9282, OV9282_REG_HOLD, 1, 0);
+
+	return ret;
+}
+
+/**
+ * ov9282_set_ctrl() - Set subdevice control
+ * @ctrl: pointer to v4l2_ctrl structure
+ *
+ * Supported controls:
+ * - V4L2_CID_VBLANK
+ * - cluster controls:
+ *   - V4L2_CID_ANALOGUE_GAIN
+ *   - V4L2_CID_EXPOSURE
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int ov9282_set_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct ov9282 *ov9282 =
+		container_of(ctrl->handler, struct ov9282, ctrl_handler);
+	u32 analog_gain;
+	u32 exposure;
+	int ret;
+
+	switch (ctrl->id) {
+	case V4L2_CID_VBLANK:
+		ov9282->vblank = ov9282->vblank_ctrl->val;
+
+		dev_dbg(ov9282->dev, "Received vblank %u, new lpfr %u",
+			ov9282->vblank,
+			ov9282->vblank + ov9282->cur_mode->height);
+
+		ret = __v4l2_ctrl_modify_range(ov9282->exp_ctrl,
+					       OV9282_EXPOSURE_MIN,
+					       ov9282->vblank +
+					       ov9282->cur_mode->height -
+					       OV9282_EXPOSURE_OFFSET,
+					       1, OV9282_EXPOSURE_DEFAULT);
+		if (ret)
+			break;
+
+		/* Set controls only if sensor is in power on state */
+		if (!ov9282->batch_active && !pm_runtime_get_if_in_use(ov9282->dev))
+			return 0;
+
+		/* The frame length goes out with the (possibly clamped) exposure */
+		ret = ov9282_update_exp_gain(ov9282, ov9282->exp_ctrl->val,
+					     ov9282->again_ctrl->val);
+
+		if (!ov9282->batch_active)
+			pm_runtime_put(ov9282->dev);
+		break;
+	case V4L2_CID_EXPOSURE:
+		/* Set controls only if sensor is in power on state */
+		if (!ov9282->batch_active && !pm_runtime_get_if_in_use(ov9282->dev))
+			return 0;
+
+		exposure = ctrl->val;
+		analog_gain = ov9282->again_ctrl->val;
+
+		ret = ov9282_update_exp_gain(ov9282, exposure, analog_gain);
+
+		if (!ov9282->batch_active)
+			pm_runtime_put(ov9282->dev);
+		break;
+	default:
+		dev_err(ov9282->dev, "Invalid control %d", ctrl->id);
+		ret = -EINVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * ov9282_ctrl_batch_begin() - Open a group hold for a batch of controls
+ * @hdl: pointer to the ov9282 control handler
+ *
+ * Nothing is collected while the sensor is powered off, the control values
+ * are then applied by the mode setup at stream on like for single writes.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int ov9282_ctrl_batch_begin(struct v4l2_ctrl_handler *hdl)
+{
+	struct ov9282 *ov9282 =
+		container_of(hdl, struct ov9282, ctrl_handler);
+	int ret;
+
+	if (!pm_runtime_get_if_in_use(ov9282->dev))
+		return 0;
+
+	ov9282->batch_active = true;
+	ov9282->batch_len = 0;
+
+	ret = ov9282_write_reg(ov9282, OV9282_REG_HOLD, 1, 1);
+	if (ret) {
+		ov9282->batch_active = false;
+		pm_runtime_put(ov9282->dev);
+	}
+
+	return ret;
+}
+
+/**
+ * ov9282_ctrl_batch_end() - Release the group hold and flush the batch
+ * @hdl: pointer to the ov9282 control handler
+ * @error: first error returned by ov9282_set_ctrl() in this batch
+ *
+ * The group hold is released even on error so that the sensor does not
+ * stay latched; the writes that were queued before the error are applied.
+ */
+static void ov9282_ctrl_batch_end(struct v4l2_ctrl_handler *hdl, int error)
+{
+	struct ov9282 *ov9282 =
+		container_of(hdl, struct ov9282, ctrl_handler);
+	int ret;
+
+	if (!ov9282->batch_active)
+		return;
+
+	ov9282_write_reg(ov9282, OV9282_REG_HOLD, 1, 0);
+	ov9282->batch_active = false;
+
+	ret = ov9282_flush_batch(ov9282);
+	if (ret)
+		dev_err(ov9282->dev, "failed to flush control batch: %d", ret);
+
+	pm_runtime_put(ov9282->dev);
+}
+
+/* V4l2 subdevice control ops*/
+static const struct v4l2_ctrl_ops ov9282_ctrl_ops = {
+	.s_ctrl = ov9282_set_ctrl,
+	.batch_begin = ov9282_ctrl_batch_begin,
+	.batch_end = ov9282_ctrl_batch_end,
+};
+
 /**
  * ov9282_power_on() - Sensor power on sequence
  * @dev: pointer to i2c device
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Closed-loop auto exposure and gain for the ov9282
+ *
+ * The controller works on the total exposure, exposure lines times gain
+ * code. Every frame it compares the weighted mean of the frame to the
+ * target and scales the total exposure that frame was actually taken with,
+ * looked up in the history of queued settings, not the latest queued one.
+ * Frames still in flight therefore do not make it correct the same error
+ * twice, whatever the sensor latency.
+ *
+ * The total is then split preferring exposure: gain stays at its minimum
+ * until the exposure reaches the motion blur limit, then rises up to its
+ * maximum, and only then does the exposure go past the blur limit up to
+ * the frame length.
+ *
+ * Build: gcc -O2 -c ov9282_ae.c raw10_stats.c raw10_unpack.c -lm
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#include "ov9282_ae.h"
+
+/* Largest correction of the total exposure in one update */
+#define OV9282_AE_MAX_STEP	8.0
+/* Correction applied while more pixels than the clip limit saturate */
+#define OV9282_AE_CLIP_STEP	0.8
+
+static int ov9282_ae_query_range(int fd, uint32_t id, unsigned int *min,
+				 unsigned int *max)
+{
+	struct v4l2_queryctrl qc = { .id = id };
+
+	if (ioctl(fd, VIDIOC_QUERYCTRL, &qc))
+		return -errno;
+
+	*min = qc.minimum;
+	*max = qc.maximum;
+	return 0;
+}
+
+static int ov9282_ae_get_ctrl(int fd, uint32_t id, int64_t *val)
+{
+	struct v4l2_ext_control ctrl = { .id = id };
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 1,
+		.controls = &ctrl,
+	};
+
+	if (ioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls))
+		return -errno;
+
+	*val = id == V4L2_CID_PIXEL_RATE ? ctrl.value64 : ctrl.value;
+	return 0;
+}
+
+int ov9282_ae_cfg_init(struct ov9282_ae_cfg *cfg, int fd)
+{
+	struct v4l2_subdev_format fmt = {
+		.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+	};
+	unsigned int width = 1280;
+	int64_t pixel_rate = 0, hblank = 0;
+	int ret;
+
+	/* 1280x720, hblank 250, vblank 1022, 160 MHz pixel clock */
+	*cfg = (struct ov9282_ae_cfg) {
+		.exposure_min = OV9282_AE_EXPOSURE_MIN,
+		.exposure_max = 720 + 1022 - OV9282_AE_EXPOSURE_OFFSET,
+		.gain_min = OV9282_AE_AGAIN_MIN,
+		.gain_max = OV9282_AE_AGAIN_MAX,
+		.line_time_ns = (1280 + 250) * 1000 / 160,
+		.blur_limit_us = 10000,
+		.latency = 2,
+		.target = 256,
+		.tolerance = 8,
+		.damping = 0.5,
+		.clip_limit = 0.02,
+	};
+
+	if (fd < 0)
+		return 0;
+
+	ret = ov9282_ae_query_range(fd, V4L2_CID_EXPOSURE, &cfg->exposure_min,
+				    &cfg->exposure_max);
+	if (ret)
+		return ret;
+	ret = ov9282_ae_query_range(fd, V4L2_CID_ANALOGUE_GAIN, &cfg->gain_min,
+				    &cfg->gain_max);
+	if (ret)
+		return ret;
+
+	/* Video nodes have no pad format, keep the default width */
+	if (!ioctl(fd, VIDIOC_SUBDEV_G_FMT, &fmt))
+		width = fmt.format.width;
+
+	if (!ov9282_ae_get_ctrl(fd, V4L2_CID_PIXEL_RATE, &pixel_rate) &&
+	    !ov9282_ae_get_ctrl(fd, V4L2_CID_HBLANK, &hblank) && pixel_rate > 0)
+		cfg->line_time_ns = (width + hblank) * 1000000000LL / pixel_rate;
+
+	return 0;
+}
+
+static double ov9282_ae_clamp(double val, double min, double max)
+{
+	return val < min ? min : val > max ? max : val;
+}
+
+int ov9282_ae_init(struct ov9282_ae *ae, const struct ov9282_ae_cfg *cfg,
+		   unsigned int exposure, unsigned int gain)
+{
+	if (!cfg->exposure_min || cfg->exposure_min > cfg->exposure_max ||
+	    !cfg->gain_min || cfg->gain_min > cfg->gain_max ||
+	    !cfg->line_time_ns || cfg->latency >= OV9282_AE_HISTORY ||
+	    !cfg->target || cfg->target > 1023 ||
+	    !(cfg->damping > 0 && cfg->damping <= 1))
+		return -EINVAL;
+
+	memset(ae, 0, sizeof(*ae));
+	ae->cfg = *cfg;
+	ae->last.exposure = ov9282_ae_clamp(exposure, cfg->exposure_min,
+					    cfg->exposure_max);
+	ae->last.gain = ov9282_ae_clamp(gain, cfg->gain_min, cfg->gain_max);
+
+	return 0;
+}
+
+void ov9282_ae_set_exposure_max(struct ov9282_ae *ae,
+				unsigned int exposure_max)
+{
+	if (exposure_max < ae->cfg.exposure_min)
+		exposure_max = ae->cfg.exposure_min;
+
+	ae->cfg.exposure_max = exposure_max;
+}
+
+/*
+ * Setting frame @sequence was taken with. If its slot was overwritten or
+ * never filled, e.g. after dropped frames, the sensor still holds the
+ * newest setting queued for an earlier frame, or failing that the latest
+ * one queued.
+ */
+static const struct ov9282_ae_setting *
+ov9282_ae_lookup(const struct ov9282_ae *ae, uint32_t sequence)
+{
+	const struct ov9282_ae_setting *s, *best = NULL;
+	unsigned int i;
+
+	s = &ae->history[sequence % OV9282_AE_HISTORY];
+	if (s->gain && s->sequence == sequence)
+		return s;
+
+	for (i = 0; i < OV9282_AE_HISTORY; i++) {
+		s = &ae->history[i];
+		if (!s->gain || (int32_t)(sequence - s->sequence) < 0)
+			continue;
+		if (!best || (int32_t)(s->sequence - best->sequence) > 0)
+			best = s;
+	}
+
+	return best ? best : &ae->last;
+}
+
+/* Split @total into exposure and gain, preferring exposure */
+static void ov9282_ae_split(const struct ov9282_ae_cfg *cfg, double total,
+			    struct ov9282_ae_setting *s)
+{
+	double blur = cfg->exposure_max;
+	double exposure, gain;
+
+	if (cfg->blur_limit_us)
+		blur = ov9282_ae_clamp(cfg->blur_limit_us * 1000.0 /
+				       cfg->line_time_ns,
+				       cfg->exposure_min, cfg->exposure_max);
+
+	exposure = total / cfg->gain_min;
+	gain = cfg->gain_min;
+	if (exposure > blur) {
+		exposure = blur;
+		gain = total / blur;
+		if (gain > cfg->gain_max) {
+			gain = cfg->gain_max;
+			exposure = total / gain;
+		}
+	}
+
+	s->exposure = lround(ov9282_ae_clamp(exposure, cfg->exposure_min,
+					     cfg->exposure_max));
+	s->gain = lround(ov9282_ae_clamp(gain, cfg->gain_min, cfg->gain_max));
+}
+
+void ov9282_ae_process(struct ov9282_ae *ae, uint32_t sequence,
+		       const struct raw10_stats *stats,
+		       struct ov9282_ae_setting *next)
+{
+	const struct ov9282_ae_cfg *cfg = &ae->cfg;
+	const struct ov9282_ae_setting *cur = ov9282_ae_lookup(ae, sequence);
+	double mean = stats->weighted_mean > 1 ? stats->weighted_mean : 1;
+	double ratio = cfg->target / mean;
+	bool clipped = false;
+
+	if (cfg->clip_limit && stats->count)
+		clipped = (double)stats->clipped_high / stats->count >
+			  cfg->clip_limit;
+
+	ae->converged = !clipped && fabs(mean - cfg->target) <= cfg->tolerance;
+
+	if (ae->converged)
+		ratio = 1;
+	else if (clipped && ratio > OV9282_AE_CLIP_STEP)
+		ratio = OV9282_AE_CLIP_STEP;
+
+	/* Damp geometrically, exposure acts multiplicatively */
+	ratio = ov9282_ae_clamp(pow(ratio, cfg->damping),
+				1 / OV9282_AE_MAX_STEP, OV9282_AE_MAX_STEP);
+
+	next->sequence = sequence + cfg->latency;
+	ov9282_ae_split(cfg, (double)cur->exposure * cur->gain * ratio, next);
+
+	ae->history[next->sequence % OV9282_AE_HISTORY] = *next;
+	ae->last = *next;
+}
+
+int ov9282_ae_apply(int fd, int request_fd,
+		    const struct ov9282_ae_setting *setting)
+{
+	struct v4l2_ext_control ctrl[] = {
+		{ .id = V4L2_CID_EXPOSURE, .value = setting->exposure },
+		{ .id = V4L2_CID_ANALOGUE_GAIN, .value = setting->gain },
+	};
+	struct v4l2_ext_controls ctrls = {
+		.which = request_fd < 0 ? V4L2_CTRL_WHICH_CUR_VAL
+					: V4L2_CTRL_WHICH_REQUEST_VAL,
+		.count = 2,
+		.request_fd = request_fd,
+		.controls = ctrl,
+	};
+
+	return ioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls) ? -errno : 0;
+}
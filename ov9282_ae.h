@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Closed-loop auto exposure and gain for the ov9282
+ *
+ * Feeds on the raw10_stats of every frame and returns the exposure (in
+ * lines, V4L2_CID_EXPOSURE) and analogue gain (V4L2_CID_ANALOGUE_GAIN,
+ * 0x10 is 1x) to program a number of frames ahead, for a media request
+ * queued with the buffer of that frame.
+ */
+#ifndef _OV9282_AE_H
+#define _OV9282_AE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "raw10_stats.h"
+
+/* Driver limits, for use without a sensor at hand */
+#define OV9282_AE_EXPOSURE_MIN		1
+#define OV9282_AE_EXPOSURE_OFFSET	12
+#define OV9282_AE_AGAIN_MIN		0x10
+#define OV9282_AE_AGAIN_MAX		0xff
+#define OV9282_AE_AGAIN_UNITY		0x10
+
+/* Settings remembered per frame, must exceed the sensor latency */
+#define OV9282_AE_HISTORY		16
+
+/**
+ * struct ov9282_ae_cfg - controller configuration
+ * @exposure_min, @exposure_max: exposure range in lines, the maximum being
+ *	the frame length minus OV9282_AE_EXPOSURE_OFFSET
+ * @gain_min, @gain_max: analogue gain code range
+ * @line_time_ns: duration of one line, (width + hblank) / pixel rate
+ * @blur_limit_us: longest exposure used before raising the gain, 0 for
+ *	none; exceeded only once the gain is at its maximum
+ * @latency: frames between queueing a setting and the first frame it
+ *	applies to
+ * @target: aimed weighted mean, in 10-bit levels
+ * @tolerance: deviation from @target, in levels, left uncorrected
+ * @damping: fraction of the error corrected per update, in (0, 1]
+ * @clip_limit: fraction of saturated pixels above which the target is
+ *	lowered to protect highlights, 0 to disable
+ */
+struct ov9282_ae_cfg {
+	unsigned int exposure_min, exposure_max;
+	unsigned int gain_min, gain_max;
+	unsigned int line_time_ns;
+	unsigned int blur_limit_us;
+	unsigned int latency;
+	unsigned int target;
+	unsigned int tolerance;
+	double damping;
+	double clip_limit;
+};
+
+/**
+ * struct ov9282_ae_setting - exposure and gain of one frame
+ * @sequence: frame the setting applies to
+ * @exposure: exposure in lines
+ * @gain: analogue gain code
+ */
+struct ov9282_ae_setting {
+	uint32_t sequence;
+	unsigned int exposure;
+	unsigned int gain;
+};
+
+/**
+ * struct ov9282_ae - controller state
+ * @cfg: configuration
+ * @history: settings of the frames up to the latest queued one, by
+ *	sequence modulo OV9282_AE_HISTORY
+ * @last: latest queued setting, the one current on the sensor until the
+ *	controller queued any
+ * @converged: the last measured frame was within tolerance
+ */
+struct ov9282_ae {
+	struct ov9282_ae_cfg cfg;
+	struct ov9282_ae_setting history[OV9282_AE_HISTORY];
+	struct ov9282_ae_setting last;
+	bool converged;
+};
+
+/*
+ * Fill @cfg with defaults for a 1280x720 mode at the driver default
+ * vblank, and if @fd is a subdev or video node of the sensor, with the
+ * ranges and timings it reports. Returns 0 or -errno.
+ */
+int ov9282_ae_cfg_init(struct ov9282_ae_cfg *cfg, int fd);
+
+/*
+ * Start from @exposure and @gain, the values current on the sensor.
+ * Returns -EINVAL on invalid configuration.
+ */
+int ov9282_ae_init(struct ov9282_ae *ae, const struct ov9282_ae_cfg *cfg,
+		   unsigned int exposure, unsigned int gain);
+
+/*
+ * Change the exposure limit after a vblank change, the controller clamps
+ * its next settings to it
+ */
+void ov9282_ae_set_exposure_max(struct ov9282_ae *ae,
+				unsigned int exposure_max);
+
+/*
+ * Account the statistics of frame @sequence and compute the setting of
+ * frame @sequence + latency into @next.
+ */
+void ov9282_ae_process(struct ov9282_ae *ae, uint32_t sequence,
+		       const struct raw10_stats *stats,
+		       struct ov9282_ae_setting *next);
+
+/*
+ * Store @setting in the request @request_fd through the sensor controls
+ * at @fd, or set them immediately if @request_fd is negative. The request
+ * is queued by the caller with the buffer of setting->sequence. Returns 0
+ * or -errno.
+ */
+int ov9282_ae_apply(int fd, int request_fd,
+		    const struct ov9282_ae_setting *setting);
+
+#endif
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Convergence benchmark for ov9282_ae.c on an emulated sensor
+ *
+ * The emulated sensor applies the setting queued for a frame when that
+ * frame starts, keeps it until the next one and exposes a scene of 256
+ * reflectances spread over a 50:1 range. Pixels are the reflectance times
+ * the scene illuminance, the exposure in lines and the gain, with 1%
+ * multiplicative noise, and saturate at 1023. The statistics of every
+ * frame go to ov9282_ae_process() and the settings it returns are queued
+ * on the sensor latency frames ahead, as a media request would.
+ *
+ * The illuminance then goes through a series of steps, and for each one
+ * the tool prints one JSON object with the frames from the step to the
+ * first of -s consecutive frames within tolerance of the target, and the
+ * setting it settled on. With -d, that share of the frames is dropped
+ * before their statistics reach the controller, as with a slow consumer.
+ *
+ * Build: gcc -O2 -o ov9282_ae_bench ov9282_ae_bench.c ov9282_ae.c -lm
+ *
+ * Examples:
+ *   ov9282_ae_bench
+ *   ov9282_ae_bench -l 3 -D 0.7
+ *   ov9282_ae_bench -d 20 -s 8
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ov9282_ae.h"
+
+#define BENCH_REFLECTANCES	256
+#define BENCH_MAX_FRAMES	300
+#define BENCH_NOISE		0.01
+
+/* Illuminance changes applied one after the other */
+static const double bench_steps[] = { 8, 1.0 / 64, 8, 2, 0.5, 30, 1.0 / 30 };
+
+/**
+ * struct bench_sensor - emulated sensor
+ * @queued: settings queued for upcoming frames, by sequence modulo
+ *	OV9282_AE_HISTORY
+ * @cur: setting of the frame being exposed
+ * @reflectance: scene content
+ * @lux: scene illuminance
+ */
+struct bench_sensor {
+	struct ov9282_ae_setting queued[OV9282_AE_HISTORY];
+	struct ov9282_ae_setting cur;
+	double reflectance[BENCH_REFLECTANCES];
+	double lux;
+};
+
+static double bench_noise(void)
+{
+	return 1 + BENCH_NOISE * (2.0 * rand() / RAND_MAX - 1);
+}
+
+/* Expose frame @sequence and return its statistics in @stats */
+static void bench_sensor_frame(struct bench_sensor *sensor, uint32_t sequence,
+			       struct raw10_stats *stats)
+{
+	const struct ov9282_ae_setting *s =
+		&sensor->queued[sequence % OV9282_AE_HISTORY];
+	double scale;
+	unsigned int i, v;
+
+	if (s->gain && s->sequence == sequence)
+		sensor->cur = *s;
+
+	scale = sensor->lux * sensor->cur.exposure * sensor->cur.gain /
+		OV9282_AE_AGAIN_UNITY;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < BENCH_REFLECTANCES; i++) {
+		v = fmin(lround(sensor->reflectance[i] * scale * bench_noise()),
+			 1023);
+		stats->hist[v >> 2]++;
+		stats->count++;
+		stats->sum += v;
+		if (v >= 1023)
+			stats->clipped_high++;
+		if (!v)
+			stats->clipped_low++;
+	}
+
+	stats->weighted_sum = stats->sum;
+	stats->weight = stats->count;
+	stats->mean = (double)stats->sum / stats->count;
+	stats->weighted_mean = stats->mean;
+}
+
+static void bench_sensor_init(struct bench_sensor *sensor,
+			      unsigned int exposure, unsigned int gain,
+			      double lux)
+{
+	unsigned int i;
+
+	memset(sensor, 0, sizeof(*sensor));
+	for (i = 0; i < BENCH_REFLECTANCES; i++)
+		sensor->reflectance[i] = 0.02 * pow(50, (double)i /
+						    (BENCH_REFLECTANCES - 1));
+	sensor->cur.exposure = exposure;
+	sensor->cur.gain = gain;
+	sensor->lux = lux;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -l FRAMES   sensor latency (default 2)\n"
+		"  -D DAMPING  fraction of the error corrected per frame (default 0.5)\n"
+		"  -d PERCENT  frames dropped before the controller (default 0)\n"
+		"  -s FRAMES   consecutive frames within tolerance to settle (default 4)\n"
+		"  -h          this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct ov9282_ae_setting next;
+	struct bench_sensor sensor;
+	struct ov9282_ae_cfg cfg;
+	struct raw10_stats stats;
+	unsigned int drop = 0, settle = 4, streak, i;
+	uint32_t sequence = 0, start;
+	struct ov9282_ae ae;
+	int opt, ret;
+
+	ov9282_ae_cfg_init(&cfg, -1);
+
+	while ((opt = getopt(argc, argv, "l:D:d:s:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			cfg.latency = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			cfg.damping = strtod(optarg, NULL);
+			break;
+		case 'd':
+			drop = strtoul(optarg, NULL, 0);
+			if (drop >= 100) {
+				fprintf(stderr, "invalid drop ratio '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			settle = strtoul(optarg, NULL, 0);
+			if (!settle) {
+				fprintf(stderr, "invalid settle count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	/* Start settled at half the blur limit: mean reflectance is ~0.25 */
+	ret = ov9282_ae_init(&ae, &cfg, 500, OV9282_AE_AGAIN_UNITY);
+	if (ret) {
+		fprintf(stderr, "ov9282_ae_init: %s\n", strerror(-ret));
+		return 1;
+	}
+	bench_sensor_init(&sensor, 500, OV9282_AE_AGAIN_UNITY,
+			  cfg.target / (0.25 * 500));
+
+	srand(1);
+	for (i = 0; i < sizeof(bench_steps) / sizeof(bench_steps[0]); i++) {
+		sensor.lux *= bench_steps[i];
+		start = sequence;
+		streak = 0;
+
+		while (streak < settle && sequence - start < BENCH_MAX_FRAMES) {
+			bench_sensor_frame(&sensor, sequence, &stats);
+
+			if (fabs(stats.weighted_mean - cfg.target) <= cfg.tolerance)
+				streak++;
+			else
+				streak = 0;
+
+			if ((unsigned int)rand() % 100 >= drop) {
+				ov9282_ae_process(&ae, sequence, &stats, &next);
+				sensor.queued[next.sequence % OV9282_AE_HISTORY] =
+					next;
+			}
+			sequence++;
+		}
+
+		printf("{\"step\":%.4f,\"latency\":%u,\"damping\":%.2f,"
+		       "\"drop_percent\":%u,\"converged\":%s,"
+		       "\"frames\":%d,\"exposure\":%u,\"gain\":%u,"
+		       "\"mean\":%.1f}\n",
+		       bench_steps[i], cfg.latency, cfg.damping, drop,
+		       streak >= settle ? "true" : "false",
+		       streak >= settle ? (int)(sequence - start - settle) : -1,
+		       sensor.cur.exposure, sensor.cur.gain,
+		       stats.weighted_mean);
+	}
+
+	return 0;
+}
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Capture tool for ov9282 pipelines
+ *
+ * Streams from a V4L2 capture node through the recycled buffer pool of
+ * v4l2_capture.c. Frames are passed by reference to a consumer thread that
+ * optionally writes them to a file, so the dequeue loop never copies or
+ * waits for I/O. Every report interval one JSON object is printed with the
+ * frame rate, frame interval jitter, dropped frames and the dequeue and
+ * consumer hold latencies. Any capture node works, e.g. vivid or vimc for
+ * runs without the sensor. With -R the stream is stopped and restarted
+ * while the consumer still holds frames, which checks that a restart never
+ * queues a buffer a consumer owns; such a run must end without a dequeue
+ * or restart failure and with no buffer errors.
+ *
+ * Build: gcc -O2 -pthread -o ov9282_capture ov9282_capture.c v4l2_capture.c -lm
+ *
+ * Examples:
+ *   ov9282_capture -d /dev/video0 -f 1280x720 -p Y10P -n 600
+ *   ov9282_capture -d /dev/video0 -m dmabuf -b 8 -o frames.raw
+ *   modprobe vivid && ov9282_capture -d /dev/video0 -n 300 -r 1
+ *   modprobe vimc && ov9282_capture -d /dev/video2 -f 640x480 -n 600 -R 25
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "v4l2_capture.h"
+
+/**
+ * struct capture_queue - frames handed from the dequeue loop to the consumer
+ * @frames: ring of frames, one slot per pool buffer is enough
+ * @head: next slot to fill
+ * @count: frames in the ring
+ * @done: no more frames will be queued
+ */
+struct capture_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct v4l2_capture_frame *frames[V4L2_CAPTURE_MAX_BUFFERS];
+	unsigned int head;
+	unsigned int count;
+	bool done;
+};
+
+/**
+ * struct capture_consumer - consumer thread state
+ * @cap: capture the frames come from
+ * @queue: frames to consume
+ * @out: output file descriptor, -1 to discard the frames
+ * @error: errno of the failure that stopped the output, 0 if none
+ */
+struct capture_consumer {
+	struct v4l2_capture *cap;
+	struct capture_queue queue;
+	int out;
+	int error;
+};
+
+static volatile sig_atomic_t capture_stop;
+
+static void capture_sigint(int sig)
+{
+	(void)sig;
+	capture_stop = 1;
+}
+
+static uint64_t capture_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void capture_queue_push(struct capture_queue *q,
+			       struct v4l2_capture_frame *frame)
+{
+	pthread_mutex_lock(&q->lock);
+	q->frames[(q->head + q->count++) % V4L2_CAPTURE_MAX_BUFFERS] = frame;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void capture_queue_finish(struct capture_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->done = true;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void *capture_consumer_fn(void *arg)
+{
+	struct capture_consumer *c = arg;
+	struct capture_queue *q = &c->queue;
+	struct v4l2_capture_frame *frame;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		while (!q->count && !q->done)
+			pthread_cond_wait(&q->cond, &q->lock);
+		if (!q->count) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		frame = q->frames[q->head];
+		q->head = (q->head + 1) % V4L2_CAPTURE_MAX_BUFFERS;
+		q->count--;
+		pthread_mutex_unlock(&q->lock);
+
+		if (c->out >= 0 && !c->error &&
+		    write(c->out, frame->data, frame->bytesused) !=
+		    (ssize_t)frame->bytesused)
+			c->error = errno ? errno : EIO;
+
+		v4l2_capture_frame_put(c->cap, frame);
+	}
+
+	return NULL;
+}
+
+static double capture_mean_us(const struct v4l2_capture_latency *lat)
+{
+	return lat->count ? lat->sum_ns / lat->count / 1000 : 0;
+}
+
+static double capture_stddev_us(const struct v4l2_capture_latency *lat)
+{
+	double mean, var;
+
+	if (lat->count < 2)
+		return 0;
+
+	mean = lat->sum_ns / lat->count;
+	var = lat->sum_sq / lat->count - mean * mean;
+
+	return var > 0 ? sqrt(var) / 1000 : 0;
+}
+
+static void capture_print(const char *path, const struct v4l2_capture_stats *s,
+			  double seconds)
+{
+	printf("{\"target\":\"%s\",\"frames\":%llu,\"seconds\":%.6f,"
+	       "\"fps\":%.2f,\"interval_us\":%.1f,\"jitter_us\":%.1f,"
+	       "\"interval_max_us\":%.1f,\"dropped_seq\":%llu,"
+	       "\"dropped_ts\":%llu,\"errors\":%llu,"
+	       "\"dequeue_us\":%.1f,\"dequeue_max_us\":%.1f,"
+	       "\"hold_us\":%.1f,\"hold_max_us\":%.1f}\n",
+	       path, (unsigned long long)s->frames, seconds,
+	       seconds > 0 ? s->frames / seconds : 0,
+	       capture_mean_us(&s->interval), capture_stddev_us(&s->interval),
+	       s->interval.max_ns / 1000.0,
+	       (unsigned long long)s->dropped_seq,
+	       (unsigned long long)s->dropped_ts,
+	       (unsigned long long)s->errors,
+	       capture_mean_us(&s->dequeue), s->dequeue.max_ns / 1000.0,
+	       capture_mean_us(&s->hold), s->hold.max_ns / 1000.0);
+	fflush(stdout);
+}
+
+static void capture_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d DEVICE [options]\n"
+		"  -d DEVICE   video capture node\n"
+		"  -m MEMORY   mmap or dmabuf (default mmap)\n"
+		"  -H HEAP     DMA heap for dmabuf (default /dev/dma_heap/system)\n"
+		"  -b COUNT    buffers in the pool (default 4)\n"
+		"  -f WxH      frame size to set (default current format)\n"
+		"  -p FOURCC   pixel format to set with -f, e.g. Y10P\n"
+		"  -n FRAMES   frames to capture, 0 until interrupted (default 0)\n"
+		"  -r SECONDS  report interval (default 1)\n"
+		"  -o FILE     write the frames to FILE\n"
+		"  -R FRAMES   stop and restart the stream every FRAMES frames\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct v4l2_capture_cfg cfg = {
+		.memory = V4L2_CAPTURE_MMAP,
+		.num_buffers = 4,
+	};
+	struct capture_consumer consumer = { .out = -1 };
+	struct v4l2_capture_frame *frame;
+	struct v4l2_capture_stats stats;
+	unsigned long long frames = 0, captured = 0, restart = 0;
+	unsigned int width, height, stride;
+	uint64_t report_ns = 1000000000ull, last, now;
+	const char *output = NULL;
+	pthread_t consumer_thread;
+	uint32_t pixelformat;
+	struct v4l2_capture *cap;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:m:H:b:f:p:n:r:o:R:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.path = optarg;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "mmap"))
+				cfg.memory = V4L2_CAPTURE_MMAP;
+			else if (!strcmp(optarg, "dmabuf"))
+				cfg.memory = V4L2_CAPTURE_DMABUF;
+			else
+				goto usage;
+			break;
+		case 'H':
+			cfg.heap = optarg;
+			break;
+		case 'b':
+			cfg.num_buffers = strtoul(optarg, NULL, 0);
+			if (!cfg.num_buffers ||
+			    cfg.num_buffers > V4L2_CAPTURE_MAX_BUFFERS)
+				goto usage;
+			break;
+		case 'f':
+			if (sscanf(optarg, "%ux%u", &cfg.width, &cfg.height) != 2 ||
+			    !cfg.width || !cfg.height)
+				goto usage;
+			break;
+		case 'p':
+			if (strlen(optarg) != 4)
+				goto usage;
+			cfg.pixelformat = optarg[0] | optarg[1] << 8 |
+					  optarg[2] << 16 | (uint32_t)optarg[3] << 24;
+			break;
+		case 'n':
+			frames = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			report_ns = strtod(optarg, NULL) * 1e9;
+			if (!report_ns)
+				goto usage;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'R':
+			restart = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (!cfg.path)
+		goto usage;
+
+	cap = v4l2_capture_open(&cfg);
+	if (!cap) {
+		fprintf(stderr, "%s: %s\n", cfg.path, strerror(errno));
+		return 1;
+	}
+
+	v4l2_capture_get_format(cap, &width, &height, &pixelformat, &stride);
+	fprintf(stderr, "%s: %ux%u %.4s, stride %u\n", cfg.path, width, height,
+		(const char *)&pixelformat, stride);
+
+	if (output) {
+		consumer.out = open(output, O_WRONLY | O_CREAT | O_TRUNC |
+				    O_CLOEXEC, 0644);
+		if (consumer.out < 0) {
+			fprintf(stderr, "%s: %s\n", output, strerror(errno));
+			v4l2_capture_close(cap);
+			return 1;
+		}
+	}
+
+	consumer.cap = cap;
+	pthread_mutex_init(&consumer.queue.lock, NULL);
+	pthread_cond_init(&consumer.queue.cond, NULL);
+	pthread_create(&consumer_thread, NULL, capture_consumer_fn, &consumer);
+
+	signal(SIGINT, capture_sigint);
+
+	last = capture_now();
+	ret = v4l2_capture_start(cap);
+	if (ret) {
+		fprintf(stderr, "stream on: %s\n", strerror(-ret));
+		goto out;
+	}
+
+	while (!capture_stop && (!frames || captured < frames)) {
+		frame = v4l2_capture_dequeue(cap, 1000);
+		if (!frame) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "dequeue: %s\n", strerror(errno));
+			ret = -errno;
+			break;
+		}
+
+		captured++;
+		capture_queue_push(&consumer.queue, frame);
+
+		if (restart && !(captured % restart)) {
+			ret = v4l2_capture_stop(cap);
+			if (!ret)
+				ret = v4l2_capture_start(cap);
+			if (ret) {
+				fprintf(stderr, "restart: %s\n", strerror(-ret));
+				break;
+			}
+		}
+
+		now = capture_now();
+		if (now - last >= report_ns) {
+			v4l2_capture_get_stats(cap, &stats, true);
+			capture_print(cfg.path, &stats, (now - last) / 1e9);
+			last = now;
+		}
+	}
+
+out:
+	capture_queue_finish(&consumer.queue);
+	pthread_join(consumer_thread, NULL);
+
+	now = capture_now();
+	v4l2_capture_get_stats(cap, &stats, true);
+	if (stats.frames)
+		capture_print(cfg.path, &stats, (now - last) / 1e9);
+
+	v4l2_capture_close(cap);
+	if (consumer.out >= 0)
+		close(consumer.out);
+	if (consumer.error) {
+		fprintf(stderr, "%s: %s\n", output, strerror(consumer.error));
+		ret = -consumer.error;
+	}
+
+	return ret ? 1 : 0;
+
+usage:
+	capture_usage(argv[0]);
+
+	return 1;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * Userspace interface of the pseudo character device platform driver
+ */
+#ifndef _PCDEV_IOCTL_H
+#define _PCDEV_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define PCDEV_IOC_MAGIC		'p'
+
+/**
+ * struct pcdev_export_dmabuf - PCDEV_IOC_EXPORT_DMABUF argument
+ * @flags: O_CLOEXEC and the O_ACCMODE access of the dma-buf file. O_RDWR
+ *	   requires a device file opened for writing.
+ * @fd: Returned dma-buf file descriptor
+ */
+struct pcdev_export_dmabuf {
+	__u32 flags;
+	__s32 fd;
+};
+
+/* Export the buffer of a PCDEV_MODE_BUFFER instance as a dma-buf */
+#define PCDEV_IOC_EXPORT_DMABUF	_IOWR(PCDEV_IOC_MAGIC, 1, \
+				      struct pcdev_export_dmabuf)
+
+#endif
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Platform data shared between the pseudo character device setup module
+ * (test.c) and the pseudo character device platform driver.
+ */
+#ifndef _PCDEV_PLATFORM_H
+#define _PCDEV_PLATFORM_H
+
+#include <linux/bits.h>
+#include <linux/types.h>
+
+struct completion;
+
+/* Platform device name and highest instance id + 1 */
+#define PCDEV_DEVICE_NAME	"pseudo-char-device"
+#define PCDEV_MAX_DEVICES	65536
+
+/* Access permissions of a pseudo character device instance */
+#define PCDEV_PERM_RDONLY	0x01
+#define PCDEV_PERM_WRONLY	0x10
+#define PCDEV_PERM_RDWR		0x11
+
+/* Personality of a pseudo character device instance */
+#define PCDEV_MODE_BUFFER	0	/* seekable, mmap'able memory buffer */
+#define PCDEV_MODE_FIFO		1	/* single-producer/single-consumer ring */
+#define PCDEV_MODE_PERCPU	2	/* per-CPU record log, merged on read */
+
+/* Back the buffer with PMD sized physically contiguous chunks */
+#define PCDEV_FLAG_HUGEPAGE		BIT(0)
+/* Allocate the buffer on @numa_node */
+#define PCDEV_FLAG_NUMA_NODE		BIT(1)
+/* Allocate the buffer on the node of the first opener, at first open */
+#define PCDEV_FLAG_NUMA_FIRST_OPENER	BIT(2)
+/* Spread the buffer chunk by chunk over all nodes with memory */
+#define PCDEV_FLAG_NUMA_INTERLEAVE	BIT(3)
+
+/**
+ * struct pcdev_platform_data - pseudo character device platform data
+ * @size: Size of the backing buffer in bytes
+ * @perm: Access permission, one of PCDEV_PERM_*
+ * @serial_number: Serial number reported when the instance is bound
+ * @flags: Buffer allocation flags, PCDEV_FLAG_*
+ * @mode: Instance personality, one of PCDEV_MODE_*
+ * @rx_watermark: PCDEV_MODE_FIFO only, fill level in bytes at which blocked
+ *		  and polling readers are woken up. 0 selects 1 byte.
+ * @tx_watermark: PCDEV_MODE_FIFO only, free space in bytes at which blocked
+ *		  and polling writers are woken up. 0 selects 1 byte.
+ * @numa_node: Node the buffer is allocated on with PCDEV_FLAG_NUMA_NODE
+ * @probed: Completed by the driver once probing the device finished,
+ *	    whether it bound or not. May be NULL.
+ *
+ * Without a PCDEV_FLAG_NUMA_* flag the buffer follows the memory policy of
+ * the task binding the device, except for PCDEV_MODE_PERCPU instances whose
+ * segments are each placed on the node of the CPU owning them.
+ *
+ * The capacity of a PCDEV_MODE_FIFO instance is @size rounded up to a power
+ * of two. A PCDEV_MODE_PERCPU instance splits @size evenly between all
+ * possible CPUs.
+ */
+struct pcdev_platform_data {
+	size_t size;
+	int perm;
+	const char *serial_number;
+	u32 flags;
+	u32 mode;
+	size_t rx_watermark;
+	size_t tx_watermark;
+	int numa_node;
+	struct completion *probed;
+};
+
+#endif
@@ -0,0 +1,1835 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Pseudo character device platform driver
+ *
+ * Binds to the "pseudo-char-device" platform devices registered by test.c
+ * and exposes each of them as a memory-backed character device node.
+ *
+ * The backing memory of an instance is a set of pages with a contiguous
+ * kernel mapping, so it can be both copied through read()/write() and
+ * mapped into userspace with mmap(). The read and write paths work on
+ * iov_iter, so vectored I/O, io_uring and splice()/sendfile() to and from
+ * pipes, sockets and files share the same single-copy code.
+ *
+ * A mapping shares the very pages that read() and write() access, there is
+ * no private copy to keep in sync:
+ *
+ *  - read() and write() are atomic with respect to each other,
+ *  - stores through a mapping are visible to read() once they are visible
+ *    to the storing CPU, and data written with write() is visible through
+ *    every mapping when write() returns,
+ *  - accesses through a mapping are not ordered against read()/write(),
+ *    userspace mixing both on the same range must provide its own ordering.
+ *
+ * The pages of a PCDEV_MODE_BUFFER instance can also be exported as a
+ * dma-buf with PCDEV_IOC_EXPORT_DMABUF, so importers (V4L2, DRM, other
+ * devices) share them without copies. Every dma-buf holds its own
+ * reference on the pages and outlives the instance if needed. CPU access
+ * through the dma-buf must be bracketed with DMA_BUF_IOCTL_SYNC, which
+ * syncs every attached device mapping and the kernel alias.
+ *
+ * PCDEV_MODE_FIFO instances use the same memory as a single-producer/
+ * single-consumer ring instead. The producer and the consumer only share
+ * the head and tail indices, so a reader and a writer never block each
+ * other. Wakeups are batched with the rx/tx watermarks from the platform
+ * data: a blocked or polling reader is only woken up once the fill level
+ * reaches the watermark, or the last writer closes the device.
+ *
+ * PCDEV_MODE_PERCPU instances split the memory into one segment per
+ * possible CPU. Every write() appends one timestamped record to the segment
+ * of the CPU it runs on, so writers on different CPUs never share a lock or
+ * a cache line. Each open file keeps its own cursor per segment and read()
+ * returns record payloads merged in timestamp order, as far as the records
+ * committed so far allow, see pcdev_percpu_read_iter(). Records are never
+ * consumed, the log is emptied by opening the device with O_TRUNC while it
+ * is quiescent.
+ *
+ * An instance can be unbound while files are still open on it, e.g. when
+ * test.c disables or removes a configfs item. Open files hold a reference
+ * on the instance, so unbinding only removes the device node and the
+ * memory goes away with the last file.
+ */
+#include <linux/cdev.h>
+#include <linux/completion.h>
+#include <linux/device.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/rwsem.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/xarray.h>
+
+#include "pcdev_ioctl.h"
+#include "pcdev_platform.h"
+
+#define PCDEV_DRIVER_NAME	PCDEV_DEVICE_NAME
+#define PCDEV_CLASS_NAME	"pcdev_class"
+
+/* Allocation order of the chunks backing PCDEV_FLAG_HUGEPAGE instances */
+#define PCDEV_HUGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+
+/**
+ * struct pcdev_buffer - pseudo character device backing memory
+ * @vaddr: Kernel mapping of @pages, used by read() and write()
+ * @pages: Backing pages in buffer order
+ * @nr_pages: Number of pages in @pages
+ * @order: Allocation order of the physically contiguous chunks of @pages
+ */
+struct pcdev_buffer {
+	void *vaddr;
+	struct page **pages;
+	unsigned long nr_pages;
+	unsigned int order;
+};
+
+/**
+ * struct pcdev_fifo - single-producer/single-consumer ring state
+ * @head: Free-running write index, only advanced by the producer
+ * @tx_want: Free space the producer waits for, tx_watermark when not waiting
+ * @tail: Free-running read index, only advanced by the consumer
+ * @rx_want: Fill level the consumer waits for, rx_watermark when not waiting
+ * @mask: Ring capacity minus one, the capacity is a power of two
+ * @rx_watermark: Fill level at which readers are woken up
+ * @tx_watermark: Free space at which writers are woken up
+ * @writers: Number of open files with write access
+ * @producer_lock: Serialises writers, only one producer runs at a time
+ * @consumer_lock: Serialises readers, only one consumer runs at a time
+ * @rx_wait: Readers waiting for data
+ * @tx_wait: Writers waiting for space
+ *
+ * The producer and consumer indices live on separate cache lines so the two
+ * sides do not bounce a line on every transfer.
+ */
+struct pcdev_fifo {
+	unsigned long head ____cacheline_aligned_in_smp;
+	size_t tx_want;
+	unsigned long tail ____cacheline_aligned_in_smp;
+	size_t rx_want;
+	size_t mask ____cacheline_aligned_in_smp;
+	size_t rx_watermark;
+	size_t tx_watermark;
+	atomic_t writers;
+	struct mutex producer_lock;
+	struct mutex consumer_lock;
+	wait_queue_head_t rx_wait;
+	wait_queue_head_t tx_wait;
+};
+
+/* Alignment of records in PCDEV_MODE_PERCPU segments */
+#define PCDEV_RECORD_ALIGN	sizeof(u64)
+
+/**
+ * struct pcdev_shard - per-CPU segment of a PCDEV_MODE_PERCPU instance
+ * @lock: Serialises writers appending to this segment
+ * @base: Start of the segment in the instance buffer
+ * @size: Segment size in bytes
+ * @committed: Bytes of complete records, published with release semantics
+ */
+struct pcdev_shard {
+	struct mutex lock;
+	char *base;
+	size_t size;
+	size_t committed;
+};
+
+/**
+ * struct pcdev_record - header of a record in a per-CPU segment
+ * @timestamp: Commit time in ns, readers merge segments in this order
+ * @len: Payload length in bytes, the payload follows the header
+ * @reserved: Padding, keeps the payload 8-byte aligned
+ */
+struct pcdev_record {
+	u64 timestamp;
+	u32 len;
+	u32 reserved;
+};
+
+/**
+ * struct pcdev_percpu_reader - per-file state of a PCDEV_MODE_PERCPU instance
+ * @pcdev: Instance the file was opened on
+ * @lock: Serialises reads through the same file
+ * @pos: Read offset into each segment, indexed by CPU
+ */
+struct pcdev_percpu_reader {
+	struct pcdev_private_data *pcdev;
+	struct mutex lock;
+	size_t pos[];
+};
+
+/**
+ * struct pcdev_private_data - pseudo character device instance
+ * @pdata: Copy of the platform data the instance was registered with
+ * @buf: Backing memory, at least @pdata.size bytes
+ * @dev_num: Device number of the character device
+ * @cdev: Character device, allocated separately as open files keep it
+ *	  until after their release
+ * @dev: Device node created in the pcdev class, referenced until the
+ *	 instance is freed
+ * @kref: Held by the bound platform device and by every open file
+ * @lock: Excludes writers from readers, readers run concurrently
+ * @fifo: Ring state of PCDEV_MODE_FIFO instances
+ * @shards: Segments of PCDEV_MODE_PERCPU instances
+ * @setup_lock: Serialises the deferred setup of PCDEV_FLAG_NUMA_FIRST_OPENER
+ *		instances
+ * @ready: Backing memory and mode state are set up
+ */
+struct pcdev_private_data {
+	struct pcdev_platform_data pdata;
+	struct pcdev_buffer buf;
+	struct pcdev_fifo fifo;
+	struct pcdev_shard __percpu *shards;
+	struct mutex setup_lock;
+	bool ready;
+	dev_t dev_num;
+	struct cdev *cdev;
+	struct device *dev;
+	struct kref kref;
+	struct rw_semaphore lock;
+};
+
+/**
+ * struct pcdrv_private_data - pseudo character device driver data
+ * @device_num_base: First device number of the allocated region
+ * @class_pcd: Device class the instance nodes are created in
+ * @devices: Bound instances, indexed by device id. Its lock also orders
+ *	   lookups taking a reference against unbinding.
+ */
+struct pcdrv_private_data {
+	dev_t device_num_base;
+	struct class *class_pcd;
+	struct xarray devices;
+};
+
+static struct pcdrv_private_data pcdrv_data = {
+	.devices = XARRAY_INIT(pcdrv_data.devices, 0),
+};
+
+/* Size of each segment of a PCDEV_MODE_PERCPU instance */
+static size_t pcdev_percpu_shard_size(struct pcdev_private_data *pcdev)
+{
+	return rounddown(pcdev->pdata.size / nr_cpu_ids, PCDEV_RECORD_ALIGN);
+}
+
+/**
+ * pcdev_buffer_chunk_node() - Pick the NUMA node of a buffer chunk
+ * @pcdev: pointer to pseudo character device instance
+ * @node: NUMA node of the whole buffer or NUMA_NO_NODE
+ * @prev: node picked for the previous chunk, NUMA_NO_NODE for the first
+ * @index: index of the first page of the chunk
+ *
+ * Return: node to allocate the chunk on, NUMA_NO_NODE to follow the memory
+ * policy of the current task.
+ */
+static int pcdev_buffer_chunk_node(struct pcdev_private_data *pcdev,
+				   int node, int prev, unsigned long index)
+{
+	size_t shard_size;
+	unsigned int cpu;
+
+	if (pcdev->pdata.flags & PCDEV_FLAG_NUMA_INTERLEAVE)
+		return next_node_in(prev, node_states[N_MEMORY]);
+
+	if (node != NUMA_NO_NODE || pcdev->pdata.mode != PCDEV_MODE_PERCPU)
+		return node;
+
+	shard_size = pcdev_percpu_shard_size(pcdev);
+	cpu = ((size_t)index << PAGE_SHIFT) / shard_size;
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return NUMA_NO_NODE;
+
+	return cpu_to_node(cpu);
+}
+
+/**
+ * pcdev_buffer_alloc() - Allocate and map instance backing memory
+ * @pcdev: pointer to pseudo character device instance
+ * @size: minimum buffer size in bytes
+ * @order: allocation order of the physically contiguous chunks
+ * @node: NUMA node of the whole buffer, NUMA_NO_NODE to place it by
+ *	  instance flags and mode
+ *
+ * The buffer is rounded up to a whole number of chunks. Chunks are split
+ * into independent pages so they can be inserted into user mappings one
+ * page at a time.
+ *
+ * Return: 0 if successful, -ENOMEM otherwise.
+ */
+static int pcdev_buffer_alloc(struct pcdev_private_data *pcdev, size_t size,
+			      unsigned int order, int node)
+{
+	struct pcdev_buffer *buf = &pcdev->buf;
+	gfp_t gfp = GFP_HIGHUSER | __GFP_ZERO;
+	unsigned long chunk = 1UL << order;
+	int nid = NUMA_NO_NODE;
+	unsigned long i, j;
+	struct page *page;
+
+	if (order)
+		gfp |= __GFP_NORETRY | __GFP_NOWARN;
+
+	buf->order = order;
+	buf->nr_pages = ALIGN(PAGE_ALIGN(size) >> PAGE_SHIFT, chunk);
+	buf->pages = kvmalloc_node(array_size(buf->nr_pages,
+					      sizeof(*buf->pages)),
+				   GFP_KERNEL, node);
+	if (!buf->pages)
+		return -ENOMEM;
+
+	for (i = 0; i < buf->nr_pages; i += chunk) {
+		nid = pcdev_buffer_chunk_node(pcdev, node, nid, i);
+		if (nid == NUMA_NO_NODE)
+			page = alloc_pages(gfp, order);
+		else
+			page = alloc_pages_node(nid, gfp, order);
+		if (!page)
+			goto error_free_pages;
+
+		if (order)
+			split_page(page, order);
+
+		for (j = 0; j < chunk; j++)
+			buf->pages[i + j] = page + j;
+	}
+
+	buf->vaddr = vmap(buf->pages, buf->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!buf->vaddr)
+		goto error_free_pages;
+
+	return 0;
+
+error_free_pages:
+	while (i--)
+		__free_page(buf->pages[i]);
+	kvfree(buf->pages);
+	buf->pages = NULL;
+	buf->nr_pages = 0;
+
+	return -ENOMEM;
+}
+
+/**
+ * pcdev_buffer_free() - Unmap and release instance backing memory
+ * @buf: buffer to release
+ *
+ * Pages still inserted in user mappings stay alive until they are unmapped.
+ */
+static void pcdev_buffer_free(struct pcdev_buffer *buf)
+{
+	unsigned long i;
+
+	vunmap(buf->vaddr);
+	for (i = 0; i < buf->nr_pages; i++)
+		__free_page(buf->pages[i]);
+	kvfree(buf->pages);
+	memset(buf, 0, sizeof(*buf));
+}
+
+/**
+ * pcdev_buffer_init() - Allocate the backing memory of an instance
+ * @pcdev: pointer to pseudo character device instance
+ * @dev: device used for diagnostics
+ * @node: NUMA node of the whole buffer or NUMA_NO_NODE
+ *
+ * PCDEV_FLAG_HUGEPAGE instances are backed by PMD sized, PMD aligned
+ * chunks. When those cannot be allocated the buffer falls back to
+ * order-0 pages.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_buffer_init(struct pcdev_private_data *pcdev,
+			     struct device *dev, int node)
+{
+	size_t size = pcdev->pdata.size;
+
+	if ((pcdev->pdata.flags & PCDEV_FLAG_HUGEPAGE) &&
+	    PCDEV_HUGE_ORDER < MAX_ORDER) {
+		if (!pcdev_buffer_alloc(pcdev, size, PCDEV_HUGE_ORDER, node))
+			return 0;
+
+		dev_warn(dev, "no huge pages available, using base pages");
+	}
+
+	return pcdev_buffer_alloc(pcdev, size, 0, node);
+}
+
+/**
+ * pcdev_fifo_init() - Initialise the ring of a PCDEV_MODE_FIFO instance
+ * @pcdev: pointer to pseudo character device instance
+ *
+ * Must be called once the instance size has been rounded up to the ring
+ * capacity.
+ */
+static void pcdev_fifo_init(struct pcdev_private_data *pcdev)
+{
+	struct pcdev_fifo *fifo = &pcdev->fifo;
+	size_t capacity = pcdev->pdata.size;
+
+	fifo->mask = capacity - 1;
+	fifo->rx_watermark = clamp_t(size_t, pcdev->pdata.rx_watermark,
+				     1, capacity);
+	fifo->tx_watermark = clamp_t(size_t, pcdev->pdata.tx_watermark,
+				     1, capacity);
+	fifo->rx_want = fifo->rx_watermark;
+	fifo->tx_want = fifo->tx_watermark;
+	atomic_set(&fifo->writers, 0);
+	mutex_init(&fifo->producer_lock);
+	mutex_init(&fifo->consumer_lock);
+	init_waitqueue_head(&fifo->rx_wait);
+	init_waitqueue_head(&fifo->tx_wait);
+}
+
+/**
+ * pcdev_percpu_init() - Split a PCDEV_MODE_PERCPU instance into segments
+ * @pcdev: pointer to pseudo character device instance
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_percpu_init(struct pcdev_private_data *pcdev)
+{
+	size_t shard_size = pcdev_percpu_shard_size(pcdev);
+	struct pcdev_shard *shard;
+	unsigned int cpu;
+
+	if (shard_size <= sizeof(struct pcdev_record))
+		return -EINVAL;
+
+	pcdev->shards = alloc_percpu(struct pcdev_shard);
+	if (!pcdev->shards)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(pcdev->shards, cpu);
+		mutex_init(&shard->lock);
+		shard->base = pcdev->buf.vaddr + cpu * shard_size;
+		shard->size = shard_size;
+		shard->committed = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * pcdev_setup() - Allocate the backing memory and mode state of an instance
+ * @pcdev: pointer to pseudo character device instance
+ * @dev: device used for diagnostics
+ * @node: NUMA node of the whole buffer or NUMA_NO_NODE
+ *
+ * Runs at probe time, or at first open for PCDEV_FLAG_NUMA_FIRST_OPENER
+ * instances with @node set to the node of the opener.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_setup(struct pcdev_private_data *pcdev, struct device *dev,
+		       int node)
+{
+	int ret;
+
+	ret = pcdev_buffer_init(pcdev, dev, node);
+	if (ret)
+		return ret;
+
+	if (pcdev->pdata.mode == PCDEV_MODE_FIFO)
+		pcdev_fifo_init(pcdev);
+
+	if (pcdev->pdata.mode == PCDEV_MODE_PERCPU) {
+		ret = pcdev_percpu_init(pcdev);
+		if (ret) {
+			pcdev_buffer_free(&pcdev->buf);
+			return ret;
+		}
+	}
+
+	smp_store_release(&pcdev->ready, true);
+
+	return 0;
+}
+
+/**
+ * pcdev_free() - Free an instance once it is unbound and no file is open
+ * @kref: reference count of the instance
+ */
+static void pcdev_free(struct kref *kref)
+{
+	struct pcdev_private_data *pcdev =
+		container_of(kref, struct pcdev_private_data, kref);
+
+	free_percpu(pcdev->shards);
+	pcdev_buffer_free(&pcdev->buf);
+	put_device(pcdev->dev);
+	kfree(pcdev);
+}
+
+/**
+ * pcdev_get() - Take a reference on the instance behind a device inode
+ * @inode: inode of the device node being opened
+ *
+ * Return: the instance, or NULL if it has been unbound.
+ */
+static struct pcdev_private_data *pcdev_get(struct inode *inode)
+{
+	struct pcdev_private_data *pcdev;
+
+	xa_lock(&pcdrv_data.devices);
+	pcdev = xa_load(&pcdrv_data.devices, MINOR(inode->i_rdev) -
+			MINOR(pcdrv_data.device_num_base));
+	if (pcdev)
+		kref_get(&pcdev->kref);
+	xa_unlock(&pcdrv_data.devices);
+
+	return pcdev;
+}
+
+/**
+ * pcdev_check_permission() - Check an open mode against instance permission
+ * @perm: Instance permission, one of PCDEV_PERM_*
+ * @mode: File mode requested by the opener
+ *
+ * Return: 0 if the access is allowed, -EPERM otherwise.
+ */
+static int pcdev_check_permission(int perm, fmode_t mode)
+{
+	if (perm == PCDEV_PERM_RDWR)
+		return 0;
+
+	if (perm == PCDEV_PERM_RDONLY &&
+	    (mode & FMODE_READ) && !(mode & FMODE_WRITE))
+		return 0;
+
+	if (perm == PCDEV_PERM_WRONLY &&
+	    (mode & FMODE_WRITE) && !(mode & FMODE_READ))
+		return 0;
+
+	return -EPERM;
+}
+
+/**
+ * pcdev_open() - Open a pseudo character device instance
+ * @inode: pointer to device inode
+ * @filp: pointer to file being opened
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_open(struct inode *inode, struct file *filp)
+{
+	struct pcdev_private_data *pcdev;
+	int ret;
+
+	pcdev = pcdev_get(inode);
+	if (!pcdev)
+		return -ENODEV;
+
+	ret = pcdev_check_permission(pcdev->pdata.perm, filp->f_mode);
+	if (ret)
+		goto error_put;
+
+	if (!smp_load_acquire(&pcdev->ready)) {
+		mutex_lock(&pcdev->setup_lock);
+		if (!pcdev->ready)
+			ret = pcdev_setup(pcdev, pcdev->dev, numa_node_id());
+		mutex_unlock(&pcdev->setup_lock);
+		if (ret)
+			goto error_put;
+	}
+
+	filp->private_data = pcdev;
+	filp->f_mode |= FMODE_NOWAIT;
+
+	if (pcdev->pdata.mode == PCDEV_MODE_FIFO) {
+		stream_open(inode, filp);
+		if (filp->f_mode & FMODE_WRITE)
+			atomic_inc(&pcdev->fifo.writers);
+	}
+
+	return 0;
+
+error_put:
+	kref_put(&pcdev->kref, pcdev_free);
+
+	return ret;
+}
+
+/**
+ * pcdev_release() - Release a pseudo character device instance
+ * @inode: pointer to device inode
+ * @filp: pointer to file being released
+ *
+ * When the last writer of a PCDEV_MODE_FIFO instance goes away, readers
+ * waiting for the rx watermark are woken up to drain what is left.
+ *
+ * Return: 0
+ */
+static int pcdev_release(struct inode *inode, struct file *filp)
+{
+	struct pcdev_private_data *pcdev = filp->private_data;
+
+	if (pcdev->pdata.mode == PCDEV_MODE_FIFO &&
+	    (filp->f_mode & FMODE_WRITE) &&
+	    atomic_dec_and_test(&pcdev->fifo.writers))
+		wake_up_interruptible_poll(&pcdev->fifo.rx_wait,
+					   EPOLLIN | EPOLLRDNORM);
+
+	kref_put(&pcdev->kref, pcdev_free);
+
+	return 0;
+}
+
+/**
+ * pcdev_lock() - Take the instance lock for an I/O request
+ * @pcdev: pointer to pseudo character device instance
+ * @iocb: I/O control block of the request
+ * @write: take the lock for writing instead of reading
+ *
+ * IOCB_NOWAIT requests never sleep on the lock, they fail with -EAGAIN
+ * and let the submitter (io_uring, RWF_NOWAIT) retry from a worker.
+ *
+ * Return: 0 if the lock is held, -EAGAIN otherwise.
+ */
+static int pcdev_lock(struct pcdev_private_data *pcdev, struct kiocb *iocb,
+		      bool write)
+{
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (write ? down_write_trylock(&pcdev->lock) :
+			    down_read_trylock(&pcdev->lock))
+			return 0;
+		return -EAGAIN;
+	}
+
+	if (write)
+		down_write(&pcdev->lock);
+	else
+		down_read(&pcdev->lock);
+
+	return 0;
+}
+
+/**
+ * pcdev_read_iter() - Copy data out of the instance buffer
+ * @iocb: I/O control block, ki_pos is advanced by the number of bytes copied
+ * @to: destination iterator, user iovecs for read()/readv() or a pipe for
+ *	splice() and sendfile()
+ *
+ * The whole request is copied with a single copy_to_iter() so large reads
+ * run at memory copy speed. Concurrent readers do not exclude each other.
+ *
+ * Return: number of bytes copied, 0 at end of buffer or error code.
+ */
+static ssize_t pcdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcdev_private_data *pcdev = iocb->ki_filp->private_data;
+	size_t size = pcdev->pdata.size;
+	loff_t pos = iocb->ki_pos;
+	size_t count, copied;
+	int ret;
+
+	if (pos >= size || !iov_iter_count(to))
+		return 0;
+
+	count = min_t(size_t, iov_iter_count(to), size - pos);
+
+	ret = pcdev_lock(pcdev, iocb, false);
+	if (ret)
+		return ret;
+
+	invalidate_kernel_vmap_range(pcdev->buf.vaddr + pos, count);
+	copied = copy_to_iter(pcdev->buf.vaddr + pos, count, to);
+	up_read(&pcdev->lock);
+
+	if (!copied)
+		return -EFAULT;
+
+	iocb->ki_pos += copied;
+
+	return copied;
+}
+
+/**
+ * pcdev_write_iter() - Copy data into the instance buffer
+ * @iocb: I/O control block, ki_pos is advanced by the number of bytes copied
+ * @from: source iterator, user iovecs for write()/writev() or a pipe for
+ *	  splice()
+ *
+ * Return: number of bytes copied or error code. -ENOSPC is returned once
+ * the file position reaches the end of the buffer.
+ */
+static ssize_t pcdev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev = iocb->ki_filp->private_data;
+	size_t size = pcdev->pdata.size;
+	loff_t pos = iocb->ki_pos;
+	size_t count, copied;
+	int ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	if (pos >= size)
+		return -ENOSPC;
+
+	count = min_t(size_t, iov_iter_count(from), size - pos);
+
+	ret = pcdev_lock(pcdev, iocb, true);
+	if (ret)
+		return ret;
+
+	copied = copy_from_iter(pcdev->buf.vaddr + pos, count, from);
+	flush_kernel_vmap_range(pcdev->buf.vaddr + pos, count);
+	up_write(&pcdev->lock);
+
+	if (!copied)
+		return -EFAULT;
+
+	iocb->ki_pos += copied;
+
+	return copied;
+}
+
+/* Bytes the consumer can read, data up to the head is visible once read */
+static size_t pcdev_fifo_fill(struct pcdev_fifo *fifo)
+{
+	return smp_load_acquire(&fifo->head) - READ_ONCE(fifo->tail);
+}
+
+/* Bytes the producer can write, the consumer is done with them once read */
+static size_t pcdev_fifo_space(struct pcdev_fifo *fifo)
+{
+	return fifo->mask + 1 -
+	       (READ_ONCE(fifo->head) - smp_load_acquire(&fifo->tail));
+}
+
+static bool pcdev_fifo_nonblock(struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+	       (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/**
+ * pcdev_fifo_lock() - Take the producer or consumer side of the ring
+ * @lock: producer_lock or consumer_lock
+ * @nonblock: fail instead of sleeping when the side is busy
+ *
+ * Return: 0 if the lock is held, error code otherwise.
+ */
+static int pcdev_fifo_lock(struct mutex *lock, bool nonblock)
+{
+	if (nonblock)
+		return mutex_trylock(lock) ? 0 : -EAGAIN;
+
+	return mutex_lock_interruptible(lock);
+}
+
+/**
+ * pcdev_fifo_readable() - Check whether a blocked reader can proceed
+ * @fifo: pointer to ring state
+ * @want: fill level the reader waits for
+ *
+ * Return: true if @want bytes are queued, or data is queued and no writer
+ * is left to complete the batch.
+ */
+static bool pcdev_fifo_readable(struct pcdev_fifo *fifo, size_t want)
+{
+	size_t fill = pcdev_fifo_fill(fifo);
+
+	return fill >= want || (fill && !atomic_read(&fifo->writers));
+}
+
+/**
+ * pcdev_fifo_wake_needed() - Check whether the other side must be woken up
+ * @wq: rx_wait or tx_wait
+ * @want: rx_want or tx_want, the level a sleeper on @wq waits for
+ * @level: fill level or free space after this side's update
+ *
+ * A sleeper stores @want before it adds itself to @wq. The barrier orders
+ * seeing it on @wq before reading @want, so a sleeper found on the queue
+ * is never compared against the watermark it replaced.
+ *
+ * Return: true if a sleeper waits for no more than @level.
+ */
+static bool pcdev_fifo_wake_needed(struct wait_queue_head *wq,
+				   const size_t *want, size_t level)
+{
+	if (!wq_has_sleeper(wq))
+		return false;
+
+	smp_mb();
+
+	return level >= READ_ONCE(*want);
+}
+
+/**
+ * pcdev_fifo_read_iter() - Consume data from the ring
+ * @iocb: I/O control block
+ * @to: destination iterator
+ *
+ * A blocking read sleeps until the lower of @to's size and the rx watermark
+ * is queued, then returns everything available up to @to's size. A
+ * non-blocking read returns what is queued without looking at the
+ * watermark. As with pipes, a read of an empty ring returns 0 once no
+ * writer has the instance open.
+ *
+ * Return: number of bytes read or error code.
+ */
+static ssize_t pcdev_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcdev_private_data *pcdev = iocb->ki_filp->private_data;
+	struct pcdev_fifo *fifo = &pcdev->fifo;
+	bool nonblock = pcdev_fifo_nonblock(iocb);
+	size_t count = iov_iter_count(to);
+	size_t want, fill, off, first, copied;
+	unsigned long tail;
+	int ret;
+
+	if (!count)
+		return 0;
+
+	ret = pcdev_fifo_lock(&fifo->consumer_lock, nonblock);
+	if (ret)
+		return ret;
+
+	want = min(count, fifo->rx_watermark);
+	if (!pcdev_fifo_readable(fifo, nonblock ? 1 : want) &&
+	    atomic_read(&fifo->writers)) {
+		if (nonblock) {
+			ret = -EAGAIN;
+			goto out_unlock;
+		}
+
+		WRITE_ONCE(fifo->rx_want, want);
+		ret = wait_event_interruptible(fifo->rx_wait,
+					       pcdev_fifo_readable(fifo, want) ||
+					       !atomic_read(&fifo->writers));
+		WRITE_ONCE(fifo->rx_want, fifo->rx_watermark);
+		if (ret)
+			goto out_unlock;
+	}
+
+	tail = fifo->tail;
+	fill = pcdev_fifo_fill(fifo);
+	if (!fill) {
+		/* End of file: empty and no writer left */
+		ret = 0;
+		goto out_unlock;
+	}
+	count = min(count, fill);
+	off = tail & fifo->mask;
+	first = min(count, fifo->mask + 1 - off);
+
+	copied = copy_to_iter(pcdev->buf.vaddr + off, first, to);
+	if (copied == first && count > first)
+		copied += copy_to_iter(pcdev->buf.vaddr, count - first, to);
+
+	if (!copied) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+
+	smp_store_release(&fifo->tail, tail + copied);
+
+	if (pcdev_fifo_wake_needed(&fifo->tx_wait, &fifo->tx_want,
+				   pcdev_fifo_space(fifo)))
+		wake_up_interruptible_poll(&fifo->tx_wait,
+					   EPOLLOUT | EPOLLWRNORM);
+
+	ret = copied;
+
+out_unlock:
+	mutex_unlock(&fifo->consumer_lock);
+
+	return ret;
+}
+
+/**
+ * pcdev_fifo_write_iter() - Produce data into the ring
+ * @iocb: I/O control block
+ * @from: source iterator
+ *
+ * A blocking write queues all of @from, sleeping until the tx watermark
+ * worth of space is free whenever the ring is full. A non-blocking write
+ * queues what fits.
+ *
+ * Return: number of bytes written or error code.
+ */
+static ssize_t pcdev_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev = iocb->ki_filp->private_data;
+	struct pcdev_fifo *fifo = &pcdev->fifo;
+	bool nonblock = pcdev_fifo_nonblock(iocb);
+	size_t space, want, count, off, first, copied;
+	size_t done = 0;
+	unsigned long head;
+	int ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	ret = pcdev_fifo_lock(&fifo->producer_lock, nonblock);
+	if (ret)
+		return ret;
+
+	head = fifo->head;
+	while (iov_iter_count(from)) {
+		space = pcdev_fifo_space(fifo);
+		if (!space) {
+			if (nonblock) {
+				ret = -EAGAIN;
+				break;
+			}
+
+			want = min(iov_iter_count(from), fifo->tx_watermark);
+			WRITE_ONCE(fifo->tx_want, want);
+			ret = wait_event_interruptible(fifo->tx_wait,
+					pcdev_fifo_space(fifo) >= want);
+			WRITE_ONCE(fifo->tx_want, fifo->tx_watermark);
+			if (ret)
+				break;
+			continue;
+		}
+
+		count = min(iov_iter_count(from), space);
+		off = head & fifo->mask;
+		first = min(count, fifo->mask + 1 - off);
+
+		copied = copy_from_iter(pcdev->buf.vaddr + off, first, from);
+		if (copied == first && count > first)
+			copied += copy_from_iter(pcdev->buf.vaddr,
+						 count - first, from);
+
+		head += copied;
+		done += copied;
+		smp_store_release(&fifo->head, head);
+
+		if (pcdev_fifo_wake_needed(&fifo->rx_wait, &fifo->rx_want,
+					   pcdev_fifo_fill(fifo)))
+			wake_up_interruptible_poll(&fifo->rx_wait,
+						   EPOLLIN | EPOLLRDNORM);
+
+		if (copied != count) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	mutex_unlock(&fifo->producer_lock);
+
+	return done ? done : ret;
+}
+
+/**
+ * pcdev_fifo_poll() - Report ring readiness
+ * @filp: pointer to file
+ * @wait: poll table
+ *
+ * Readiness follows the same watermarks as blocking I/O, so epoll users
+ * get one wakeup per batch rather than one per write.
+ *
+ * Return: poll mask
+ */
+static __poll_t pcdev_fifo_poll(struct file *filp, poll_table *wait)
+{
+	struct pcdev_private_data *pcdev = filp->private_data;
+	struct pcdev_fifo *fifo = &pcdev->fifo;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &fifo->rx_wait, wait);
+	poll_wait(filp, &fifo->tx_wait, wait);
+
+	if (pcdev_fifo_readable(fifo, fifo->rx_watermark))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	if (pcdev_fifo_space(fifo) >= fifo->tx_watermark)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+/**
+ * pcdev_percpu_truncate() - Drop all records of a PCDEV_MODE_PERCPU instance
+ * @pcdev: pointer to pseudo character device instance
+ *
+ * Writers are excluded while the segments are reset. Readers still holding
+ * cursors past the new end restart from the beginning of the segment.
+ */
+static void pcdev_percpu_truncate(struct pcdev_private_data *pcdev)
+{
+	struct pcdev_shard *shard;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(pcdev->shards, cpu);
+		mutex_lock(&shard->lock);
+		smp_store_release(&shard->committed, 0);
+		mutex_unlock(&shard->lock);
+	}
+}
+
+/**
+ * pcdev_percpu_open() - Open a PCDEV_MODE_PERCPU instance
+ * @inode: pointer to device inode
+ * @filp: pointer to file being opened
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_percpu_open(struct inode *inode, struct file *filp)
+{
+	struct pcdev_percpu_reader *reader;
+	struct pcdev_private_data *pcdev;
+	int ret;
+
+	ret = pcdev_open(inode, filp);
+	if (ret)
+		return ret;
+
+	pcdev = filp->private_data;
+
+	reader = kvzalloc(struct_size(reader, pos, nr_cpu_ids), GFP_KERNEL);
+	if (!reader) {
+		kref_put(&pcdev->kref, pcdev_free);
+		return -ENOMEM;
+	}
+
+	reader->pcdev = pcdev;
+	mutex_init(&reader->lock);
+	filp->private_data = reader;
+	stream_open(inode, filp);
+
+	if ((filp->f_flags & O_TRUNC) && (filp->f_mode & FMODE_WRITE))
+		pcdev_percpu_truncate(pcdev);
+
+	return 0;
+}
+
+/**
+ * pcdev_percpu_release() - Release a PCDEV_MODE_PERCPU instance
+ * @inode: pointer to device inode
+ * @filp: pointer to file being released
+ *
+ * Return: 0
+ */
+static int pcdev_percpu_release(struct inode *inode, struct file *filp)
+{
+	struct pcdev_percpu_reader *reader = filp->private_data;
+
+	kref_put(&reader->pcdev->kref, pcdev_free);
+	kvfree(reader);
+
+	return 0;
+}
+
+/**
+ * pcdev_percpu_read_iter() - Read records merged in timestamp order
+ * @iocb: I/O control block
+ * @to: destination iterator
+ *
+ * Payloads of as many whole records as fit in @to are returned, oldest
+ * first among the records committed at each step. Records committed while
+ * the read runs are merged in as they show up. A writer takes its
+ * timestamp before it commits, so a record committed late on one CPU can
+ * still follow a younger one from another CPU, in the same read or the
+ * next.
+ *
+ * Return: number of bytes read, 0 if no unread record is left, -EMSGSIZE if
+ * the next record does not fit in @to or another error code.
+ */
+static ssize_t pcdev_percpu_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcdev_percpu_reader *reader = iocb->ki_filp->private_data;
+	struct pcdev_private_data *pcdev = reader->pcdev;
+	struct pcdev_record *rec, *next;
+	struct pcdev_shard *shard;
+	unsigned int cpu, next_cpu;
+	size_t committed;
+	ssize_t done = 0;
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!mutex_trylock(&reader->lock))
+			return -EAGAIN;
+	} else {
+		mutex_lock(&reader->lock);
+	}
+
+	for (;;) {
+		next = NULL;
+		next_cpu = 0;
+
+		/* Linear scan, reads are rare compared to appends */
+		for_each_possible_cpu(cpu) {
+			shard = per_cpu_ptr(pcdev->shards, cpu);
+			committed = smp_load_acquire(&shard->committed);
+			if (reader->pos[cpu] > committed)
+				reader->pos[cpu] = 0;
+			if (reader->pos[cpu] == committed)
+				continue;
+
+			rec = (void *)(shard->base + reader->pos[cpu]);
+			if (!next || rec->timestamp < next->timestamp) {
+				next = rec;
+				next_cpu = cpu;
+			}
+		}
+
+		if (!next)
+			break;
+
+		if (next->len > iov_iter_count(to)) {
+			if (!done)
+				done = -EMSGSIZE;
+			break;
+		}
+
+		if (copy_to_iter(next + 1, next->len, to) != next->len) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+
+		done += next->len;
+		reader->pos[next_cpu] += ALIGN(sizeof(*next) + next->len,
+					       PCDEV_RECORD_ALIGN);
+	}
+
+	mutex_unlock(&reader->lock);
+
+	return done;
+}
+
+/**
+ * pcdev_percpu_write_iter() - Append one record to the local CPU segment
+ * @iocb: I/O control block
+ * @from: record payload
+ *
+ * The segment is picked from the CPU the writer runs on. A writer migrated
+ * after the pick still appends safely, it merely shares the segment lock
+ * with the writers of the other CPU for this one record.
+ *
+ * Return: number of bytes written, -ENOSPC if the local segment is full or
+ * another error code.
+ */
+static ssize_t pcdev_percpu_write_iter(struct kiocb *iocb,
+				       struct iov_iter *from)
+{
+	struct pcdev_percpu_reader *reader = iocb->ki_filp->private_data;
+	struct pcdev_private_data *pcdev = reader->pcdev;
+	size_t len = iov_iter_count(from);
+	struct pcdev_record *rec;
+	struct pcdev_shard *shard;
+	size_t off, total;
+	ssize_t ret;
+
+	if (!len)
+		return 0;
+
+	if (len > U32_MAX)
+		return -EMSGSIZE;
+
+	total = ALIGN(sizeof(*rec) + len, PCDEV_RECORD_ALIGN);
+	shard = raw_cpu_ptr(pcdev->shards);
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!mutex_trylock(&shard->lock))
+			return -EAGAIN;
+	} else {
+		mutex_lock(&shard->lock);
+	}
+
+	off = shard->committed;
+	if (total > shard->size - off) {
+		ret = -ENOSPC;
+		goto out_unlock;
+	}
+
+	rec = (void *)(shard->base + off);
+	if (!copy_from_iter_full(rec + 1, len, from)) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+
+	rec->len = len;
+	rec->reserved = 0;
+	rec->timestamp = ktime_get_ns();
+	smp_store_release(&shard->committed, off + total);
+	ret = len;
+
+out_unlock:
+	mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+/**
+ * pcdev_llseek() - Reposition the file offset inside the instance buffer
+ * @filp: pointer to file
+ * @offset: offset relative to @whence
+ * @whence: SEEK_SET, SEEK_CUR or SEEK_END
+ *
+ * Return: new file position or error code.
+ */
+static loff_t pcdev_llseek(struct file *filp, loff_t offset, int whence)
+{
+	struct pcdev_private_data *pcdev = filp->private_data;
+
+	return fixed_size_llseek(filp, offset, whence, pcdev->pdata.size);
+}
+
+/**
+ * pcdev_mmap() - Map the instance buffer into userspace
+ * @filp: pointer to file
+ * @vma: user mapping to populate
+ *
+ * All pages of the requested range are inserted up front, accesses through
+ * the mapping never fault. Only shared mappings are supported, a private
+ * mapping would silently detach from the device on the first store.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct pcdev_private_data *pcdev = filp->private_data;
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+	return vm_map_pages(vma, pcdev->buf.pages, pcdev->buf.nr_pages);
+}
+
+/**
+ * struct pcdev_dmabuf - exporter state of a dma-buf backed by an instance
+ * @pages: Exported pages, each holding a reference taken at export time
+ * @nr_pages: Number of pages in @pages
+ * @lock: Protects @attachments, @vaddr and @vmap_count
+ * @attachments: Attached devices, struct pcdev_dmabuf_attachment
+ * @vaddr: Kernel mapping handed out by vmap, NULL when unmapped
+ * @vmap_count: Number of vmap users of @vaddr
+ */
+struct pcdev_dmabuf {
+	struct page **pages;
+	unsigned long nr_pages;
+	struct mutex lock;
+	struct list_head attachments;
+	void *vaddr;
+	unsigned int vmap_count;
+};
+
+/**
+ * struct pcdev_dmabuf_attachment - device attached to a pcdev dma-buf
+ * @list: Entry in pcdev_dmabuf.attachments
+ * @dev: Attached device
+ * @sgt: Scatter table of the exported pages
+ * @dir: DMA direction of the current mapping
+ * @mapped: @sgt is DMA mapped for @dev
+ */
+struct pcdev_dmabuf_attachment {
+	struct list_head list;
+	struct device *dev;
+	struct sg_table sgt;
+	enum dma_data_direction dir;
+	bool mapped;
+};
+
+static int pcdev_dmabuf_attach(struct dma_buf *dmabuf,
+			       struct dma_buf_attachment *attach)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	struct pcdev_dmabuf_attachment *a;
+	int ret;
+
+	a = kzalloc(sizeof(*a), GFP_KERNEL);
+	if (!a)
+		return -ENOMEM;
+
+	ret = sg_alloc_table_from_pages(&a->sgt, priv->pages, priv->nr_pages,
+					0, priv->nr_pages << PAGE_SHIFT,
+					GFP_KERNEL);
+	if (ret) {
+		kfree(a);
+		return ret;
+	}
+
+	a->dev = attach->dev;
+	attach->priv = a;
+
+	mutex_lock(&priv->lock);
+	list_add(&a->list, &priv->attachments);
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+static void pcdev_dmabuf_detach(struct dma_buf *dmabuf,
+				struct dma_buf_attachment *attach)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	struct pcdev_dmabuf_attachment *a = attach->priv;
+
+	mutex_lock(&priv->lock);
+	list_del(&a->list);
+	mutex_unlock(&priv->lock);
+
+	sg_free_table(&a->sgt);
+	kfree(a);
+}
+
+static struct sg_table *
+pcdev_dmabuf_map(struct dma_buf_attachment *attach,
+		 enum dma_data_direction dir)
+{
+	struct pcdev_dmabuf_attachment *a = attach->priv;
+	int ret;
+
+	ret = dma_map_sgtable(attach->dev, &a->sgt, dir, 0);
+	if (ret)
+		return ERR_PTR(ret);
+
+	a->dir = dir;
+	a->mapped = true;
+
+	return &a->sgt;
+}
+
+static void pcdev_dmabuf_unmap(struct dma_buf_attachment *attach,
+			       struct sg_table *sgt,
+			       enum dma_data_direction dir)
+{
+	struct pcdev_dmabuf_attachment *a = attach->priv;
+
+	a->mapped = false;
+	dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+}
+
+/**
+ * pcdev_dmabuf_begin_cpu_access() - Make device writes visible to the CPU
+ * @dmabuf: exported buffer
+ * @dir: direction of the CPU access
+ *
+ * Return: 0
+ */
+static int pcdev_dmabuf_begin_cpu_access(struct dma_buf *dmabuf,
+					 enum dma_data_direction dir)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	struct pcdev_dmabuf_attachment *a;
+
+	mutex_lock(&priv->lock);
+
+	list_for_each_entry(a, &priv->attachments, list)
+		if (a->mapped)
+			dma_sync_sgtable_for_cpu(a->dev, &a->sgt, dir);
+
+	if (priv->vaddr)
+		invalidate_kernel_vmap_range(priv->vaddr,
+					     priv->nr_pages << PAGE_SHIFT);
+
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+/**
+ * pcdev_dmabuf_end_cpu_access() - Make CPU writes visible to devices
+ * @dmabuf: exported buffer
+ * @dir: direction of the CPU access
+ *
+ * Return: 0
+ */
+static int pcdev_dmabuf_end_cpu_access(struct dma_buf *dmabuf,
+				       enum dma_data_direction dir)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	struct pcdev_dmabuf_attachment *a;
+
+	mutex_lock(&priv->lock);
+
+	if (priv->vaddr)
+		flush_kernel_vmap_range(priv->vaddr,
+					priv->nr_pages << PAGE_SHIFT);
+
+	list_for_each_entry(a, &priv->attachments, list)
+		if (a->mapped)
+			dma_sync_sgtable_for_device(a->dev, &a->sgt, dir);
+
+	mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+static int pcdev_dmabuf_mmap(struct dma_buf *dmabuf,
+			     struct vm_area_struct *vma)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+	return vm_map_pages(vma, priv->pages, priv->nr_pages);
+}
+
+static int pcdev_dmabuf_vmap(struct dma_buf *dmabuf, struct dma_buf_map *map)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	int ret = 0;
+
+	mutex_lock(&priv->lock);
+
+	if (!priv->vmap_count) {
+		priv->vaddr = vmap(priv->pages, priv->nr_pages, VM_MAP,
+				   PAGE_KERNEL);
+		if (!priv->vaddr)
+			ret = -ENOMEM;
+	}
+
+	if (!ret) {
+		priv->vmap_count++;
+		dma_buf_map_set_vaddr(map, priv->vaddr);
+	}
+
+	mutex_unlock(&priv->lock);
+
+	return ret;
+}
+
+static void pcdev_dmabuf_vunmap(struct dma_buf *dmabuf,
+				struct dma_buf_map *map)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+
+	mutex_lock(&priv->lock);
+
+	if (!--priv->vmap_count) {
+		vunmap(priv->vaddr);
+		priv->vaddr = NULL;
+	}
+
+	mutex_unlock(&priv->lock);
+}
+
+static void pcdev_dmabuf_release(struct dma_buf *dmabuf)
+{
+	struct pcdev_dmabuf *priv = dmabuf->priv;
+	unsigned long i;
+
+	for (i = 0; i < priv->nr_pages; i++)
+		put_page(priv->pages[i]);
+	kvfree(priv->pages);
+	kfree(priv);
+}
+
+static const struct dma_buf_ops pcdev_dmabuf_ops = {
+	.attach = pcdev_dmabuf_attach,
+	.detach = pcdev_dmabuf_detach,
+	.map_dma_buf = pcdev_dmabuf_map,
+	.unmap_dma_buf = pcdev_dmabuf_unmap,
+	.begin_cpu_access = pcdev_dmabuf_begin_cpu_access,
+	.end_cpu_access = pcdev_dmabuf_end_cpu_access,
+	.mmap = pcdev_dmabuf_mmap,
+	.vmap = pcdev_dmabuf_vmap,
+	.vunmap = pcdev_dmabuf_vunmap,
+	.release = pcdev_dmabuf_release,
+};
+
+/**
+ * pcdev_export_dmabuf() - Export the instance buffer as a dma-buf
+ * @filp: device file the request comes from
+ * @uarg: user pointer to struct pcdev_export_dmabuf
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_export_dmabuf(struct file *filp,
+			       struct pcdev_export_dmabuf __user *uarg)
+{
+	struct pcdev_private_data *pcdev = filp->private_data;
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct pcdev_export_dmabuf req;
+	struct pcdev_dmabuf *priv;
+	struct dma_buf *dmabuf;
+	unsigned long i;
+	int fd;
+
+	if (copy_from_user(&req, uarg, sizeof(req)))
+		return -EFAULT;
+
+	if (req.flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	if ((req.flags & O_ACCMODE) != O_RDONLY &&
+	    !(filp->f_mode & FMODE_WRITE))
+		return -EPERM;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	priv->nr_pages = pcdev->buf.nr_pages;
+	priv->pages = kvmalloc_array(priv->nr_pages, sizeof(*priv->pages),
+				     GFP_KERNEL);
+	if (!priv->pages) {
+		kfree(priv);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < priv->nr_pages; i++) {
+		priv->pages[i] = pcdev->buf.pages[i];
+		get_page(priv->pages[i]);
+	}
+
+	mutex_init(&priv->lock);
+	INIT_LIST_HEAD(&priv->attachments);
+
+	exp_info.ops = &pcdev_dmabuf_ops;
+	exp_info.size = priv->nr_pages << PAGE_SHIFT;
+	exp_info.flags = req.flags & O_ACCMODE;
+	exp_info.priv = priv;
+
+	dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dmabuf)) {
+		for (i = 0; i < priv->nr_pages; i++)
+			put_page(priv->pages[i]);
+		kvfree(priv->pages);
+		kfree(priv);
+		return PTR_ERR(dmabuf);
+	}
+
+	/*
+	 * Only install the fd once the caller knows it: an fd installed
+	 * before a failing copy_to_user() would leak into the process.
+	 */
+	fd = get_unused_fd_flags(req.flags & O_CLOEXEC);
+	if (fd < 0) {
+		dma_buf_put(dmabuf);
+		return fd;
+	}
+
+	req.fd = fd;
+	if (copy_to_user(uarg, &req, sizeof(req))) {
+		put_unused_fd(fd);
+		dma_buf_put(dmabuf);
+		return -EFAULT;
+	}
+
+	fd_install(fd, dmabuf->file);
+
+	return 0;
+}
+
+/**
+ * pcdev_ioctl() - Handle pseudo character device ioctls
+ * @filp: pointer to file
+ * @cmd: ioctl command, PCDEV_IOC_*
+ * @arg: ioctl argument
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static long pcdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case PCDEV_IOC_EXPORT_DMABUF:
+		return pcdev_export_dmabuf(filp, (void __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations pcdev_fops = {
+	.owner = THIS_MODULE,
+	.open = pcdev_open,
+	.release = pcdev_release,
+	.read_iter = pcdev_read_iter,
+	.write_iter = pcdev_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.llseek = pcdev_llseek,
+	.mmap = pcdev_mmap,
+	.unlocked_ioctl = pcdev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
+static const struct file_operations pcdev_fifo_fops = {
+	.owner = THIS_MODULE,
+	.open = pcdev_open,
+	.release = pcdev_release,
+	.read_iter = pcdev_fifo_read_iter,
+	.write_iter = pcdev_fifo_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.poll = pcdev_fifo_poll,
+	.llseek = no_llseek,
+};
+
+static const struct file_operations pcdev_percpu_fops = {
+	.owner = THIS_MODULE,
+	.open = pcdev_percpu_open,
+	.release = pcdev_percpu_release,
+	.read_iter = pcdev_percpu_read_iter,
+	.write_iter = pcdev_percpu_write_iter,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.llseek = no_llseek,
+};
+
+/**
+ * pcdev_probe() - Bind a pseudo character device instance
+ * @pdev: pointer to platform device
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_probe(struct platform_device *pdev)
+{
+	struct pcdev_platform_data *pdata = dev_get_platdata(&pdev->dev);
+	const struct file_operations *fops;
+	struct pcdev_private_data *pcdev;
+	int node = NUMA_NO_NODE;
+	int ret;
+
+	if (!pdata || !pdata->size) {
+		dev_err(&pdev->dev, "no platform data");
+		return -EINVAL;
+	}
+
+	if (pdev->id < 0 || pdev->id >= PCDEV_MAX_DEVICES) {
+		dev_err(&pdev->dev, "invalid device id %d", pdev->id);
+		return -EINVAL;
+	}
+
+	pcdev = kzalloc(sizeof(*pcdev), GFP_KERNEL);
+	if (!pcdev)
+		return -ENOMEM;
+
+	pcdev->pdata = *pdata;
+	kref_init(&pcdev->kref);
+	init_rwsem(&pcdev->lock);
+	mutex_init(&pcdev->setup_lock);
+
+	switch (pdata->mode) {
+	case PCDEV_MODE_BUFFER:
+		fops = &pcdev_fops;
+		break;
+	case PCDEV_MODE_FIFO:
+		pcdev->pdata.size = roundup_pow_of_two(pdata->size);
+		fops = &pcdev_fifo_fops;
+		break;
+	case PCDEV_MODE_PERCPU:
+		fops = &pcdev_percpu_fops;
+		break;
+	default:
+		dev_err(&pdev->dev, "invalid mode %u", pdata->mode);
+		ret = -EINVAL;
+		goto error_free;
+	}
+
+	if (pdata->flags & PCDEV_FLAG_NUMA_NODE) {
+		node = pdata->numa_node;
+		if (node < 0 || node >= MAX_NUMNODES || !node_online(node)) {
+			dev_err(&pdev->dev, "invalid NUMA node %d", node);
+			ret = -EINVAL;
+			goto error_free;
+		}
+	}
+
+	if (!(pdata->flags & PCDEV_FLAG_NUMA_FIRST_OPENER)) {
+		ret = pcdev_setup(pcdev, &pdev->dev, node);
+		if (ret)
+			goto error_free;
+	}
+
+	pcdev->dev_num = pcdrv_data.device_num_base + pdev->id;
+
+	pcdev->cdev = cdev_alloc();
+	if (!pcdev->cdev) {
+		ret = -ENOMEM;
+		goto error_free_buffer;
+	}
+	pcdev->cdev->ops = fops;
+	pcdev->cdev->owner = THIS_MODULE;
+
+	/* Published before the node exists, so no open can miss it */
+	ret = xa_err(xa_store(&pcdrv_data.devices, pdev->id, pcdev,
+			      GFP_KERNEL));
+	if (ret) {
+		kobject_put(&pcdev->cdev->kobj);
+		goto error_free_buffer;
+	}
+
+	ret = cdev_add(pcdev->cdev, pcdev->dev_num, 1);
+	if (ret) {
+		dev_err(&pdev->dev, "failed to add cdev");
+		kobject_put(&pcdev->cdev->kobj);
+		goto error_unpublish;
+	}
+
+	pcdev->dev = device_create(pcdrv_data.class_pcd, &pdev->dev,
+				   pcdev->dev_num, NULL, "pcdev-%d", pdev->id);
+	if (IS_ERR(pcdev->dev)) {
+		dev_err(&pdev->dev, "failed to create device node");
+		ret = PTR_ERR(pcdev->dev);
+		pcdev->dev = NULL;
+		goto error_cdev_del;
+	}
+	get_device(pcdev->dev);
+
+	platform_set_drvdata(pdev, pcdev);
+
+	dev_dbg(&pdev->dev, "serial %s, size %zu bytes, %lu pages of order %u",
+		 pdata->serial_number, pcdev->pdata.size, pcdev->buf.nr_pages,
+		 pcdev->buf.order);
+
+	return 0;
+
+error_cdev_del:
+	cdev_del(pcdev->cdev);
+error_unpublish:
+	xa_erase(&pcdrv_data.devices, pdev->id);
+	/* A racing open may still hold the instance */
+	kref_put(&pcdev->kref, pcdev_free);
+
+	return ret;
+
+error_free_buffer:
+	free_percpu(pcdev->shards);
+	pcdev_buffer_free(&pcdev->buf);
+error_free:
+	kfree(pcdev);
+
+	return ret;
+}
+
+/**
+ * pcdev_platform_driver_probe() - Bind an instance and report it
+ * @pdev: pointer to platform device
+ *
+ * Completes the @probed completion of the platform data, if any, so that
+ * whoever registered @pdev can wait for this device alone.
+ *
+ * Return: 0 if successful, error code otherwise.
+ */
+static int pcdev_platform_driver_probe(struct platform_device *pdev)
+{
+	struct pcdev_platform_data *pdata = dev_get_platdata(&pdev->dev);
+	int ret;
+
+	ret = pcdev_probe(pdev);
+	if (pdata && pdata->probed)
+		complete(pdata->probed);
+
+	return ret;
+}
+
+/**
+ * pcdev_platform_driver_remove() - Unbind a pseudo character device instance
+ * @pdev: pointer to platform device
+ *
+ * Files still open on the instance keep working on its memory, which is
+ * freed when the last of them is released.
+ *
+ * Return: 0
+ */
+static int pcdev_platform_driver_remove(struct platform_device *pdev)
+{
+	struct pcdev_private_data *pcdev = platform_get_drvdata(pdev);
+
+	xa_erase(&pcdrv_data.devices, pdev->id);
+
+	device_destroy(pcdrv_data.class_pcd, pcdev->dev_num);
+	cdev_del(pcdev->cdev);
+	kref_put(&pcdev->kref, pcdev_free);
+
+	return 0;
+}
+
+/**
+ * footprint_show() - Report the memory used by an instance
+ * @dev: pointer to platform device
+ * @attr: device attribute
+ * @buf: sysfs output buffer
+ *
+ * Reports two numbers: the bytes of backing memory and the bytes of
+ * driver bookkeeping for the instance.
+ *
+ * Return: number of characters written to @buf
+ */
+static ssize_t footprint_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct pcdev_private_data *pcdev = dev_get_drvdata(dev);
+	size_t meta;
+
+	meta = sizeof(*pcdev) + pcdev->buf.nr_pages * sizeof(*pcdev->buf.pages);
+	if (pcdev->shards)
+		meta += nr_cpu_ids * sizeof(struct pcdev_shard);
+
+	return sprintf(buf, "%lu %zu\n", pcdev->buf.nr_pages << PAGE_SHIFT, meta);
+}
+static DEVICE_ATTR_RO(footprint);
+
+static struct attribute *pcdev_attrs[] = {
+	&dev_attr_footprint.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(pcdev);
+
+static struct platform_driver pcdev_platform_driver = {
+	.probe = pcdev_platform_driver_probe,
+	.remove = pcdev_platform_driver_remove,
+	.driver = {
+		.name = PCDEV_DRIVER_NAME,
+		.dev_groups = pcdev_groups,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	},
+};
+
+static int __init pcdev_platform_driver_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0,
+				  PCDEV_MAX_DEVICES, "pcdevs");
+	if (ret < 0)
+		return ret;
+
+	pcdrv_data.class_pcd = class_create(THIS_MODULE, PCDEV_CLASS_NAME);
+	if (IS_ERR(pcdrv_data.class_pcd)) {
+		ret = PTR_ERR(pcdrv_data.class_pcd);
+		goto error_unregister_region;
+	}
+
+	ret = platform_driver_register(&pcdev_platform_driver);
+	if (ret)
+		goto error_class_destroy;
+
+	return 0;
+
+error_class_destroy:
+	class_destroy(pcdrv_data.class_pcd);
+error_unregister_region:
+	unregister_chrdev_region(pcdrv_data.device_num_base, PCDEV_MAX_DEVICES);
+
+	return ret;
+}
+
+static void __exit pcdev_platform_driver_exit(void)
+{
+	platform_driver_unregister(&pcdev_platform_driver);
+	class_destroy(pcdrv_data.class_pcd);
+	unregister_chrdev_region(pcdrv_data.device_num_base, PCDEV_MAX_DEVICES);
+}
+
+module_init(pcdev_platform_driver_init);
+module_exit(pcdev_platform_driver_exit);
+
+MODULE_DESCRIPTION("Pseudo character device platform driver");
+MODULE_LICENSE("GPL");
+MODULE_IMPORT_NS(DMA_BUF);
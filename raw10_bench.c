@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Benchmark for raw10_unpack.c and raw10_stats.c
+ *
+ * Times unpacking of whole frames with every implementation the CPU
+ * supports, then the statistics of the same frames for each listed thread
+ * count, with and without a sub-sampling grid and metering zones. Frames
+ * are random packed RAW10 data, spread over more memory than the last
+ * level cache holds so that every frame is read from DRAM as it would be
+ * from a capture buffer. Every run prints one JSON object per line with
+ * the mean, p50 and p99 time per frame.
+ *
+ * Build: gcc -O2 -pthread -o raw10_bench raw10_bench.c raw10_stats.c raw10_unpack.c
+ *
+ * Examples:
+ *   raw10_bench
+ *   raw10_bench -f 1280x720 -t 1,2,4 -n 2000
+ *   raw10_bench -f 640x400 -g 4x4
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "raw10_stats.h"
+#include "raw10_unpack.h"
+
+#define BENCH_MAX_THREADS	8
+/* Enough distinct frames to defeat the last level cache */
+#define BENCH_POOL_BYTES	(64u << 20)
+
+/**
+ * struct bench_cfg - benchmark configuration
+ * @width, @height: frame size in pixels
+ * @frames: timed frames per run
+ * @threads: statistics thread counts to run
+ * @nr_threads: entries in @threads
+ * @step_x, @step_y: sub-sampling grid of the sub-sampled runs
+ */
+struct bench_cfg {
+	unsigned int width, height;
+	unsigned int frames;
+	unsigned int threads[BENCH_MAX_THREADS];
+	unsigned int nr_threads;
+	unsigned int step_x, step_y;
+};
+
+/**
+ * struct bench_pool - packed frames the runs cycle through
+ * @data: frame data, @count frames of @frame_bytes each
+ * @frame_bytes: bytes of one packed frame
+ * @count: frames in @data
+ */
+struct bench_pool {
+	uint8_t *data;
+	size_t frame_bytes;
+	unsigned int count;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void bench_report(const char *kernel, const char *isa,
+			 unsigned int threads, const struct bench_cfg *cfg,
+			 const struct bench_pool *pool, uint64_t *samples)
+{
+	uint64_t total = 0;
+	unsigned int i;
+	double mean;
+
+	for (i = 0; i < cfg->frames; i++)
+		total += samples[i];
+	qsort(samples, cfg->frames, sizeof(*samples), bench_cmp_u64);
+	mean = (double)total / cfg->frames;
+
+	printf("{\"kernel\":\"%s\",\"isa\":\"%s\",\"threads\":%u,"
+	       "\"width\":%u,\"height\":%u,\"frames\":%u,"
+	       "\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p99_ms\":%.4f,"
+	       "\"packed_gb_per_sec\":%.2f}\n",
+	       kernel, isa, threads, cfg->width, cfg->height, cfg->frames,
+	       mean / 1e6, samples[cfg->frames / 2] / 1e6,
+	       samples[(uint64_t)cfg->frames * 99 / 100] / 1e6,
+	       pool->frame_bytes / mean);
+}
+
+static const uint8_t *bench_frame(const struct bench_pool *pool,
+				  unsigned int i)
+{
+	return pool->data + (size_t)(i % pool->count) * pool->frame_bytes;
+}
+
+static void bench_unpack(const struct bench_cfg *cfg,
+			 const struct bench_pool *pool, uint64_t *samples)
+{
+	size_t pixels = (size_t)cfg->width * cfg->height;
+	uint16_t *out16;
+	uint64_t start;
+	uint8_t *out8;
+	unsigned int i;
+	int isa;
+
+	out16 = malloc(pixels * sizeof(*out16));
+	out8 = malloc(pixels);
+	if (!out16 || !out8)
+		goto out;
+
+	for (isa = RAW10_ISA_SCALAR; isa <= RAW10_ISA_AVX512; isa++) {
+		if (raw10_set_isa(isa))
+			continue;
+
+		for (i = 0; i < cfg->frames; i++) {
+			start = bench_now();
+			raw10_unpack16(bench_frame(pool, i), out16, pixels);
+			samples[i] = bench_now() - start;
+		}
+		bench_report("unpack16", raw10_isa_name(isa), 1, cfg, pool,
+			     samples);
+
+		for (i = 0; i < cfg->frames; i++) {
+			start = bench_now();
+			raw10_downshift8(bench_frame(pool, i), out8, pixels);
+			samples[i] = bench_now() - start;
+		}
+		bench_report("downshift8", raw10_isa_name(isa), 1, cfg, pool,
+			     samples);
+	}
+
+out:
+	free(out16);
+	free(out8);
+}
+
+static int bench_stats(const struct bench_cfg *cfg,
+		       const struct bench_pool *pool, const char *kernel,
+		       struct raw10_stats_cfg *scfg, uint64_t *samples)
+{
+	struct raw10_stats_ctx *ctx;
+	struct raw10_stats stats;
+	unsigned int t, i;
+	uint64_t start;
+
+	for (t = 0; t < cfg->nr_threads; t++) {
+		scfg->threads = cfg->threads[t];
+		ctx = raw10_stats_create(scfg);
+		if (!ctx)
+			return -errno;
+
+		/* untimed warm-up frame */
+		raw10_stats_run(ctx, bench_frame(pool, 0), &stats);
+		for (i = 0; i < cfg->frames; i++) {
+			start = bench_now();
+			raw10_stats_run(ctx, bench_frame(pool, i), &stats);
+			samples[i] = bench_now() - start;
+		}
+		raw10_stats_destroy(ctx);
+
+		bench_report(kernel, raw10_isa_name(raw10_get_isa()),
+			     cfg->threads[t], cfg, pool, samples);
+	}
+
+	return 0;
+}
+
+static int bench_pool_init(struct bench_pool *pool,
+			   const struct bench_cfg *cfg)
+{
+	size_t i, size;
+
+	pool->frame_bytes = raw10_line_bytes(cfg->width) * cfg->height;
+	pool->count = BENCH_POOL_BYTES / pool->frame_bytes;
+	if (pool->count < 2)
+		pool->count = 2;
+
+	size = (size_t)pool->count * pool->frame_bytes;
+	pool->data = malloc(size);
+	if (!pool->data)
+		return -ENOMEM;
+
+	srand(1);
+	for (i = 0; i < size; i++)
+		pool->data[i] = rand();
+
+	return 0;
+}
+
+static int bench_parse_threads(const char *arg, struct bench_cfg *cfg)
+{
+	char *copy = strdup(arg), *tok, *save, *end;
+	unsigned long v;
+	int ret = 0;
+
+	if (!copy)
+		return -ENOMEM;
+
+	cfg->nr_threads = 0;
+	for (tok = strtok_r(copy, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		v = strtoul(tok, &end, 0);
+		if (*end || !v || v > RAW10_STATS_MAX_THREADS ||
+		    cfg->nr_threads == BENCH_MAX_THREADS) {
+			ret = -EINVAL;
+			break;
+		}
+		cfg->threads[cfg->nr_threads++] = v;
+	}
+	free(copy);
+
+	return ret ? ret : cfg->nr_threads ? 0 : -EINVAL;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -f WxH      frame size (default 1280x720)\n"
+		"  -t LIST     statistics thread counts, e.g. 1,2,4 (default 1)\n"
+		"  -n FRAMES   timed frames per run (default 1000)\n"
+		"  -g XxY      sub-sampling grid of the sub-sampled runs (default 2x2)\n"
+		"  -h          this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_cfg cfg = {
+		.width = 1280, .height = 720,
+		.frames = 1000,
+		.threads = { 1 }, .nr_threads = 1,
+		.step_x = 2, .step_y = 2,
+	};
+	struct raw10_stats_zone zones[9];
+	struct raw10_stats_cfg scfg;
+	struct bench_pool pool;
+	uint64_t *samples;
+	unsigned int i;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "f:t:n:g:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (sscanf(optarg, "%ux%u", &cfg.width, &cfg.height) != 2 ||
+			    !cfg.width || !cfg.height) {
+				fprintf(stderr, "invalid frame size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			if (bench_parse_threads(optarg, &cfg)) {
+				fprintf(stderr, "invalid thread list '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			cfg.frames = strtoul(optarg, NULL, 0);
+			if (!cfg.frames) {
+				fprintf(stderr, "invalid frame count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			if (sscanf(optarg, "%ux%u", &cfg.step_x, &cfg.step_y) != 2 ||
+			    !cfg.step_x || !cfg.step_y) {
+				fprintf(stderr, "invalid grid '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	samples = malloc(cfg.frames * sizeof(*samples));
+	if (!samples || bench_pool_init(&pool, &cfg)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	bench_unpack(&cfg, &pool, samples);
+
+	/* statistics with the best implementation, as picked at first use */
+	for (i = RAW10_ISA_AVX512; raw10_set_isa(i); i--)
+		;
+
+	memset(&scfg, 0, sizeof(scfg));
+	scfg.width = cfg.width;
+	scfg.height = cfg.height;
+	scfg.clip_low = 16;
+	ret = bench_stats(&cfg, &pool, "stats", &scfg, samples);
+
+	/* 3x3 metering grid weighing the centre zone most */
+	for (i = 0; i < 9; i++) {
+		zones[i].x = i % 3 * cfg.width / 3;
+		zones[i].y = i / 3 * cfg.height / 3;
+		zones[i].width = cfg.width / 3;
+		zones[i].height = cfg.height / 3;
+		zones[i].weight = i == 4 ? 8 : 1;
+	}
+	scfg.zones = zones;
+	scfg.num_zones = 9;
+	if (!ret)
+		ret = bench_stats(&cfg, &pool, "stats-zones", &scfg, samples);
+
+	scfg.step_x = cfg.step_x;
+	scfg.step_y = cfg.step_y;
+	if (!ret)
+		ret = bench_stats(&cfg, &pool, "stats-zones-subsampled", &scfg,
+				  samples);
+
+	if (ret)
+		fprintf(stderr, "raw10_stats_create: %s\n", strerror(-ret));
+
+	free(pool.data);
+	free(samples);
+
+	return ret ? 1 : 0;
+}
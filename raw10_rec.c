@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Record and replay container for packed RAW10 sensor streams
+ *
+ * The writer issues one pwritev() per frame: the metadata block, the frame
+ * itself when its address and length meet the O_DIRECT alignment the file
+ * reports, and a zero tail up to the slot size. Other frames go through an
+ * aligned bounce buffer. The index is kept in memory and written at the end
+ * together with the final header, so a crash only loses the index, not the
+ * frames.
+ *
+ * The reader maps the whole file; frames are never copied.
+ *
+ * Build: gcc -O2 -c raw10_rec.c
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "raw10_rec.h"
+#include "raw10_unpack.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "raw10_rec only supports little endian hosts"
+#endif
+
+#define ROUND_UP(n, a)		(((n) + (a) - 1) / (a) * (a))
+
+_Static_assert(sizeof(struct raw10_rec_header) <= RAW10_REC_ALIGN,
+	       "header does not fit its block");
+_Static_assert(sizeof(struct raw10_rec_meta) <= RAW10_REC_ALIGN,
+	       "metadata does not fit its block");
+
+struct raw10_rec_writer {
+	int fd;
+	struct raw10_rec_header hdr;
+	uint8_t *block;
+	uint8_t *bounce;
+	uint8_t *zero;
+	/* O_DIRECT alignment of buffer addresses and lengths, 1 without it */
+	uint32_t mem_align;
+	uint32_t len_align;
+	struct raw10_rec_index_entry *index;
+	uint64_t index_size;
+};
+
+struct raw10_rec_reader {
+	const uint8_t *base;
+	size_t size;
+	const struct raw10_rec_header *hdr;
+	const struct raw10_rec_index_entry *index;
+	uint64_t num_frames;
+};
+
+static void *raw10_rec_alloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, RAW10_REC_ALIGN, size))
+		return NULL;
+
+	memset(p, 0, size);
+	return p;
+}
+
+/* Write the first RAW10_REC_ALIGN bytes, aligned for O_DIRECT */
+static int raw10_rec_write_header(struct raw10_rec_writer *w)
+{
+	memset(w->block, 0, RAW10_REC_ALIGN);
+	memcpy(w->block, &w->hdr, sizeof(w->hdr));
+
+	if (pwrite(w->fd, w->block, RAW10_REC_ALIGN, 0) != RAW10_REC_ALIGN)
+		return errno ? -errno : -EIO;
+
+	return 0;
+}
+
+/*
+ * Get the O_DIRECT alignment of the open file, from statx() where the
+ * kernel reports it and the block size otherwise. Returns false if the
+ * file cannot do direct I/O on the RAW10_REC_ALIGN layout.
+ */
+static bool raw10_rec_dio_align(struct raw10_rec_writer *w)
+{
+	struct stat st;
+
+#ifdef STATX_DIOALIGN
+	struct statx stx;
+
+	if (!statx(w->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) &&
+	    (stx.stx_mask & STATX_DIOALIGN)) {
+		/* Zero alignments mean no direct I/O on this file */
+		w->mem_align = stx.stx_dio_mem_align;
+		w->len_align = stx.stx_dio_offset_align;
+		return w->mem_align && w->len_align &&
+		       w->mem_align <= RAW10_REC_ALIGN &&
+		       w->len_align <= RAW10_REC_ALIGN;
+	}
+#endif
+
+	if (fstat(w->fd, &st))
+		return false;
+
+	w->mem_align = st.st_blksize;
+	w->len_align = st.st_blksize;
+	return st.st_blksize && st.st_blksize <= RAW10_REC_ALIGN;
+}
+
+static void raw10_rec_writer_free(struct raw10_rec_writer *w)
+{
+	if (w->fd >= 0)
+		close(w->fd);
+	free(w->block);
+	free(w->bounce);
+	free(w->zero);
+	free(w->index);
+	free(w);
+}
+
+struct raw10_rec_writer *raw10_rec_create(const char *path,
+					  const struct raw10_rec_info *info)
+{
+	struct raw10_rec_writer *w;
+	uint32_t stride;
+	uint64_t frame_size;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	int ret;
+
+	stride = info->stride ? info->stride : raw10_line_bytes(info->width);
+	frame_size = (uint64_t)stride * info->height;
+	if (!info->width || !info->height ||
+	    stride < raw10_line_bytes(info->width) ||
+	    frame_size + RAW10_REC_ALIGN > UINT32_MAX - RAW10_REC_ALIGN) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	memcpy(w->hdr.magic, RAW10_REC_MAGIC, sizeof(w->hdr.magic));
+	w->hdr.version = RAW10_REC_VERSION;
+	w->hdr.header_size = RAW10_REC_ALIGN;
+	w->hdr.width = info->width;
+	w->hdr.height = info->height;
+	w->hdr.stride = stride;
+	w->hdr.pixelformat = info->pixelformat;
+	w->hdr.frame_size = frame_size;
+	w->hdr.slot_size = RAW10_REC_ALIGN + ROUND_UP(frame_size,
+						      RAW10_REC_ALIGN);
+
+	w->block = raw10_rec_alloc(RAW10_REC_ALIGN);
+	w->zero = raw10_rec_alloc(RAW10_REC_ALIGN);
+	w->bounce = raw10_rec_alloc(w->hdr.slot_size - RAW10_REC_ALIGN);
+	if (!w->block || !w->zero || !w->bounce) {
+		w->fd = -1;
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	/* tmpfs and some FUSE filesystems refuse O_DIRECT */
+	w->fd = open(path, flags | O_DIRECT, 0644);
+	if (w->fd >= 0 && !raw10_rec_dio_align(w)) {
+		close(w->fd);
+		w->fd = -1;
+		errno = EINVAL;
+	}
+	if (w->fd < 0 && errno == EINVAL) {
+		w->fd = open(path, flags, 0644);
+		w->mem_align = 1;
+		w->len_align = 1;
+	}
+	if (w->fd < 0) {
+		ret = -errno;
+		goto error;
+	}
+
+	ret = raw10_rec_write_header(w);
+	if (ret)
+		goto error;
+
+	return w;
+
+error:
+	raw10_rec_writer_free(w);
+	errno = -ret;
+	return NULL;
+}
+
+int raw10_rec_append(struct raw10_rec_writer *w,
+		     const struct raw10_rec_meta *meta, const void *data)
+{
+	size_t padded = w->hdr.slot_size - RAW10_REC_ALIGN;
+	size_t len = meta->bytesused;
+	struct raw10_rec_index_entry *entry;
+	struct raw10_rec_meta *m;
+	struct iovec iov[3];
+	unsigned int n = 0;
+	ssize_t written;
+	off_t offset;
+
+	if (len > w->hdr.frame_size)
+		return -EINVAL;
+
+	if (w->hdr.num_frames == w->index_size) {
+		uint64_t size = w->index_size ? w->index_size * 2 : 1024;
+
+		entry = realloc(w->index, size * sizeof(*entry));
+		if (!entry)
+			return -ENOMEM;
+		w->index = entry;
+		w->index_size = size;
+	}
+
+	memset(w->block, 0, RAW10_REC_ALIGN);
+	m = (struct raw10_rec_meta *)w->block;
+	*m = *meta;
+	m->magic = RAW10_REC_META_MAGIC;
+	iov[n++] = (struct iovec){ w->block, RAW10_REC_ALIGN };
+
+	if (!((uintptr_t)data % w->mem_align) && !(len % w->len_align) &&
+	    padded - len <= RAW10_REC_ALIGN) {
+		if (len)
+			iov[n++] = (struct iovec){ (void *)data, len };
+		if (padded > len)
+			iov[n++] = (struct iovec){ w->zero, padded - len };
+	} else {
+		memcpy(w->bounce, data, len);
+		memset(w->bounce + len, 0, padded - len);
+		iov[n++] = (struct iovec){ w->bounce, padded };
+	}
+
+	offset = w->hdr.header_size + w->hdr.num_frames * w->hdr.slot_size;
+	written = pwritev(w->fd, iov, n, offset);
+	if (written != (ssize_t)w->hdr.slot_size)
+		return written < 0 ? -errno : -EIO;
+
+	entry = &w->index[w->hdr.num_frames++];
+	entry->timestamp_ns = meta->timestamp_ns;
+	entry->sequence = meta->sequence;
+	entry->reserved = 0;
+
+	return 0;
+}
+
+int raw10_rec_finish(struct raw10_rec_writer *w)
+{
+	struct raw10_rec_index_header ih = {
+		.num_frames = w->hdr.num_frames,
+	};
+	size_t len = sizeof(ih) + w->hdr.num_frames * sizeof(*w->index);
+	size_t padded = ROUND_UP(len, RAW10_REC_ALIGN);
+	uint64_t offset;
+	uint8_t *buf;
+	int ret = 0;
+
+	buf = raw10_rec_alloc(padded);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(ih.magic, RAW10_REC_INDEX_MAGIC, sizeof(ih.magic));
+	memcpy(buf, &ih, sizeof(ih));
+	if (w->hdr.num_frames)
+		memcpy(buf + sizeof(ih), w->index,
+		       w->hdr.num_frames * sizeof(*w->index));
+
+	offset = w->hdr.header_size + w->hdr.num_frames * w->hdr.slot_size;
+	if (pwrite(w->fd, buf, padded, offset) != (ssize_t)padded) {
+		ret = errno ? -errno : -EIO;
+		goto out;
+	}
+	/* Drop the O_DIRECT padding of the index */
+	if (ftruncate(w->fd, offset + len)) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* Publish the index only once it is on disk */
+	if (fdatasync(w->fd)) {
+		ret = -errno;
+		goto out;
+	}
+	w->hdr.index_offset = offset;
+	ret = raw10_rec_write_header(w);
+	if (!ret && fdatasync(w->fd))
+		ret = -errno;
+
+out:
+	free(buf);
+	raw10_rec_writer_free(w);
+	return ret;
+}
+
+static bool raw10_rec_slot_valid(const struct raw10_rec_reader *r,
+				 uint64_t i)
+{
+	const struct raw10_rec_meta *meta = (const void *)(r->base +
+		r->hdr->header_size + i * r->hdr->slot_size);
+
+	return meta->magic == RAW10_REC_META_MAGIC &&
+	       meta->bytesused <= r->hdr->frame_size;
+}
+
+/* Use the index if complete, else count the slots written before a crash */
+static void raw10_rec_load_index(struct raw10_rec_reader *r)
+{
+	const struct raw10_rec_header *hdr = r->hdr;
+	const struct raw10_rec_index_header *ih;
+	uint64_t slots = (r->size - hdr->header_size) / hdr->slot_size;
+	uint64_t n = hdr->num_frames;
+
+	if (hdr->index_offset && n <= slots &&
+	    hdr->index_offset == hdr->header_size + n * hdr->slot_size &&
+	    r->size - hdr->index_offset >= sizeof(*ih) &&
+	    (r->size - hdr->index_offset - sizeof(*ih)) / sizeof(*r->index) >= n) {
+		ih = (const void *)(r->base + hdr->index_offset);
+		if (!memcmp(ih->magic, RAW10_REC_INDEX_MAGIC, sizeof(ih->magic)) &&
+		    ih->num_frames == n) {
+			r->index = (const void *)(ih + 1);
+			r->num_frames = n;
+			return;
+		}
+	}
+
+	r->index = NULL;
+	for (n = 0; n < slots && raw10_rec_slot_valid(r, n); n++)
+		;
+	r->num_frames = n;
+}
+
+struct raw10_rec_reader *raw10_rec_open(const char *path)
+{
+	const struct raw10_rec_header *hdr;
+	struct raw10_rec_reader *r;
+	struct stat st;
+	void *base;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		ret = -errno;
+		close(fd);
+		errno = -ret;
+		return NULL;
+	}
+	if (st.st_size < RAW10_REC_ALIGN) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	ret = base == MAP_FAILED ? -errno : 0;
+	close(fd);
+	if (ret) {
+		errno = -ret;
+		return NULL;
+	}
+
+	hdr = base;
+	if (memcmp(hdr->magic, RAW10_REC_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != RAW10_REC_VERSION ||
+	    hdr->header_size < sizeof(*hdr) ||
+	    hdr->header_size > (uint64_t)st.st_size ||
+	    hdr->slot_size < RAW10_REC_ALIGN ||
+	    hdr->slot_size - RAW10_REC_ALIGN < hdr->frame_size) {
+		munmap(base, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(base, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	r->base = base;
+	r->size = st.st_size;
+	r->hdr = hdr;
+	raw10_rec_load_index(r);
+
+	/* Replay reads frames in order */
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+	return r;
+}
+
+void raw10_rec_close(struct raw10_rec_reader *r)
+{
+	if (!r)
+		return;
+
+	munmap((void *)r->base, r->size);
+	free(r);
+}
+
+void raw10_rec_get_info(const struct raw10_rec_reader *r,
+			struct raw10_rec_info *info)
+{
+	info->width = r->hdr->width;
+	info->height = r->hdr->height;
+	info->stride = r->hdr->stride;
+	info->pixelformat = r->hdr->pixelformat;
+}
+
+uint64_t raw10_rec_count(const struct raw10_rec_reader *r)
+{
+	return r->num_frames;
+}
+
+const uint8_t *raw10_rec_frame(const struct raw10_rec_reader *r, uint64_t i,
+			       const struct raw10_rec_meta **meta)
+{
+	const uint8_t *slot;
+
+	if (i >= r->num_frames)
+		return NULL;
+
+	slot = r->base + r->hdr->header_size + i * r->hdr->slot_size;
+	if (meta)
+		*meta = (const struct raw10_rec_meta *)slot;
+
+	return slot + RAW10_REC_ALIGN;
+}
+
+static uint64_t raw10_rec_timestamp(const struct raw10_rec_reader *r,
+				    uint64_t i)
+{
+	const struct raw10_rec_meta *meta;
+
+	if (r->index)
+		return r->index[i].timestamp_ns;
+
+	meta = (const void *)(r->base + r->hdr->header_size +
+			      i * r->hdr->slot_size);
+	return meta->timestamp_ns;
+}
+
+int64_t raw10_rec_find(const struct raw10_rec_reader *r,
+		       uint64_t timestamp_ns)
+{
+	uint64_t lo = 0, hi = r->num_frames, mid;
+
+	/* Last frame with a timestamp at or before @timestamp_ns */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (raw10_rec_timestamp(r, mid) <= timestamp_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (int64_t)lo - 1;
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Record and replay container for packed RAW10 sensor streams
+ *
+ * Layout, all fields little endian, all offsets multiples of
+ * RAW10_REC_ALIGN:
+ *
+ *   header     RAW10_REC_ALIGN bytes, struct raw10_rec_header
+ *   slot 0     RAW10_REC_ALIGN bytes of struct raw10_rec_meta, then the
+ *              frame padded to RAW10_REC_ALIGN
+ *   slot 1 ... slot_size bytes each
+ *   index      struct raw10_rec_index_header, then one
+ *              struct raw10_rec_index_entry per frame
+ *
+ * Slots have a fixed size, so frame i is at a computed offset. The index
+ * adds timestamp lookup without touching the frames; a file whose index
+ * was never written (index_offset 0) is recovered from its size.
+ */
+#ifndef _RAW10_REC_H
+#define _RAW10_REC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAW10_REC_MAGIC		"RAW10REC"
+#define RAW10_REC_INDEX_MAGIC	"RAW10IDX"
+#define RAW10_REC_META_MAGIC	0x4d303152	/* "R10M" */
+#define RAW10_REC_VERSION	1
+#define RAW10_REC_ALIGN		4096
+
+struct raw10_rec_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t pixelformat;
+	uint32_t frame_size;
+	uint32_t slot_size;
+	uint64_t num_frames;
+	uint64_t index_offset;
+};
+
+/**
+ * struct raw10_rec_meta - per-frame metadata
+ * @magic: RAW10_REC_META_MAGIC, checked when recovering
+ * @sequence: sensor frame counter
+ * @timestamp_ns: capture timestamp
+ * @exposure: exposure in lines
+ * @gain: analogue gain code
+ * @vblank: vertical blanking in lines
+ * @bytesused: valid bytes of the frame, at most frame_size
+ */
+struct raw10_rec_meta {
+	uint32_t magic;
+	uint32_t sequence;
+	uint64_t timestamp_ns;
+	uint32_t exposure;
+	uint32_t gain;
+	uint32_t vblank;
+	uint32_t bytesused;
+};
+
+struct raw10_rec_index_header {
+	char magic[8];
+	uint64_t num_frames;
+};
+
+struct raw10_rec_index_entry {
+	uint64_t timestamp_ns;
+	uint32_t sequence;
+	uint32_t reserved;
+};
+
+/**
+ * struct raw10_rec_info - stream format
+ * @width, @height: frame size in pixels
+ * @stride: bytes per line, 0 for the packed line size
+ * @pixelformat: V4L2 fourcc, V4L2_PIX_FMT_Y10P for the ov9282
+ */
+struct raw10_rec_info {
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t pixelformat;
+};
+
+struct raw10_rec_writer;
+struct raw10_rec_reader;
+
+/*
+ * Create @path, with O_DIRECT when the filesystem supports it. Returns
+ * NULL with errno set on failure.
+ */
+struct raw10_rec_writer *raw10_rec_create(const char *path,
+					  const struct raw10_rec_info *info);
+
+/*
+ * Append one frame of meta->bytesused bytes. Frames whose address and size
+ * meet the direct I/O alignment of the file, such as mmap'ed capture
+ * buffers on most devices, are written without a copy. Returns 0 or -errno.
+ */
+int raw10_rec_append(struct raw10_rec_writer *w,
+		     const struct raw10_rec_meta *meta, const void *data);
+
+/* Write the index and the final header, and free @w. Returns 0 or -errno */
+int raw10_rec_finish(struct raw10_rec_writer *w);
+
+/* Map @path. Returns NULL with errno set on failure */
+struct raw10_rec_reader *raw10_rec_open(const char *path);
+void raw10_rec_close(struct raw10_rec_reader *r);
+
+void raw10_rec_get_info(const struct raw10_rec_reader *r,
+			struct raw10_rec_info *info);
+uint64_t raw10_rec_count(const struct raw10_rec_reader *r);
+
+/* Frame @i and its metadata, NULL if out of range */
+const uint8_t *raw10_rec_frame(const struct raw10_rec_reader *r, uint64_t i,
+			       const struct raw10_rec_meta **meta);
+
+/* Index of the last frame at or before @timestamp_ns, -1 if none */
+int64_t raw10_rec_find(const struct raw10_rec_reader *r,
+		       uint64_t timestamp_ns);
+
+#endif
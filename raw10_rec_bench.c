@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Benchmark for raw10_rec.c
+ *
+ * Appends frames to a recording as fast as the writer goes, from a ring of
+ * page aligned buffers like mmap'ed capture buffers, or from unaligned
+ * ones with -u to measure the bounce buffer path. The file is then opened
+ * with the reader, which jumps to random frames and looks up random
+ * timestamps, once with the file's pages dropped from the page cache and
+ * once more on the same mapping. One JSON object per phase reports
+ * frames/s and bytes/s for the writer, with p50/p99/max append latency,
+ * and the mean time per random access for the reader.
+ *
+ * Run it on the filesystem recordings go to: tmpfs has no O_DIRECT and
+ * measures memory copies only.
+ *
+ * Build: gcc -O2 -o raw10_rec_bench raw10_rec_bench.c raw10_rec.c raw10_unpack.c
+ *
+ * Examples:
+ *   raw10_rec_bench -o /data/bench.r10
+ *   raw10_rec_bench -o /data/bench.r10 -f 1280x720 -n 3000 -u
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "raw10_rec.h"
+#include "raw10_unpack.h"
+
+#define BENCH_BUFFERS		8
+#define BENCH_LOOKUPS		100000
+/* Frame interval written to the timestamps, 120 fps */
+#define BENCH_INTERVAL_NS	8333333ull
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int bench_write(const char *path, const struct raw10_rec_info *info,
+		       unsigned int frames, bool unaligned, uint64_t *samples)
+{
+	size_t size = raw10_line_bytes(info->width) * info->height;
+	struct raw10_rec_meta meta = { 0 };
+	uint8_t *bufs[BENCH_BUFFERS] = { NULL };
+	struct raw10_rec_writer *w;
+	uint64_t start, total;
+	unsigned int i;
+	size_t j;
+	int ret = 0;
+
+	for (i = 0; i < BENCH_BUFFERS; i++) {
+		bufs[i] = aligned_alloc(4096, (size + 4096) / 4096 * 4096);
+		if (!bufs[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		for (j = 0; j < size + 1; j++)
+			bufs[i][j] = rand();
+	}
+
+	w = raw10_rec_create(path, info);
+	if (!w) {
+		ret = -errno;
+		goto out;
+	}
+
+	meta.bytesused = size;
+	meta.exposure = 500;
+	meta.gain = 0x10;
+	meta.vblank = 1022;
+
+	total = bench_now();
+	for (i = 0; i < frames && !ret; i++) {
+		meta.sequence = i;
+		meta.timestamp_ns = i * BENCH_INTERVAL_NS;
+
+		start = bench_now();
+		ret = raw10_rec_append(w, &meta,
+				       bufs[i % BENCH_BUFFERS] + unaligned);
+		samples[i] = bench_now() - start;
+	}
+	if (ret) {
+		raw10_rec_finish(w);
+		goto out;
+	}
+	ret = raw10_rec_finish(w);
+	total = bench_now() - total;
+	if (ret)
+		goto out;
+
+	qsort(samples, frames, sizeof(*samples), bench_cmp_u64);
+	printf("{\"phase\":\"write\",\"width\":%u,\"height\":%u,"
+	       "\"aligned\":%s,\"frames\":%u,\"seconds\":%.3f,"
+	       "\"fps\":%.1f,\"bytes_per_sec\":%.1f,"
+	       "\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+	       info->width, info->height, unaligned ? "false" : "true",
+	       frames, total / 1e9, frames * 1e9 / total,
+	       (double)frames * size * 1e9 / total,
+	       samples[frames / 2] / 1e3,
+	       samples[(uint64_t)frames * 99 / 100] / 1e3,
+	       samples[frames - 1] / 1e3);
+
+out:
+	for (i = 0; i < BENCH_BUFFERS; i++)
+		free(bufs[i]);
+	return ret;
+}
+
+/*
+ * Jump to random frames, touching their metadata and one byte of the
+ * frame, then look up random timestamps. Run twice on one mapping: the
+ * first pass faults the pages in, the second finds them mapped.
+ */
+static int bench_read(const char *path)
+{
+	static const char * const passes[] = { "first", "repeat" };
+	const struct raw10_rec_meta *meta;
+	uint64_t n, i, start, frame_ns, find_ns;
+	struct raw10_rec_reader *r;
+	unsigned long sum = 0;
+	const uint8_t *frame;
+	unsigned int pass;
+
+	r = raw10_rec_open(path);
+	if (!r)
+		return -errno;
+
+	n = raw10_rec_count(r);
+	if (!n) {
+		raw10_rec_close(r);
+		return -ENODATA;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		srand(2);
+		start = bench_now();
+		for (i = 0; i < BENCH_LOOKUPS; i++) {
+			frame = raw10_rec_frame(r, (uint64_t)rand() % n, &meta);
+			sum += meta->sequence + frame[meta->bytesused / 2];
+		}
+		frame_ns = (bench_now() - start) / BENCH_LOOKUPS;
+
+		start = bench_now();
+		for (i = 0; i < BENCH_LOOKUPS; i++)
+			sum += raw10_rec_find(r, (uint64_t)rand() % n *
+						 BENCH_INTERVAL_NS + 1);
+		find_ns = (bench_now() - start) / BENCH_LOOKUPS;
+
+		printf("{\"phase\":\"read\",\"pass\":\"%s\",\"frames\":%llu,"
+		       "\"lookups\":%u,\"frame_ns\":%llu,\"find_ns\":%llu,"
+		       "\"checksum\":%lu}\n",
+		       passes[pass], (unsigned long long)n, BENCH_LOOKUPS,
+		       (unsigned long long)frame_ns,
+		       (unsigned long long)find_ns, sum);
+	}
+
+	raw10_rec_close(r);
+
+	return 0;
+}
+
+/* Start the reader from the disk, whether or not the writer used O_DIRECT */
+static void bench_drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -o FILE [options]\n"
+		"  -o FILE     recording to create, overwritten\n"
+		"  -f WxH      frame size (default 1280x720)\n"
+		"  -n FRAMES   frames to write (default 2000)\n"
+		"  -u          append from unaligned buffers\n"
+		"  -k          keep the recording\n"
+		"  -h          this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct raw10_rec_info info = {
+		.width = 1280, .height = 720,
+		.pixelformat = V4L2_PIX_FMT_Y10P,
+	};
+	unsigned int frames = 2000;
+	bool unaligned = false, keep = false;
+	const char *path = NULL;
+	uint64_t *samples;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "o:f:n:ukh")) != -1) {
+		switch (opt) {
+		case 'o':
+			path = optarg;
+			break;
+		case 'f':
+			if (sscanf(optarg, "%ux%u", &info.width, &info.height) != 2 ||
+			    !info.width || !info.height) {
+				fprintf(stderr, "invalid frame size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			if (!frames) {
+				fprintf(stderr, "invalid frame count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'u':
+			unaligned = true;
+			break;
+		case 'k':
+			keep = true;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!path) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	samples = malloc(frames * sizeof(*samples));
+	if (!samples) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	ret = bench_write(path, &info, frames, unaligned, samples);
+	if (ret) {
+		fprintf(stderr, "write: %s\n", strerror(-ret));
+		goto out;
+	}
+
+	bench_drop_cache(path);
+	ret = bench_read(path);
+	if (ret)
+		fprintf(stderr, "read: %s\n", strerror(-ret));
+
+out:
+	if (!keep)
+		unlink(path);
+	free(samples);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Per-frame statistics of packed RAW10 frames
+ *
+ * Every sampled line is unpacked with the SIMD kernels of raw10_unpack.c,
+ * or gathered directly from the packed data when sub-sampling
+ * horizontally, and only counted in a histogram of all 1024 levels. The
+ * sum, the clipped counts and the 8-bit histogram are derived from it once
+ * per frame, so the per-pixel cost is a single increment. The histogram is
+ * spread over four interleaved tables so that runs of equal pixels do not
+ * serialise on one counter; the tables of a band fit in the L1 cache.
+ *
+ * The zone edges split each line in segments of constant zone weight. The
+ * segments under a zone are summed in the same pass as the histogram, so
+ * the weighted sum costs an add per pixel rather than a second read of the
+ * line per zone.
+ *
+ * The sampled lines are split in one band per thread. The worker threads
+ * live as long as the context, the caller computes the first band itself.
+ *
+ * Build: gcc -O2 -pthread -c raw10_stats.c raw10_unpack.c
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw10_stats.h"
+#include "raw10_unpack.h"
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define RAW10_LEVELS		1024
+/* Segment edges: both edges of every zone plus both ends of the line */
+#define RAW10_MAX_EDGES		(2 * RAW10_STATS_MAX_ZONES + 2)
+
+struct raw10_stats_band {
+	struct raw10_stats_ctx *ctx;
+	pthread_t thread;
+	unsigned int first, last;
+	uint16_t *line;
+	uint32_t hist[4][RAW10_LEVELS];
+	uint64_t zone_sum;
+	uint64_t zone_weight;
+};
+
+struct raw10_stats_ctx {
+	struct raw10_stats_cfg cfg;
+	struct raw10_stats_zone zones[RAW10_STATS_MAX_ZONES];
+	unsigned int samples_x, samples_y;
+	/* Sample index ranges of the zones and the sorted segment edges */
+	unsigned int zone_first[RAW10_STATS_MAX_ZONES];
+	unsigned int zone_last[RAW10_STATS_MAX_ZONES];
+	unsigned int edges[RAW10_MAX_EDGES];
+	unsigned int num_edges;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	const uint8_t *frame;
+	unsigned long generation;
+	unsigned int pending;
+	bool stop;
+
+	unsigned int num_bands;
+	struct raw10_stats_band bands[RAW10_STATS_MAX_THREADS];
+};
+
+/* First sample index at or after pixel @x of the line */
+static unsigned int raw10_sample_index(const struct raw10_stats_ctx *ctx,
+				       unsigned int x)
+{
+	unsigned int step = ctx->cfg.step_x;
+
+	if (x <= ctx->cfg.x)
+		return 0;
+	x = DIV_ROUND_UP(x - ctx->cfg.x, step);
+
+	return x < ctx->samples_x ? x : ctx->samples_x;
+}
+
+/* Sort the segment edges and drop duplicates, leaving empty segments out */
+static void raw10_sort_edges(struct raw10_stats_ctx *ctx)
+{
+	unsigned int i, j, n = 0;
+
+	for (i = 1; i < ctx->num_edges; i++) {
+		unsigned int edge = ctx->edges[i];
+
+		for (j = i; j && ctx->edges[j - 1] > edge; j--)
+			ctx->edges[j] = ctx->edges[j - 1];
+		ctx->edges[j] = edge;
+	}
+
+	for (i = 0; i < ctx->num_edges; i++)
+		if (!n || ctx->edges[i] != ctx->edges[n - 1])
+			ctx->edges[n++] = ctx->edges[i];
+	ctx->num_edges = n;
+}
+
+/*
+ * Count @n samples in the histogram of @band and return their sum, or 0
+ * without summing if @sum is false. Inlined so that each use drops the
+ * unused half.
+ */
+static inline __attribute__((always_inline)) uint64_t
+raw10_stats_count(struct raw10_stats_band *band, const uint16_t *v,
+		  unsigned int n, bool sum)
+{
+	uint64_t s0 = 0, s1 = 0;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		band->hist[0][v[i]]++;
+		band->hist[1][v[i + 1]]++;
+		band->hist[2][v[i + 2]]++;
+		band->hist[3][v[i + 3]]++;
+		if (sum) {
+			s0 += v[i] + v[i + 1];
+			s1 += v[i + 2] + v[i + 3];
+		}
+	}
+	for (; i < n; i++) {
+		band->hist[0][v[i]]++;
+		if (sum)
+			s0 += v[i];
+	}
+
+	return s0 + s1;
+}
+
+static void raw10_stats_line(struct raw10_stats_band *band, unsigned int y)
+{
+	struct raw10_stats_ctx *ctx = band->ctx;
+	const struct raw10_stats_cfg *cfg = &ctx->cfg;
+	const uint8_t *line = ctx->frame + y * cfg->stride;
+	unsigned int weights[RAW10_MAX_EDGES] = { 0 };
+	unsigned int n = ctx->samples_x;
+	uint16_t *v = band->line;
+	unsigned int i, k;
+
+	if (cfg->step_x == 1) {
+		raw10_roi_unpack16(line, 0, cfg->x, 0, n, 1, v, 0);
+	} else {
+		for (i = 0; i < n; i++) {
+			unsigned int x = cfg->x + i * cfg->step_x;
+			const uint8_t *group = line + x / 4 * 5;
+
+			v[i] = (uint16_t)(group[x % 4] << 2) |
+			       ((group[4] >> (2 * (x % 4))) & 3);
+		}
+	}
+
+	/* Weight of each segment on this line */
+	for (i = 0; i < cfg->num_zones; i++) {
+		const struct raw10_stats_zone *zone = &ctx->zones[i];
+
+		if (y < zone->y || y - zone->y >= zone->height)
+			continue;
+
+		for (k = 0; k + 1 < ctx->num_edges; k++)
+			if (ctx->edges[k] >= ctx->zone_first[i] &&
+			    ctx->edges[k + 1] <= ctx->zone_last[i])
+				weights[k] += zone->weight;
+	}
+
+	for (k = 0; k + 1 < ctx->num_edges; k++) {
+		unsigned int first = ctx->edges[k];
+		unsigned int len = ctx->edges[k + 1] - first;
+
+		if (!weights[k]) {
+			raw10_stats_count(band, v + first, len, false);
+			continue;
+		}
+
+		band->zone_sum += weights[k] *
+				  raw10_stats_count(band, v + first, len, true);
+		band->zone_weight += (uint64_t)weights[k] * len;
+	}
+}
+
+static void raw10_stats_band_run(struct raw10_stats_band *band)
+{
+	const struct raw10_stats_cfg *cfg = &band->ctx->cfg;
+	unsigned int row;
+
+	memset(band->hist, 0, sizeof(band->hist));
+	band->zone_sum = 0;
+	band->zone_weight = 0;
+
+	for (row = band->first; row < band->last; row++)
+		raw10_stats_line(band, cfg->y + row * cfg->step_y);
+}
+
+static void *raw10_stats_worker(void *arg)
+{
+	struct raw10_stats_band *band = arg;
+	struct raw10_stats_ctx *ctx = band->ctx;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (;;) {
+		while (!ctx->stop && ctx->generation == seen)
+			pthread_cond_wait(&ctx->start, &ctx->lock);
+		if (ctx->stop)
+			break;
+		seen = ctx->generation;
+		pthread_mutex_unlock(&ctx->lock);
+
+		raw10_stats_band_run(band);
+
+		pthread_mutex_lock(&ctx->lock);
+		if (!--ctx->pending)
+			pthread_cond_signal(&ctx->done);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+static void raw10_stats_stop(struct raw10_stats_ctx *ctx, unsigned int started)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->stop = true;
+	pthread_cond_broadcast(&ctx->start);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 1; i < started; i++)
+		pthread_join(ctx->bands[i].thread, NULL);
+}
+
+void raw10_stats_destroy(struct raw10_stats_ctx *ctx)
+{
+	unsigned int i;
+
+	if (!ctx)
+		return;
+
+	raw10_stats_stop(ctx, ctx->num_bands);
+	for (i = 0; i < ctx->num_bands; i++)
+		free(ctx->bands[i].line);
+	pthread_cond_destroy(&ctx->done);
+	pthread_cond_destroy(&ctx->start);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+struct raw10_stats_ctx *raw10_stats_create(const struct raw10_stats_cfg *cfg)
+{
+	struct raw10_stats_ctx *ctx;
+	struct raw10_stats_cfg *c;
+	unsigned int i, per_band;
+	int ret;
+
+	if (!cfg->width || !cfg->height ||
+	    cfg->num_zones > RAW10_STATS_MAX_ZONES ||
+	    cfg->threads > RAW10_STATS_MAX_THREADS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->cfg = *cfg;
+	c = &ctx->cfg;
+	if (!c->stride)
+		c->stride = raw10_line_bytes(c->width);
+	if (!c->roi_width || !c->roi_height) {
+		c->x = c->y = 0;
+		c->roi_width = c->width;
+		c->roi_height = c->height;
+	}
+	if (!c->step_x)
+		c->step_x = 1;
+	if (!c->step_y)
+		c->step_y = 1;
+	if (!c->clip_high)
+		c->clip_high = 1023;
+	if (!c->threads)
+		c->threads = 1;
+
+	if (c->x >= c->width || c->roi_width > c->width - c->x ||
+	    c->y >= c->height || c->roi_height > c->height - c->y ||
+	    c->stride < raw10_line_bytes(c->width) ||
+	    c->clip_high > 1023 || c->clip_low >= c->clip_high) {
+		free(ctx);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memcpy(ctx->zones, cfg->zones, cfg->num_zones * sizeof(*cfg->zones));
+	c->zones = ctx->zones;
+	ctx->samples_x = DIV_ROUND_UP(c->roi_width, c->step_x);
+	ctx->samples_y = DIV_ROUND_UP(c->roi_height, c->step_y);
+
+	ctx->edges[ctx->num_edges++] = 0;
+	ctx->edges[ctx->num_edges++] = ctx->samples_x;
+	for (i = 0; i < c->num_zones; i++) {
+		ctx->zone_first[i] = raw10_sample_index(ctx, ctx->zones[i].x);
+		ctx->zone_last[i] = raw10_sample_index(ctx, ctx->zones[i].x +
+							    ctx->zones[i].width);
+		ctx->edges[ctx->num_edges++] = ctx->zone_first[i];
+		ctx->edges[ctx->num_edges++] = ctx->zone_last[i];
+	}
+	raw10_sort_edges(ctx);
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->start, NULL);
+	pthread_cond_init(&ctx->done, NULL);
+
+	/* No more bands than sampled lines */
+	ctx->num_bands = c->threads < ctx->samples_y ? c->threads
+						     : ctx->samples_y;
+	per_band = DIV_ROUND_UP(ctx->samples_y, ctx->num_bands);
+
+	for (i = 0; i < ctx->num_bands; i++) {
+		struct raw10_stats_band *band = &ctx->bands[i];
+
+		band->ctx = ctx;
+		band->first = i * per_band;
+		band->last = band->first + per_band < ctx->samples_y ?
+			     band->first + per_band : ctx->samples_y;
+		band->line = malloc(ctx->samples_x * sizeof(*band->line));
+		if (!band->line) {
+			ctx->num_bands = i;
+			goto error;
+		}
+
+		if (!i)
+			continue;
+
+		ret = pthread_create(&band->thread, NULL, raw10_stats_worker,
+				     band);
+		if (ret) {
+			free(band->line);
+			band->line = NULL;
+			ctx->num_bands = i;
+			errno = ret;
+			goto error;
+		}
+	}
+
+	return ctx;
+
+error:
+	ret = errno;
+	raw10_stats_destroy(ctx);
+	errno = ret;
+	return NULL;
+}
+
+void raw10_stats_run(struct raw10_stats_ctx *ctx, const uint8_t *frame,
+		     struct raw10_stats *stats)
+{
+	unsigned int i, j, level;
+
+	if (ctx->num_bands > 1) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->frame = frame;
+		ctx->pending = ctx->num_bands - 1;
+		ctx->generation++;
+		pthread_cond_broadcast(&ctx->start);
+		pthread_mutex_unlock(&ctx->lock);
+	} else {
+		ctx->frame = frame;
+	}
+
+	raw10_stats_band_run(&ctx->bands[0]);
+
+	if (ctx->num_bands > 1) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->pending)
+			pthread_cond_wait(&ctx->done, &ctx->lock);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	for (level = 0; level < RAW10_LEVELS; level++) {
+		uint64_t n = 0;
+
+		for (i = 0; i < ctx->num_bands; i++)
+			for (j = 0; j < 4; j++)
+				n += ctx->bands[i].hist[j][level];
+
+		stats->hist[level >> 2] += n;
+		stats->count += n;
+		stats->sum += n * level;
+		if (level <= ctx->cfg.clip_low)
+			stats->clipped_low += n;
+		if (level >= ctx->cfg.clip_high)
+			stats->clipped_high += n;
+	}
+
+	stats->weighted_sum = stats->sum;
+	stats->weight = stats->count;
+	for (i = 0; i < ctx->num_bands; i++) {
+		stats->weighted_sum += ctx->bands[i].zone_sum;
+		stats->weight += ctx->bands[i].zone_weight;
+	}
+
+	stats->mean = stats->count ? (double)stats->sum / stats->count : 0;
+	stats->weighted_mean = stats->weight ?
+		(double)stats->weighted_sum / stats->weight : 0;
+}
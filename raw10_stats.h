@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Per-frame statistics of packed RAW10 (Y10P) frames for auto exposure:
+ * histogram, mean, weighted mean and clipped pixel counts, computed from
+ * the packed data on a pool of threads working on row bands.
+ *
+ * On one core of the machine raw10_bench was run on, a 1280x720 frame takes
+ * under 1 ms with every pixel sampled and no zones. With a 3x3 zone grid the
+ * full-sampling median sits around 1 ms and varies past it, so a 1 ms
+ * budget with zones needs a sub-sampling grid (2x2 stays below it) or a
+ * second thread.
+ */
+#ifndef _RAW10_STATS_H
+#define _RAW10_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Histogram bins, one per value of the 8 most significant bits */
+#define RAW10_STATS_BINS	256
+#define RAW10_STATS_MAX_ZONES	16
+#define RAW10_STATS_MAX_THREADS	16
+
+/**
+ * struct raw10_stats_zone - weighted metering zone
+ * @x, @y, @width, @height: rectangle in frame coordinates
+ * @weight: weight added to the pixels of the zone
+ */
+struct raw10_stats_zone {
+	unsigned int x, y, width, height;
+	unsigned int weight;
+};
+
+/**
+ * struct raw10_stats_cfg - statistics configuration
+ * @width, @height: frame size in pixels
+ * @stride: bytes between frame lines, 0 for raw10_line_bytes(@width)
+ * @x, @y, @roi_width, @roi_height: measured rectangle, the whole frame if
+ *	@roi_width or @roi_height is 0
+ * @step_x, @step_y: sub-sampling grid, every pixel if 0 or 1
+ * @clip_low: pixels at or below this 10-bit value count as crushed
+ * @clip_high: pixels at or above this 10-bit value count as saturated, 0
+ *	for 1023
+ * @zones: metering zones, every sampled pixel weighs 1 plus the weights of
+ *	the zones containing it
+ * @num_zones: number of entries in @zones
+ * @threads: threads sharing the work, including the caller, 0 for 1
+ */
+struct raw10_stats_cfg {
+	unsigned int width, height;
+	size_t stride;
+	unsigned int x, y, roi_width, roi_height;
+	unsigned int step_x, step_y;
+	unsigned int clip_low, clip_high;
+	const struct raw10_stats_zone *zones;
+	unsigned int num_zones;
+	unsigned int threads;
+};
+
+/**
+ * struct raw10_stats - statistics of one frame
+ * @hist: histogram of the 8 most significant bits of the sampled pixels
+ * @count: sampled pixels
+ * @sum: sum of the 10-bit values of the sampled pixels
+ * @weighted_sum, @weight: weighted sum of the 10-bit values and sum of the
+ *	weights
+ * @clipped_low, @clipped_high: crushed and saturated sampled pixels
+ * @mean: @sum / @count
+ * @weighted_mean: @weighted_sum / @weight
+ */
+struct raw10_stats {
+	uint32_t hist[RAW10_STATS_BINS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t weighted_sum;
+	uint64_t weight;
+	uint64_t clipped_low;
+	uint64_t clipped_high;
+	double mean;
+	double weighted_mean;
+};
+
+struct raw10_stats_ctx;
+
+/* Returns NULL with errno set on invalid configuration or failure */
+struct raw10_stats_ctx *raw10_stats_create(const struct raw10_stats_cfg *cfg);
+void raw10_stats_destroy(struct raw10_stats_ctx *ctx);
+
+/*
+ * Compute the statistics of @frame. Calls on one context must not run
+ * concurrently.
+ */
+void raw10_stats_run(struct raw10_stats_ctx *ctx, const uint8_t *frame,
+		     struct raw10_stats *stats);
+
+#endif
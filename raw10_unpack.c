@@ -0,0 +1,381 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CSI-2 packed RAW10 unpacking with runtime CPU dispatch
+ *
+ * The SIMD kernels gather the high byte of every pixel and the shared
+ * low-bits byte of its group into 16-bit lanes with byte shuffles, then
+ * move the 2 low bits of pixel k into place by multiplying the low-bits
+ * byte by 2^(6 - 2k) and shifting right by 6. Shuffles work within 128-bit
+ * lanes, so every 128-bit lane handles two 5-byte groups (8 pixels) for
+ * unpacking, or three groups (12 pixels) for downshifting.
+ *
+ * Kernels run only while the groups of the remaining pixels, rounded up
+ * to 5 bytes, cover every byte of their loads, and leave the rest to the
+ * next narrower kernel and finally the scalar code, so they never read
+ * past the groups of the requested pixels.
+ *
+ * Build: gcc -O2 -c raw10_unpack.c (x86-64; other architectures only get
+ * the scalar code)
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "raw10_unpack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAW10_HAVE_X86
+#include <immintrin.h>
+#endif
+
+struct raw10_impl {
+	enum raw10_isa isa;
+	void (*unpack16)(const uint8_t *src, uint16_t *dst, size_t pixels);
+	void (*downshift8)(const uint8_t *src, uint8_t *dst, size_t pixels);
+};
+
+static inline uint16_t raw10_pixel(const uint8_t *group, unsigned int k)
+{
+	return (uint16_t)(group[k] << 2) | ((group[4] >> (2 * k)) & 3);
+}
+
+/* Unpack @pixels pixels starting at pixel @k of the group at @src */
+static void raw10_unpack16_tail(const uint8_t *src, unsigned int k,
+				uint16_t *dst, size_t pixels)
+{
+	for (; pixels; pixels--) {
+		*dst++ = raw10_pixel(src, k);
+		if (++k == 4) {
+			k = 0;
+			src += 5;
+		}
+	}
+}
+
+static void raw10_downshift8_tail(const uint8_t *src, unsigned int k,
+				  uint8_t *dst, size_t pixels)
+{
+	for (; pixels; pixels--) {
+		*dst++ = src[k];
+		if (++k == 4) {
+			k = 0;
+			src += 5;
+		}
+	}
+}
+
+static void raw10_unpack16_scalar(const uint8_t *src, uint16_t *dst,
+				  size_t pixels)
+{
+	for (; pixels >= 4; pixels -= 4, src += 5, dst += 4) {
+		dst[0] = raw10_pixel(src, 0);
+		dst[1] = raw10_pixel(src, 1);
+		dst[2] = raw10_pixel(src, 2);
+		dst[3] = raw10_pixel(src, 3);
+	}
+	raw10_unpack16_tail(src, 0, dst, pixels);
+}
+
+static void raw10_downshift8_scalar(const uint8_t *src, uint8_t *dst,
+				    size_t pixels)
+{
+	for (; pixels >= 4; pixels -= 4, src += 5, dst += 4)
+		memcpy(dst, src, 4);
+	raw10_downshift8_tail(src, 0, dst, pixels);
+}
+
+static const struct raw10_impl raw10_impl_scalar = {
+	.isa = RAW10_ISA_SCALAR,
+	.unpack16 = raw10_unpack16_scalar,
+	.downshift8 = raw10_downshift8_scalar,
+};
+
+#ifdef RAW10_HAVE_X86
+
+/* Per 128-bit lane: high bytes and low-bits bytes of two groups */
+#define RAW10_SHUF_HI	 0, -1,  1, -1,  2, -1,  3, -1, \
+			 5, -1,  6, -1,  7, -1,  8, -1
+#define RAW10_SHUF_LO	 4, -1,  4, -1,  4, -1,  4, -1, \
+			 9, -1,  9, -1,  9, -1,  9, -1
+#define RAW10_MUL	64, 16, 4, 1, 64, 16, 4, 1
+/* Per 128-bit lane: high bytes of three groups, packed in 12 bytes */
+#define RAW10_SHUF_8	 0,  1,  2,  3,  5,  6,  7,  8, \
+			10, 11, 12, 13, -1, -1, -1, -1
+
+__attribute__((target("sse4.1")))
+static void raw10_unpack16_sse41(const uint8_t *src, uint16_t *dst,
+				 size_t pixels)
+{
+	const __m128i shuf_hi = _mm_setr_epi8(RAW10_SHUF_HI);
+	const __m128i shuf_lo = _mm_setr_epi8(RAW10_SHUF_LO);
+	const __m128i mul = _mm_setr_epi16(RAW10_MUL);
+	const __m128i three = _mm_set1_epi16(3);
+
+	/* 8 pixels from 10 bytes, with a 16-byte load: 13 pixels are 20 bytes */
+	for (; pixels > 12; pixels -= 8, src += 10, dst += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i *)src);
+		__m128i hi = _mm_slli_epi16(_mm_shuffle_epi8(in, shuf_hi), 2);
+		__m128i lo = _mm_mullo_epi16(_mm_shuffle_epi8(in, shuf_lo), mul);
+
+		lo = _mm_and_si128(_mm_srli_epi16(lo, 6), three);
+		_mm_storeu_si128((__m128i *)dst, _mm_or_si128(hi, lo));
+	}
+	raw10_unpack16_scalar(src, dst, pixels);
+}
+
+__attribute__((target("sse4.1")))
+static void raw10_downshift8_sse41(const uint8_t *src, uint8_t *dst,
+				   size_t pixels)
+{
+	const __m128i shuf = _mm_setr_epi8(RAW10_SHUF_8);
+
+	/* 12 pixels from 15 bytes, with a 16-byte load: 13 pixels are 20 bytes */
+	for (; pixels > 12; pixels -= 12, src += 15, dst += 12) {
+		__m128i out = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)src), shuf);
+
+		_mm_storel_epi64((__m128i *)dst, out);
+		_mm_storeu_si32(dst + 8, _mm_srli_si128(out, 8));
+	}
+	raw10_downshift8_scalar(src, dst, pixels);
+}
+
+static const struct raw10_impl raw10_impl_sse41 = {
+	.isa = RAW10_ISA_SSE41,
+	.unpack16 = raw10_unpack16_sse41,
+	.downshift8 = raw10_downshift8_sse41,
+};
+
+__attribute__((target("avx2")))
+static void raw10_unpack16_avx2(const uint8_t *src, uint16_t *dst,
+				size_t pixels)
+{
+	const __m256i shuf_hi = _mm256_setr_epi8(RAW10_SHUF_HI, RAW10_SHUF_HI);
+	const __m256i shuf_lo = _mm256_setr_epi8(RAW10_SHUF_LO, RAW10_SHUF_LO);
+	const __m256i mul = _mm256_setr_epi16(RAW10_MUL, RAW10_MUL);
+	const __m256i three = _mm256_set1_epi16(3);
+
+	/* 16 pixels from 20 bytes, loading 26: the upper lane is at byte 10 */
+	for (; pixels > 20; pixels -= 16, src += 20, dst += 16) {
+		__m256i in = _mm256_loadu2_m128i((const __m128i *)(src + 10),
+						 (const __m128i *)src);
+		__m256i hi = _mm256_slli_epi16(_mm256_shuffle_epi8(in, shuf_hi), 2);
+		__m256i lo = _mm256_mullo_epi16(_mm256_shuffle_epi8(in, shuf_lo),
+						mul);
+
+		lo = _mm256_and_si256(_mm256_srli_epi16(lo, 6), three);
+		_mm256_storeu_si256((__m256i *)dst, _mm256_or_si256(hi, lo));
+	}
+	raw10_unpack16_sse41(src, dst, pixels);
+}
+
+__attribute__((target("avx2")))
+static void raw10_downshift8_avx2(const uint8_t *src, uint8_t *dst,
+				  size_t pixels)
+{
+	const __m256i shuf = _mm256_setr_epi8(RAW10_SHUF_8, RAW10_SHUF_8);
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	const __m256i mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+
+	/* 24 pixels from 30 bytes, loading 31: the upper lane is at byte 15 */
+	for (; pixels > 24; pixels -= 24, src += 30, dst += 24) {
+		__m256i in = _mm256_loadu2_m128i((const __m128i *)(src + 15),
+						 (const __m128i *)src);
+		__m256i out = _mm256_permutevar8x32_epi32(
+			_mm256_shuffle_epi8(in, shuf), pack);
+
+		_mm256_maskstore_epi32((int *)dst, mask, out);
+	}
+	raw10_downshift8_sse41(src, dst, pixels);
+}
+
+static const struct raw10_impl raw10_impl_avx2 = {
+	.isa = RAW10_ISA_AVX2,
+	.unpack16 = raw10_unpack16_avx2,
+	.downshift8 = raw10_downshift8_avx2,
+};
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i raw10_load4x128(const uint8_t *src, size_t step)
+{
+	__m512i in = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)src));
+
+	in = _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *)(src + step)), 1);
+	in = _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *)(src + 2 * step)), 2);
+	return _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *)(src + 3 * step)), 3);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void raw10_unpack16_avx512(const uint8_t *src, uint16_t *dst,
+				  size_t pixels)
+{
+	const __m512i shuf_hi = _mm512_broadcast_i32x4(_mm_setr_epi8(RAW10_SHUF_HI));
+	const __m512i shuf_lo = _mm512_broadcast_i32x4(_mm_setr_epi8(RAW10_SHUF_LO));
+	const __m512i mul = _mm512_broadcast_i32x4(_mm_setr_epi16(RAW10_MUL));
+	const __m512i three = _mm512_set1_epi16(3);
+
+	/* 32 pixels from 40 bytes, loading 46: lanes are 10 bytes apart */
+	for (; pixels > 36; pixels -= 32, src += 40, dst += 32) {
+		__m512i in = raw10_load4x128(src, 10);
+		__m512i hi = _mm512_slli_epi16(_mm512_shuffle_epi8(in, shuf_hi), 2);
+		__m512i lo = _mm512_mullo_epi16(_mm512_shuffle_epi8(in, shuf_lo),
+						mul);
+
+		lo = _mm512_and_si512(_mm512_srli_epi16(lo, 6), three);
+		_mm512_storeu_si512(dst, _mm512_or_si512(hi, lo));
+	}
+	raw10_unpack16_avx2(src, dst, pixels);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void raw10_downshift8_avx512(const uint8_t *src, uint8_t *dst,
+				    size_t pixels)
+{
+	const __m512i shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(RAW10_SHUF_8));
+	const __m512i pack = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9,
+					       10, 12, 13, 14, 15, 15, 15, 15);
+
+	/* 48 pixels from 60 bytes, loading 61: lanes are 15 bytes apart */
+	for (; pixels > 48; pixels -= 48, src += 60, dst += 48) {
+		__m512i out = _mm512_permutexvar_epi32(pack,
+			_mm512_shuffle_epi8(raw10_load4x128(src, 15), shuf));
+
+		_mm512_mask_storeu_epi32(dst, 0x0fff, out);
+	}
+	raw10_downshift8_avx2(src, dst, pixels);
+}
+
+static const struct raw10_impl raw10_impl_avx512 = {
+	.isa = RAW10_ISA_AVX512,
+	.unpack16 = raw10_unpack16_avx512,
+	.downshift8 = raw10_downshift8_avx512,
+};
+
+#endif /* RAW10_HAVE_X86 */
+
+static const struct raw10_impl *raw10_impl_of(enum raw10_isa isa)
+{
+	switch (isa) {
+	case RAW10_ISA_SCALAR:
+		return &raw10_impl_scalar;
+#ifdef RAW10_HAVE_X86
+	case RAW10_ISA_SSE41:
+		return __builtin_cpu_supports("sse4.1") ? &raw10_impl_sse41 : NULL;
+	case RAW10_ISA_AVX2:
+		return __builtin_cpu_supports("avx2") ? &raw10_impl_avx2 : NULL;
+	case RAW10_ISA_AVX512:
+		return __builtin_cpu_supports("avx512f") &&
+		       __builtin_cpu_supports("avx512bw") ?
+		       &raw10_impl_avx512 : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+/* The ISA is read from the implementation so the two never disagree */
+static const struct raw10_impl *raw10_impl;
+
+static const struct raw10_impl *raw10_get_impl(void)
+{
+	const struct raw10_impl *impl;
+	int isa;
+
+	impl = __atomic_load_n(&raw10_impl, __ATOMIC_ACQUIRE);
+	if (impl)
+		return impl;
+
+	/* Concurrent first callers all pick the same implementation */
+	for (isa = RAW10_ISA_AVX512; isa > RAW10_ISA_SCALAR; isa--) {
+		impl = raw10_impl_of(isa);
+		if (impl)
+			break;
+	}
+	if (!impl)
+		impl = &raw10_impl_scalar;
+
+	__atomic_store_n(&raw10_impl, impl, __ATOMIC_RELEASE);
+	return impl;
+}
+
+enum raw10_isa raw10_get_isa(void)
+{
+	return raw10_get_impl()->isa;
+}
+
+int raw10_set_isa(enum raw10_isa isa)
+{
+	const struct raw10_impl *impl = raw10_impl_of(isa);
+
+	if (!impl)
+		return -1;
+
+	__atomic_store_n(&raw10_impl, impl, __ATOMIC_RELEASE);
+	return 0;
+}
+
+const char *raw10_isa_name(enum raw10_isa isa)
+{
+	static const char * const names[] = {
+		[RAW10_ISA_SCALAR] = "scalar",
+		[RAW10_ISA_SSE41] = "sse4.1",
+		[RAW10_ISA_AVX2] = "avx2",
+		[RAW10_ISA_AVX512] = "avx512",
+	};
+
+	return isa < sizeof(names) / sizeof(names[0]) ? names[isa] : "unknown";
+}
+
+void raw10_unpack16(const uint8_t *src, uint16_t *dst, size_t pixels)
+{
+	raw10_get_impl()->unpack16(src, dst, pixels);
+}
+
+void raw10_downshift8(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+	raw10_get_impl()->downshift8(src, dst, pixels);
+}
+
+void raw10_roi_unpack16(const uint8_t *src, size_t src_stride,
+			unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height,
+			uint16_t *dst, size_t dst_stride)
+{
+	const struct raw10_impl *impl = raw10_get_impl();
+	unsigned int head = (4 - x % 4) % 4;
+	unsigned int row;
+
+	if (head > width)
+		head = width;
+
+	src += (size_t)y * src_stride + x / 4 * 5;
+	for (row = 0; row < height; row++) {
+		const uint8_t *s = src + row * src_stride;
+		uint16_t *d = (uint16_t *)((uint8_t *)dst + row * dst_stride);
+
+		/* Pixels before the first group boundary, then whole groups */
+		raw10_unpack16_tail(s, x % 4, d, head);
+		impl->unpack16(s + (head ? 5 : 0), d + head, width - head);
+	}
+}
+
+void raw10_roi_downshift8(const uint8_t *src, size_t src_stride,
+			  unsigned int x, unsigned int y,
+			  unsigned int width, unsigned int height,
+			  uint8_t *dst, size_t dst_stride)
+{
+	const struct raw10_impl *impl = raw10_get_impl();
+	unsigned int head = (4 - x % 4) % 4;
+	unsigned int row;
+
+	if (head > width)
+		head = width;
+
+	src += (size_t)y * src_stride + x / 4 * 5;
+	for (row = 0; row < height; row++) {
+		const uint8_t *s = src + row * src_stride;
+		uint8_t *d = dst + row * dst_stride;
+
+		raw10_downshift8_tail(s, x % 4, d, head);
+		impl->downshift8(s + (head ? 5 : 0), d + head, width - head);
+	}
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Unpacking of CSI-2 packed RAW10 frames, as produced by the ov9282 for
+ * MEDIA_BUS_FMT_Y10_1X10 (V4L2_PIX_FMT_Y10P in memory).
+ *
+ * Every 4 pixels are stored in 5 bytes: the 8 most significant bits of
+ * pixels 0..3, then one byte holding their 2 least significant bits, pixel
+ * 0 in bits 1:0.
+ *
+ * All functions pick an SSE4.1, AVX2 or AVX-512BW implementation at the
+ * first call, depending on what the CPU supports, and produce the same
+ * output as the scalar one.
+ */
+#ifndef _RAW10_UNPACK_H
+#define _RAW10_UNPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum raw10_isa {
+	RAW10_ISA_SCALAR,
+	RAW10_ISA_SSE41,
+	RAW10_ISA_AVX2,
+	RAW10_ISA_AVX512,
+};
+
+/*
+ * Bytes of a packed line of @width pixels, without padding: a partial
+ * group at the end of the line still takes all 5 bytes
+ */
+static inline size_t raw10_line_bytes(unsigned int width)
+{
+	return ((size_t)width + 3) / 4 * 5;
+}
+
+/*
+ * Return the implementation in use. raw10_set_isa() forces one, e.g. to
+ * compare implementations; it fails with -1 if the CPU lacks it.
+ */
+enum raw10_isa raw10_get_isa(void);
+int raw10_set_isa(enum raw10_isa isa);
+const char *raw10_isa_name(enum raw10_isa isa);
+
+/*
+ * Unpack @pixels pixels starting at the first pixel of @src to one 10-bit
+ * value per uint16_t. @src must hold the complete 5-byte groups of all
+ * pixels.
+ */
+void raw10_unpack16(const uint8_t *src, uint16_t *dst, size_t pixels);
+
+/* Same, keeping only the 8 most significant bits of every pixel */
+void raw10_downshift8(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+/*
+ * Extract the @width x @height rectangle at (@x, @y) of a frame with lines
+ * @src_stride bytes apart, to lines @dst_stride bytes apart. @x needs no
+ * alignment.
+ */
+void raw10_roi_unpack16(const uint8_t *src, size_t src_stride,
+			unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height,
+			uint16_t *dst, size_t dst_stride);
+void raw10_roi_downshift8(const uint8_t *src, size_t src_stride,
+			  unsigned int x, unsigned int y,
+			  unsigned int width, unsigned int height,
+			  uint8_t *dst, size_t dst_stride);
+
+#endif
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Bit-exactness and bounds test for raw10_unpack.c
+ *
+ * Every implementation the CPU supports is compared against a reference
+ * decoder for all pixel counts up to a few SIMD iterations, and for ROIs
+ * at every x offset of frames of every width modulo 4. The source always
+ * ends at the last byte of its groups, right before a PROT_NONE guard
+ * page, so a kernel that loads past the groups of the requested pixels
+ * faults. Destination buffers carry a canary after the last pixel.
+ *
+ * Build: gcc -O2 -o raw10_unpack_test raw10_unpack_test.c raw10_unpack.c
+ *
+ * Examples:
+ *   raw10_unpack_test
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "raw10_unpack.h"
+
+#define TEST_MAX_PIXELS		256
+#define TEST_CANARY		0xa5
+
+/**
+ * struct test_guard - buffer whose end is followed by a guard page
+ * @map: start of the mapping
+ * @map_size: size of the mapping, guard page included
+ * @end: first byte of the guard page
+ */
+struct test_guard {
+	uint8_t *map;
+	size_t map_size;
+	uint8_t *end;
+};
+
+static unsigned int test_failures;
+
+static int test_guard_init(struct test_guard *g, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t data = (size + page - 1) / page * page;
+
+	g->map_size = data + page;
+	g->map = mmap(NULL, g->map_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (g->map == MAP_FAILED)
+		return -1;
+
+	g->end = g->map + data;
+	return mprotect(g->end, page, PROT_NONE);
+}
+
+/* @size bytes of random data ending right before the guard page */
+static uint8_t *test_guard_fill(struct test_guard *g, size_t size)
+{
+	uint8_t *p = g->end - size;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		p[i] = rand();
+	return p;
+}
+
+static uint16_t test_pixel(const uint8_t *src, size_t i)
+{
+	const uint8_t *group = src + i / 4 * 5;
+
+	return group[i % 4] << 2 | (group[4] >> (2 * (i % 4)) & 3);
+}
+
+static void test_fail(const char *isa, const char *what, unsigned int a,
+		      unsigned int b, unsigned int c)
+{
+	if (test_failures++ < 20)
+		fprintf(stderr, "FAIL %s %s (%u, %u, %u)\n", isa, what, a, b, c);
+}
+
+static void test_lines(const char *isa, struct test_guard *g)
+{
+	uint16_t out16[TEST_MAX_PIXELS + 1];
+	uint8_t out8[TEST_MAX_PIXELS + 1];
+	const uint8_t *src;
+	size_t pixels, i;
+
+	for (pixels = 0; pixels <= TEST_MAX_PIXELS; pixels++) {
+		src = test_guard_fill(g, raw10_line_bytes(pixels));
+
+		memset(out16, TEST_CANARY, sizeof(out16));
+		memset(out8, TEST_CANARY, sizeof(out8));
+		raw10_unpack16(src, out16, pixels);
+		raw10_downshift8(src, out8, pixels);
+
+		for (i = 0; i < pixels; i++) {
+			if (out16[i] != test_pixel(src, i))
+				test_fail(isa, "unpack16", pixels, i, out16[i]);
+			if (out8[i] != test_pixel(src, i) >> 2)
+				test_fail(isa, "downshift8", pixels, i, out8[i]);
+		}
+		if (out16[pixels] != (TEST_CANARY << 8 | TEST_CANARY))
+			test_fail(isa, "unpack16 overrun", pixels, 0, 0);
+		if (out8[pixels] != TEST_CANARY)
+			test_fail(isa, "downshift8 overrun", pixels, 0, 0);
+	}
+}
+
+/* ROIs reaching the last pixel of the last line of the frame */
+static void test_rois(const char *isa, struct test_guard *g)
+{
+	enum { HEIGHT = 3, DST_STRIDE = 2 * TEST_MAX_PIXELS + 2 };
+	static uint16_t out16[HEIGHT][DST_STRIDE / 2];
+	static uint8_t out8[HEIGHT][DST_STRIDE];
+	unsigned int frame_width, x, width, row, i;
+	const uint8_t *src, *line;
+	size_t stride;
+
+	for (frame_width = 1; frame_width <= 100; frame_width++) {
+		stride = raw10_line_bytes(frame_width);
+		src = test_guard_fill(g, stride * HEIGHT);
+
+		for (x = 0; x < frame_width; x++) {
+			width = frame_width - x;
+
+			memset(out16, TEST_CANARY, sizeof(out16));
+			memset(out8, TEST_CANARY, sizeof(out8));
+			raw10_roi_unpack16(src, stride, x, 1, width, HEIGHT - 1,
+					   &out16[0][0], DST_STRIDE);
+			raw10_roi_downshift8(src, stride, x, 1, width, HEIGHT - 1,
+					     &out8[0][0], DST_STRIDE);
+
+			for (row = 0; row < HEIGHT - 1; row++) {
+				line = src + (row + 1) * stride;
+				for (i = 0; i < width; i++) {
+					if (out16[row][i] != test_pixel(line, x + i))
+						test_fail(isa, "roi_unpack16",
+							  frame_width, x, i);
+					if (out8[row][i] != test_pixel(line, x + i) >> 2)
+						test_fail(isa, "roi_downshift8",
+							  frame_width, x, i);
+				}
+				if (out8[row][width] != TEST_CANARY)
+					test_fail(isa, "roi_downshift8 overrun",
+						  frame_width, x, row);
+			}
+			if (out16[HEIGHT - 1][0] != (TEST_CANARY << 8 | TEST_CANARY))
+				test_fail(isa, "roi_unpack16 overrun",
+					  frame_width, x, 0);
+		}
+	}
+}
+
+int main(void)
+{
+	struct test_guard g;
+	unsigned int failures;
+	int isa, tested = 0;
+
+	if (test_guard_init(&g, 3 * raw10_line_bytes(TEST_MAX_PIXELS))) {
+		perror("guard page");
+		return 1;
+	}
+
+	srand(1);
+	for (isa = RAW10_ISA_SCALAR; isa <= RAW10_ISA_AVX512; isa++) {
+		if (raw10_set_isa(isa)) {
+			printf("%s: skipped, not supported by this CPU\n",
+			       raw10_isa_name(isa));
+			continue;
+		}
+
+		failures = test_failures;
+		test_lines(raw10_isa_name(isa), &g);
+		test_rois(raw10_isa_name(isa), &g);
+		printf("%s: %s\n", raw10_isa_name(isa),
+		       test_failures == failures ? "ok" : "FAIL");
+		tested++;
+	}
+
+	munmap(g.map, g.map_size);
+
+	return test_failures || !tested ? 1 : 0;
+}
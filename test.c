@@ -1,28 +1,466 @@
+#include <linux/completion.h>
+#include <linux/configfs.h>
+#include <linux/device.h>
+#include <linux/idr.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/slab.h>
 
-struct platform_device platform_pcdev_1 = {
-    .name = "pseudo-char-device",
-    .id = 0;
+#include "pcdev_platform.h"
+
+static void pcdev_release(struct device *dev){
 
 }
+
+static struct pcdev_platform_data pcdev_pdata[] = {
+    [0] = { .size = 512, .perm = PCDEV_PERM_RDWR, .serial_number = "PCDEVABC1111" },
+    [1] = { .size = 1024, .perm = PCDEV_PERM_RDWR, .serial_number = "PCDEVXYZ2222" },
+};
+
+struct platform_device platform_pcdev_1 = {
+    .name = PCDEV_DEVICE_NAME,
+    .id = 0,
+    .dev = {
+        .platform_data = &pcdev_pdata[0],
+        .release = pcdev_release,
+    },
+};
 struct platform_device platform_pcdev_2 = {
-    .name = "pseudo-char-device",
-    .id = 1;
+    .name = PCDEV_DEVICE_NAME,
+    .id = 1,
+    .dev = {
+        .platform_data = &pcdev_pdata[1],
+        .release = pcdev_release,
+    },
+};
+
+/*
+ * Runtime instances: every directory created under
+ * /sys/kernel/config/pcdev/ describes one device. Its attributes are
+ * writable until "enable" is set to 1, which registers the platform
+ * device; writing 0 (or removing the directory) unregisters it again.
+ */
 
+/* Ids below this one belong to the static devices above */
+#define PCDEV_DYNAMIC_ID_BASE   ARRAY_SIZE(pcdev_pdata)
+#define PCDEV_SERIAL_LEN        32
+/* Longest wait for the driver to probe an enabled instance */
+#define PCDEV_PROBE_TIMEOUT_MS  10000
+
+static DEFINE_IDA(pcdev_ida);
+
+/**
+ * struct pcdev_item - configfs description of a runtime instance
+ * @item: configfs item, one directory under the pcdev subsystem
+ * @lock: Serialises attribute access against enable/disable
+ * @pdata: Platform data handed to the device when it is enabled
+ * @serial_number: Storage for @pdata.serial_number
+ * @pdev: Registered platform device, NULL while disabled
+ * @probed: Completed by the driver once it probed @pdev
+ * @create_ns: Time registration and probe of the platform device took for
+ *             the last enable, in ns. The driver probes asynchronously,
+ *             so enable waits for the probe of this device before
+ *             stopping the clock. Registration alone if the driver is not
+ *             loaded.
+ */
+struct pcdev_item {
+    struct config_item item;
+    struct mutex lock;
+    struct pcdev_platform_data pdata;
+    char serial_number[PCDEV_SERIAL_LEN];
+    struct platform_device *pdev;
+    struct completion probed;
+    u64 create_ns;
+};
+
+static inline struct pcdev_item *to_pcdev_item(struct config_item *item){
+    return container_of(item, struct pcdev_item, item);
 }
 
+static int pcdev_item_enable(struct pcdev_item *pi){
+    struct platform_device *pdev;
+    ktime_t start;
+    int id;
 
-static int __init pcdev_platform_init(void){
+    id = ida_alloc_range(&pcdev_ida, PCDEV_DYNAMIC_ID_BASE,
+                         PCDEV_MAX_DEVICES - 1, GFP_KERNEL);
+    if (id < 0)
+        return id;
+
+    reinit_completion(&pi->probed);
+    pi->pdata.probed = &pi->probed;
+
+    start = ktime_get();
+    pdev = platform_device_register_data(NULL, PCDEV_DEVICE_NAME, id,
+                                         &pi->pdata, sizeof(pi->pdata));
+    if (IS_ERR(pdev)) {
+        ida_free(&pcdev_ida, id);
+        return PTR_ERR(pdev);
+    }
 
+    /* The node exists once enable returns, as with synchronous probing */
+    if (driver_find(PCDEV_DEVICE_NAME, &platform_bus_type) &&
+        !wait_for_completion_timeout(&pi->probed,
+                                     msecs_to_jiffies(PCDEV_PROBE_TIMEOUT_MS)))
+        dev_warn(&pdev->dev, "not probed after %u ms\n",
+                 PCDEV_PROBE_TIMEOUT_MS);
+    pi->create_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 
-    platform_device_register(&platform_pcdev_1);
-    platform_device_register(&platform_pcdev_2);
+    pi->pdev = pdev;
     return 0;
+}
+
+static void pcdev_item_disable(struct pcdev_item *pi){
+    int id = pi->pdev->id;
+
+    platform_device_unregister(pi->pdev);
+    ida_free(&pcdev_ida, id);
+    pi->pdev = NULL;
+}
+
+/* Show/store helpers for the numeric platform data attributes */
+#define PCDEV_ITEM_ATTR(_name, _type)                                        \
+static ssize_t pcdev_item_##_name##_show(struct config_item *item,          \
+                                         char *page)                        \
+{                                                                           \
+    return sprintf(page, "%lld\n",                                          \
+                   (long long)to_pcdev_item(item)->pdata._name);            \
+}                                                                           \
+static ssize_t pcdev_item_##_name##_store(struct config_item *item,         \
+                                          const char *page, size_t len)     \
+{                                                                           \
+    struct pcdev_item *pi = to_pcdev_item(item);                            \
+    _type val;                                                              \
+    int ret;                                                                \
+                                                                            \
+    ret = kstrto##_type(page, 0, &val);                                     \
+    if (ret)                                                                \
+        return ret;                                                         \
+                                                                            \
+    mutex_lock(&pi->lock);                                                  \
+    if (pi->pdev) {                                                         \
+        mutex_unlock(&pi->lock);                                            \
+        return -EBUSY;                                                      \
+    }                                                                       \
+    pi->pdata._name = val;                                                  \
+    mutex_unlock(&pi->lock);                                                \
+                                                                            \
+    return len;                                                             \
+}                                                                           \
+CONFIGFS_ATTR(pcdev_item_, _name)
+
+PCDEV_ITEM_ATTR(size, u64);
+PCDEV_ITEM_ATTR(perm, int);
+PCDEV_ITEM_ATTR(flags, u32);
+PCDEV_ITEM_ATTR(mode, u32);
+PCDEV_ITEM_ATTR(rx_watermark, u64);
+PCDEV_ITEM_ATTR(tx_watermark, u64);
+PCDEV_ITEM_ATTR(numa_node, int);
 
+static ssize_t pcdev_item_serial_number_show(struct config_item *item, char *page){
+    return sprintf(page, "%s\n", to_pcdev_item(item)->serial_number);
+}
+
+static ssize_t pcdev_item_serial_number_store(struct config_item *item,
+                                              const char *page, size_t len){
+    struct pcdev_item *pi = to_pcdev_item(item);
+    int ret = len;
+
+    mutex_lock(&pi->lock);
+    if (pi->pdev)
+        ret = -EBUSY;
+    else
+        strscpy(pi->serial_number, strim((char *)page), PCDEV_SERIAL_LEN);
+    mutex_unlock(&pi->lock);
 
+    return ret;
+}
+CONFIGFS_ATTR(pcdev_item_, serial_number);
+
+static ssize_t pcdev_item_enable_show(struct config_item *item, char *page){
+    return sprintf(page, "%d\n", !!to_pcdev_item(item)->pdev);
+}
+
+static ssize_t pcdev_item_enable_store(struct config_item *item,
+                                       const char *page, size_t len){
+    struct pcdev_item *pi = to_pcdev_item(item);
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(page, &enable);
+    if (ret)
+        return ret;
+
+    mutex_lock(&pi->lock);
+    if (enable && !pi->pdev)
+        ret = pcdev_item_enable(pi);
+    else if (!enable && pi->pdev)
+        pcdev_item_disable(pi);
+    mutex_unlock(&pi->lock);
+
+    return ret ? ret : len;
+}
+CONFIGFS_ATTR(pcdev_item_, enable);
+
+static ssize_t pcdev_item_id_show(struct config_item *item, char *page){
+    struct pcdev_item *pi = to_pcdev_item(item);
+    int ret;
+
+    mutex_lock(&pi->lock);
+    ret = sprintf(page, "%d\n", pi->pdev ? pi->pdev->id : -1);
+    mutex_unlock(&pi->lock);
+
+    return ret;
+}
+CONFIGFS_ATTR_RO(pcdev_item_, id);
+
+static ssize_t pcdev_item_create_ns_show(struct config_item *item, char *page){
+    return sprintf(page, "%llu\n", to_pcdev_item(item)->create_ns);
+}
+CONFIGFS_ATTR_RO(pcdev_item_, create_ns);
+
+/* Bookkeeping this module keeps per instance, the driver reports its own
+ * share through the "footprint" attribute of the platform device */
+static ssize_t pcdev_item_overhead_show(struct config_item *item, char *page){
+    return sprintf(page, "%zu\n", sizeof(struct pcdev_item) +
+                   sizeof(struct platform_device) +
+                   sizeof(struct pcdev_platform_data));
+}
+CONFIGFS_ATTR_RO(pcdev_item_, overhead);
+
+static struct configfs_attribute *pcdev_item_attrs[] = {
+    &pcdev_item_attr_size,
+    &pcdev_item_attr_perm,
+    &pcdev_item_attr_flags,
+    &pcdev_item_attr_mode,
+    &pcdev_item_attr_rx_watermark,
+    &pcdev_item_attr_tx_watermark,
+    &pcdev_item_attr_numa_node,
+    &pcdev_item_attr_serial_number,
+    &pcdev_item_attr_enable,
+    &pcdev_item_attr_id,
+    &pcdev_item_attr_create_ns,
+    &pcdev_item_attr_overhead,
+    NULL,
+};
+
+static void pcdev_item_release(struct config_item *item){
+    kfree(to_pcdev_item(item));
+}
+
+static struct configfs_item_operations pcdev_item_ops = {
+    .release = pcdev_item_release,
+};
+
+static const struct config_item_type pcdev_item_type = {
+    .ct_item_ops = &pcdev_item_ops,
+    .ct_attrs = pcdev_item_attrs,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct config_item *pcdev_make_item(struct config_group *group,
+                                           const char *name){
+    struct pcdev_item *pi;
+
+    pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+    if (!pi)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_init(&pi->lock);
+    init_completion(&pi->probed);
+    pi->pdata.size = PAGE_SIZE;
+    pi->pdata.perm = PCDEV_PERM_RDWR;
+    pi->pdata.serial_number = pi->serial_number;
+    strscpy(pi->serial_number, name, PCDEV_SERIAL_LEN);
+    config_item_init_type_name(&pi->item, name, &pcdev_item_type);
+
+    return &pi->item;
+}
+
+static void pcdev_drop_item(struct config_group *group,
+                            struct config_item *item){
+    struct pcdev_item *pi = to_pcdev_item(item);
+
+    mutex_lock(&pi->lock);
+    if (pi->pdev)
+        pcdev_item_disable(pi);
+    mutex_unlock(&pi->lock);
+
+    config_item_put(item);
+}
+
+static struct configfs_group_operations pcdev_group_ops = {
+    .make_item = pcdev_make_item,
+    .drop_item = pcdev_drop_item,
+};
+
+static const struct config_item_type pcdev_group_type = {
+    .ct_group_ops = &pcdev_group_ops,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem pcdev_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "pcdev",
+            .ci_type = &pcdev_group_type,
+        },
+    },
+};
+
+
+/*
+ * Extra instances registered at load time. They are allocated up front,
+ * added in one pass and probed asynchronously by the driver, so module
+ * load does not wait for hundreds of buffer allocations in a row.
+ */
+static unsigned int nr_instances;
+module_param(nr_instances, uint, 0444);
+MODULE_PARM_DESC(nr_instances, "Number of extra instances registered at load time");
+
+static unsigned long instance_size = PAGE_SIZE;
+module_param(instance_size, ulong, 0444);
+MODULE_PARM_DESC(instance_size, "Buffer size of the extra instances in bytes");
+
+static struct platform_device **pcdev_boot_devs;
+
+static void pcdev_boot_put(unsigned int count){
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        ida_free(&pcdev_ida, pcdev_boot_devs[i]->id);
+        platform_device_put(pcdev_boot_devs[i]);
+    }
+    kfree(pcdev_boot_devs);
+    pcdev_boot_devs = NULL;
+}
+
+static struct platform_device *pcdev_boot_alloc(void){
+    struct pcdev_platform_data pdata = {
+        .size = instance_size,
+        .perm = PCDEV_PERM_RDWR,
+        .serial_number = "PCDEVBOOT",
+    };
+    struct platform_device *pdev;
+    int id, ret;
+
+    id = ida_alloc_range(&pcdev_ida, PCDEV_DYNAMIC_ID_BASE,
+                         PCDEV_MAX_DEVICES - 1, GFP_KERNEL);
+    if (id < 0)
+        return ERR_PTR(id);
+
+    pdev = platform_device_alloc(PCDEV_DEVICE_NAME, id);
+    if (!pdev) {
+        ida_free(&pcdev_ida, id);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    ret = platform_device_add_data(pdev, &pdata, sizeof(pdata));
+    if (ret) {
+        platform_device_put(pdev);
+        ida_free(&pcdev_ida, id);
+        return ERR_PTR(ret);
+    }
+
+    return pdev;
+}
+
+/* Allocate every extra instance first, then add them all in one pass */
+static int pcdev_boot_register(void){
+    unsigned int i;
+    int ret;
+
+    if (!nr_instances)
+        return 0;
+
+    pcdev_boot_devs = kcalloc(nr_instances, sizeof(*pcdev_boot_devs),
+                              GFP_KERNEL);
+    if (!pcdev_boot_devs)
+        return -ENOMEM;
+
+    for (i = 0; i < nr_instances; i++) {
+        pcdev_boot_devs[i] = pcdev_boot_alloc();
+        if (IS_ERR(pcdev_boot_devs[i])) {
+            ret = PTR_ERR(pcdev_boot_devs[i]);
+            pcdev_boot_put(i);
+            return ret;
+        }
+    }
+
+    for (i = 0; i < nr_instances; i++) {
+        ret = platform_device_add(pcdev_boot_devs[i]);
+        if (ret)
+            goto error_del;
+    }
+
+    return 0;
+
+error_del:
+    while (i--)
+        platform_device_del(pcdev_boot_devs[i]);
+    pcdev_boot_put(nr_instances);
+    return ret;
+}
+
+static void pcdev_boot_unregister(void){
+    unsigned int i;
+
+    if (!pcdev_boot_devs)
+        return;
+
+    for (i = 0; i < nr_instances; i++)
+        platform_device_del(pcdev_boot_devs[i]);
+    pcdev_boot_put(nr_instances);
+}
+
+static int __init pcdev_platform_init(void){
+    unsigned int count = ARRAY_SIZE(pcdev_pdata) + nr_instances;
+    ktime_t start;
+    s64 elapsed;
+    int ret;
+
+    start = ktime_get();
+
+    ret = platform_device_register(&platform_pcdev_1);
+    if (ret) {
+        platform_device_put(&platform_pcdev_1);
+        return ret;
+    }
+
+    ret = platform_device_register(&platform_pcdev_2);
+    if (ret) {
+        platform_device_put(&platform_pcdev_2);
+        goto error_unregister_1;
+    }
+
+    ret = pcdev_boot_register();
+    if (ret)
+        goto error_unregister_2;
+
+    elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+    pr_info("pcdev: registered %u instances in %lld us, %lld ns per instance\n",
+            count, elapsed / NSEC_PER_USEC, elapsed / count);
+
+    config_group_init(&pcdev_subsys.su_group);
+    mutex_init(&pcdev_subsys.su_mutex);
+    ret = configfs_register_subsystem(&pcdev_subsys);
+    if (ret)
+        goto error_boot_unregister;
+
+    return 0;
+
+error_boot_unregister:
+    pcdev_boot_unregister();
+error_unregister_2:
+    platform_device_unregister(&platform_pcdev_2);
+error_unregister_1:
+    platform_device_unregister(&platform_pcdev_1);
+    return ret;
 }
 static void  __exit pcdev_platform_exit(void){
+    configfs_unregister_subsystem(&pcdev_subsys);
+    pcdev_boot_unregister();
     platform_device_unregister(&platform_pcdev_1);
     platform_device_unregister(&platform_pcdev_2);
 
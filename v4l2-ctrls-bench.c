@@ -0,0 +1,544 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: in-kernel microbenchmarks.
+ *
+ * Loading the module runs every benchmark once and logs the results:
+ *
+ *	modprobe v4l2-ctrls-bench nr_ctrls=512
+ *	dmesg | grep v4l2-ctrls-bench
+ *
+ * find: v4l2_ctrl_find() over a parent handler that aggregates
+ * @nr_ctrls controls from handlers of @ctrls_per_child controls through
+ * v4l2_ctrl_add_handler(), with the buckets sized from @parent_hint, and
+ * v4l2_ctrl_phash_find() over the same handler once
+ * v4l2_ctrl_handler_finalize() built the collision-free table. Both take
+ * the handler lock around every lookup. IDs are looked up in a strided
+ * order so the single-entry cache of the handler rarely hits, as in a
+ * VIDIOC_S_EXT_CTRLS storm.
+ *
+ * lockless: @nr_readers threads read one integer control set up with
+ * v4l2_ctrl_enable_lockless() while one thread sets it with
+ * v4l2_ctrl_s_ctrl_seq(), for @duration_ms, once with v4l2_ctrl_g_ctrl()
+ * and once with v4l2_ctrl_g_ctrl_lockless(). Reads and writes per second
+ * show how much readers and the writer slow each other down through the
+ * handler lock.
+ *
+ * req_pool: @frames allocations of request control storage for the parent
+ * handler of the find benchmark, each getting a request handler with one
+ * reference and value storage per control and releasing it. It runs once
+ * with separate allocations, the handler, its buckets and every reference,
+ * and once through the pool of v4l2_ctrl_req_pool_init(). It logs the
+ * allocations per frame and the mean, p99 and maximum get-to-release
+ * latency. This is the allocator cost alone: the request is never applied
+ * or completed. v4l2_request_bench measures the whole
+ * v4l2_ctrl_request_setup()/v4l2_ctrl_request_complete() path from
+ * userspace.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <media/v4l2-ctrls.h>
+
+#define BENCH_CID_BASE		(V4L2_CID_USER_BASE | 0x1000)
+
+static unsigned int nr_ctrls = 256;
+module_param(nr_ctrls, uint, 0444);
+MODULE_PARM_DESC(nr_ctrls, "Controls of the parent handler (default 256)");
+
+static unsigned int ctrls_per_child = 32;
+module_param(ctrls_per_child, uint, 0444);
+MODULE_PARM_DESC(ctrls_per_child,
+		 "Controls per handler added to the parent (default 32)");
+
+static unsigned int parent_hint = 16;
+module_param(parent_hint, uint, 0444);
+MODULE_PARM_DESC(parent_hint,
+		 "nr_of_controls_hint of the parent handler (default 16)");
+
+static unsigned int rounds = 1000;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "Lookups of every control per measurement (default 1000)");
+
+static unsigned int nr_readers;
+module_param(nr_readers, uint, 0444);
+MODULE_PARM_DESC(nr_readers,
+		 "Reader threads of the lockless benchmark (default online CPUs - 1)");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "Length of each timed run (default 1000)");
+
+static unsigned int frames = 2400;
+module_param(frames, uint, 0444);
+MODULE_PARM_DESC(frames, "Requests of the req_pool benchmark (default 2400)");
+
+/**
+ * struct bench_ctrls - controls under test
+ * @parent: handler the lookups go through
+ * @children: handlers owning the controls, added to @parent
+ * @nr_children: number of entries in @children
+ */
+struct bench_ctrls {
+	struct v4l2_ctrl_handler parent;
+	struct v4l2_ctrl_handler *children;
+	unsigned int nr_children;
+};
+
+static int bench_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops bench_ctrl_ops = {
+	.s_ctrl = bench_s_ctrl,
+};
+
+static void bench_ctrls_free(struct bench_ctrls *b)
+{
+	unsigned int i;
+
+	mutex_lock(b->parent.lock);
+	v4l2_ctrl_handler_unfinalize(&b->parent);
+	mutex_unlock(b->parent.lock);
+	v4l2_ctrl_handler_free(&b->parent);
+	for (i = 0; i < b->nr_children; i++)
+		v4l2_ctrl_handler_free(&b->children[i]);
+	kfree(b->children);
+}
+
+/* Create @n integer controls spread over child handlers of @b->parent */
+static int bench_ctrls_init(struct bench_ctrls *b, unsigned int n)
+{
+	struct v4l2_ctrl_config cfg = {
+		.ops = &bench_ctrl_ops,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "Benchmark Control",
+		.max = 1000,
+		.step = 1,
+	};
+	struct v4l2_ctrl_handler *child;
+	unsigned int i;
+	int ret = 0;
+
+	b->nr_children = DIV_ROUND_UP(n, ctrls_per_child);
+	b->children = kcalloc(b->nr_children, sizeof(*b->children),
+			      GFP_KERNEL);
+	if (!b->children)
+		return -ENOMEM;
+
+	v4l2_ctrl_handler_init(&b->parent, parent_hint);
+	for (i = 0; i < b->nr_children; i++)
+		v4l2_ctrl_handler_init(&b->children[i], ctrls_per_child);
+
+	for (i = 0; i < n; i++) {
+		child = &b->children[i / ctrls_per_child];
+		cfg.id = BENCH_CID_BASE + i;
+		v4l2_ctrl_new_custom(child, &cfg, NULL);
+	}
+
+	for (i = 0; i < b->nr_children; i++) {
+		ret = b->children[i].error;
+		if (!ret)
+			ret = v4l2_ctrl_add_handler(&b->parent,
+						    &b->children[i], NULL,
+						    false);
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		bench_ctrls_free(b);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Visits every control once per round unless the stride divides @n */
+#define BENCH_FIND_STRIDE	97
+
+/*
+ * Look up @id in @hdl with v4l2_ctrl_phash_find(), taking the lock as
+ * v4l2_ctrl_find() does.
+ */
+static struct v4l2_ctrl_ref *bench_phash_find(struct v4l2_ctrl_handler *hdl,
+					      u32 id)
+{
+	struct v4l2_ctrl_ref *ref;
+
+	mutex_lock(hdl->lock);
+	ref = v4l2_ctrl_phash_find(hdl, id);
+	mutex_unlock(hdl->lock);
+
+	return ref;
+}
+
+/*
+ * Average time of one v4l2_ctrl_find() on @hdl, or of one
+ * v4l2_ctrl_phash_find() if @phash is set, in ns.
+ */
+static u64 bench_find_ns(struct v4l2_ctrl_handler *hdl, unsigned int n,
+			 bool phash)
+{
+	unsigned int r, i, missing = 0;
+	u64 start, ns;
+	u32 id;
+
+	start = ktime_get_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++) {
+			id = BENCH_CID_BASE + (i * BENCH_FIND_STRIDE) % n;
+			if (phash ? !bench_phash_find(hdl, id) :
+				    !v4l2_ctrl_find(hdl, id))
+				missing++;
+		}
+	}
+	ns = ktime_get_ns() - start;
+
+	if (missing)
+		pr_err("find: %u lookups failed\n", missing);
+
+	return div_u64(ns, (u64)rounds * n);
+}
+
+static int bench_find(void)
+{
+	struct bench_ctrls b = {};
+	u64 buckets_ns, phash_ns;
+	int ret;
+
+	ret = bench_ctrls_init(&b, nr_ctrls);
+	if (ret)
+		return ret;
+
+	buckets_ns = bench_find_ns(&b.parent, nr_ctrls, false);
+
+	ret = v4l2_ctrl_handler_finalize(&b.parent);
+	if (ret) {
+		pr_err("find: finalize failed: %d\n", ret);
+		goto out;
+	}
+	phash_ns = bench_find_ns(&b.parent, nr_ctrls, true);
+
+	pr_info("find: %u controls, %u buckets: %llu ns per lookup, perfect hash: %llu ns per lookup\n",
+		nr_ctrls, b.parent.nr_of_buckets, buckets_ns, phash_ns);
+
+out:
+	bench_ctrls_free(&b);
+	return ret;
+}
+
+/**
+ * struct bench_thread - one reader or writer of the lockless benchmark
+ * @ctrl: control accessed
+ * @stop: set when the run is over
+ * @lockless: read with v4l2_ctrl_g_ctrl_lockless()
+ * @ops: completed reads or writes
+ * @done: completed once the thread stopped counting
+ */
+struct bench_thread {
+	struct v4l2_ctrl *ctrl;
+	const bool *stop;
+	bool lockless;
+	u64 ops;
+	struct completion done;
+};
+
+static int bench_reader_fn(void *arg)
+{
+	struct bench_thread *t = arg;
+
+	while (!READ_ONCE(*t->stop)) {
+		if (t->lockless)
+			v4l2_ctrl_g_ctrl_lockless(t->ctrl);
+		else
+			v4l2_ctrl_g_ctrl(t->ctrl);
+		t->ops++;
+		cond_resched();
+	}
+
+	complete(&t->done);
+	return 0;
+}
+
+static int bench_writer_fn(void *arg)
+{
+	struct bench_thread *t = arg;
+
+	while (!READ_ONCE(*t->stop)) {
+		v4l2_ctrl_s_ctrl_seq(t->ctrl, t->ops % 1000);
+		t->ops++;
+		cond_resched();
+	}
+
+	complete(&t->done);
+	return 0;
+}
+
+/*
+ * Run @n readers and one writer, the writer being @threads[@n]. Returns
+ * the reads and the writes per second.
+ */
+static int bench_lockless_run(struct v4l2_ctrl *ctrl, bool lockless,
+			      struct bench_thread *threads, unsigned int n,
+			      u64 *reads, u64 *writes)
+{
+	struct task_struct *task;
+	bool stop = false;
+	unsigned int i, started;
+	u64 start, ns;
+	int ret = 0;
+
+	for (started = 0; started <= n; started++) {
+		struct bench_thread *t = &threads[started];
+
+		*t = (struct bench_thread) {
+			.ctrl = ctrl,
+			.stop = &stop,
+			.lockless = lockless,
+		};
+		init_completion(&t->done);
+
+		task = kthread_run(started < n ? bench_reader_fn :
+				   bench_writer_fn, t, "v4l2-ctrls-bench/%u",
+				   started);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+	}
+
+	start = ktime_get_ns();
+	if (!ret)
+		msleep(duration_ms);
+	WRITE_ONCE(stop, true);
+
+	for (i = 0; i < started; i++)
+		wait_for_completion(&threads[i].done);
+	ns = ktime_get_ns() - start;
+
+	*reads = 0;
+	for (i = 0; i < n; i++)
+		*reads += threads[i].ops;
+	*reads = div64_u64(*reads * NSEC_PER_SEC, ns);
+	*writes = div64_u64(threads[n].ops * NSEC_PER_SEC, ns);
+
+	return ret;
+}
+
+static int bench_lockless(void)
+{
+	struct v4l2_ctrl_config cfg = {
+		.ops = &bench_ctrl_ops,
+		.id = BENCH_CID_BASE,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "Benchmark Control",
+		.max = 1000,
+		.step = 1,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	};
+	unsigned int n = nr_readers ? nr_readers :
+			 max(num_online_cpus(), 2U) - 1;
+	u64 locked_reads, locked_writes, lockless_reads, lockless_writes;
+	struct v4l2_ctrl_handler hdl;
+	struct bench_thread *threads;
+	struct v4l2_ctrl *ctrl;
+	int ret;
+
+	threads = kcalloc(n + 1, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	v4l2_ctrl_handler_init(&hdl, 1);
+	ctrl = v4l2_ctrl_new_custom(&hdl, &cfg, NULL);
+	ret = hdl.error;
+	if (!ret)
+		ret = v4l2_ctrl_enable_lockless(ctrl);
+	if (ret)
+		goto out;
+
+	ret = bench_lockless_run(ctrl, false, threads, n, &locked_reads,
+				 &locked_writes);
+	if (!ret)
+		ret = bench_lockless_run(ctrl, true, threads, n,
+					 &lockless_reads, &lockless_writes);
+	if (ret) {
+		pr_err("lockless: cannot start threads: %d\n", ret);
+		goto out;
+	}
+
+	pr_info("lockless: %u readers, 1 writer: locked %llu reads/s %llu writes/s, lockless %llu reads/s %llu writes/s\n",
+		n, locked_reads, locked_writes, lockless_reads,
+		lockless_writes);
+
+out:
+	v4l2_ctrl_handler_free(&hdl);
+	kfree(threads);
+	return ret;
+}
+
+/* Piecewise request control storage for @parent, counted in @allocs */
+static int bench_req_alloc_frame(struct v4l2_ctrl_handler *parent,
+				 unsigned int *allocs)
+{
+	struct v4l2_ctrl_ref *ref, *new, *next;
+	struct v4l2_ctrl_handler *hdl;
+	LIST_HEAD(refs);
+	int ret = 0;
+
+	hdl = kzalloc(sizeof(*hdl), GFP_KERNEL);
+	if (!hdl)
+		return -ENOMEM;
+	v4l2_ctrl_handler_init(hdl, parent->nr_of_buckets * 8);
+	*allocs += 2;
+
+	mutex_lock(parent->lock);
+	list_for_each_entry(ref, &parent->ctrl_refs, node) {
+		new = kzalloc(sizeof(*new) +
+			      ref->ctrl->elems * ref->ctrl->elem_size,
+			      GFP_KERNEL);
+		if (!new) {
+			ret = -ENOMEM;
+			break;
+		}
+		new->ctrl = ref->ctrl;
+		new->p_req.p = new + 1;
+		list_add_tail(&new->node, &refs);
+		(*allocs)++;
+	}
+	mutex_unlock(parent->lock);
+
+	list_for_each_entry_safe(new, next, &refs, node)
+		kfree(new);
+	v4l2_ctrl_handler_free(hdl);
+	kfree(hdl);
+
+	return ret;
+}
+
+/* Request control storage for @parent from its pool */
+static int bench_req_pool_frame(struct v4l2_ctrl_handler *parent)
+{
+	struct v4l2_ctrl_ref *ref, *new;
+	struct v4l2_ctrl_handler *hdl;
+	unsigned int i = 0;
+
+	hdl = v4l2_ctrl_req_pool_get(parent);
+	if (!hdl)
+		return -ENOMEM;
+
+	mutex_lock(parent->lock);
+	list_for_each_entry(ref, &parent->ctrl_refs, node) {
+		new = v4l2_ctrl_req_pool_ref(hdl, i++);
+		if (new)
+			new->ctrl = ref->ctrl;
+	}
+	mutex_unlock(parent->lock);
+
+	v4l2_ctrl_req_pool_put(hdl);
+
+	return 0;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void bench_req_report(const char *name, u64 *lat, u64 allocs)
+{
+	u64 sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++)
+		sum += lat[i];
+	sort(lat, frames, sizeof(*lat), bench_cmp_u64, NULL);
+
+	pr_info("req_pool: %s: %llu.%02llu allocations per frame, latency mean %llu ns p99 %llu ns max %llu ns\n",
+		name, div_u64(allocs, frames),
+		div_u64(allocs * 100, frames) % 100, div_u64(sum, frames),
+		lat[(u64)frames * 99 / 100], lat[frames - 1]);
+}
+
+static int bench_req_pool(void)
+{
+	struct bench_ctrls b = {};
+	unsigned int i, allocs = 0;
+	long pool_allocs;
+	u64 *lat, start;
+	int ret;
+
+	lat = kvmalloc_array(frames, sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return -ENOMEM;
+
+	ret = bench_ctrls_init(&b, nr_ctrls);
+	if (ret)
+		goto out_free_lat;
+
+	for (i = 0; i < frames && !ret; i++) {
+		start = ktime_get_ns();
+		ret = bench_req_alloc_frame(&b.parent, &allocs);
+		lat[i] = ktime_get_ns() - start;
+	}
+	if (ret)
+		goto out;
+	bench_req_report("separate", lat, allocs);
+
+	/* Two requests in flight, as with one queued and one applied */
+	ret = v4l2_ctrl_req_pool_init(&b.parent, 2, 2);
+	if (ret)
+		goto out;
+	pool_allocs = atomic_long_read(&b.parent.req_pool->allocs);
+
+	for (i = 0; i < frames && !ret; i++) {
+		start = ktime_get_ns();
+		ret = bench_req_pool_frame(&b.parent);
+		lat[i] = ktime_get_ns() - start;
+	}
+	if (!ret)
+		bench_req_report("pooled", lat,
+				 atomic_long_read(&b.parent.req_pool->allocs) -
+				 pool_allocs);
+
+	v4l2_ctrl_req_pool_free(&b.parent);
+out:
+	if (ret)
+		pr_err("req_pool: failed: %d\n", ret);
+	bench_ctrls_free(&b);
+out_free_lat:
+	kvfree(lat);
+	return ret;
+}
+
+static int __init v4l2_ctrls_bench_init(void)
+{
+	if (!nr_ctrls || !ctrls_per_child || !rounds || !duration_ms ||
+	    !frames)
+		return -EINVAL;
+
+	bench_find();
+	bench_lockless();
+	bench_req_pool();
+
+	return 0;
+}
+
+static void __exit v4l2_ctrls_bench_exit(void)
+{
+}
+
+module_init(v4l2_ctrls_bench_init);
+module_exit(v4l2_ctrls_bench_exit);
+
+MODULE_DESCRIPTION("V4L2 controls framework microbenchmarks");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: coalescing control event rings.
+ */
+
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <media/v4l2-ctrls.h>
+
+/* Wake up the readers of @ring, with @ring->lock held */
+static void ev_ring_wake(struct v4l2_ctrl_ev_ring *ring)
+{
+	ring->ready = true;
+	wake_up_all(&ring->wait);
+}
+
+static enum hrtimer_restart ev_ring_timer(struct hrtimer *timer)
+{
+	struct v4l2_ctrl_ev_ring *ring =
+		container_of(timer, struct v4l2_ctrl_ev_ring, timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	if (ring->count && !ring->ready)
+		ev_ring_wake(ring);
+	spin_unlock_irqrestore(&ring->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+int v4l2_ctrl_ev_ring_init(struct v4l2_ctrl_ev_ring *ring, unsigned int depth,
+			   unsigned int batch, unsigned int window_us)
+{
+	if (!depth || depth > SZ_64K)
+		return -EINVAL;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->depth = roundup_pow_of_two(depth);
+	ring->events = kvcalloc(ring->depth, sizeof(*ring->events), GFP_KERNEL);
+	if (!ring->events)
+		return -ENOMEM;
+
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+	hrtimer_init(&ring->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ring->timer.function = ev_ring_timer;
+	ring->batch = clamp(batch, 1U, ring->depth);
+	ring->window_ns = (u64)window_us * NSEC_PER_USEC;
+
+	return 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ev_ring_init);
+
+void v4l2_ctrl_ev_ring_release(struct v4l2_ctrl_ev_ring *ring)
+{
+	hrtimer_cancel(&ring->timer);
+	kvfree(ring->events);
+	ring->events = NULL;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ev_ring_release);
+
+/*
+ * Index of the first queued event after the @from'th one, searching
+ * forwards or backwards, that has the control id @id, or -1 if none
+ */
+static int ev_ring_find(struct v4l2_ctrl_ev_ring *ring, u32 id, int from,
+			int step)
+{
+	unsigned int mask = ring->depth - 1;
+	int i;
+
+	for (i = from + step; i >= 0 && i < (int)ring->count; i += step)
+		if (ring->events[(ring->first + i) & mask].id == id)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Make room in a full ring, with @ring->lock held. Return true if @ev was
+ * merged into a queued event and must not be queued itself.
+ */
+static bool ev_ring_coalesce(struct v4l2_ctrl_ev_ring *ring,
+			     const struct v4l2_event *ev)
+{
+	unsigned int mask = ring->depth - 1;
+	struct v4l2_event *oldest = &ring->events[ring->first];
+	struct v4l2_event merged;
+	u32 sequence;
+	int i;
+
+	/* The newest event of the same control takes the new value */
+	i = ev_ring_find(ring, ev->id, ring->count, -1);
+	if (i >= 0) {
+		struct v4l2_event *slot = &ring->events[(ring->first + i) & mask];
+
+		merged = *ev;
+		v4l2_ctrl_merge(slot, &merged);
+		sequence = slot->sequence;
+		*slot = merged;
+		slot->sequence = sequence;
+		ring->coalesced++;
+		return true;
+	}
+
+	/* Otherwise the oldest event is folded into its next same-id event */
+	i = ev_ring_find(ring, oldest->id, 0, 1);
+	if (i >= 0) {
+		v4l2_ctrl_merge(oldest, &ring->events[(ring->first + i) & mask]);
+		ring->coalesced++;
+	} else {
+		ring->lost++;
+	}
+
+	ring->first = (ring->first + 1) & mask;
+	ring->count--;
+
+	return false;
+}
+
+void v4l2_ctrl_ev_ring_queue(struct v4l2_ctrl_ev_ring *ring,
+			     const struct v4l2_event *ev)
+{
+	unsigned int mask = ring->depth - 1;
+	struct v4l2_event *slot;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ring->lock, flags);
+
+	if (ring->count == ring->depth && ev_ring_coalesce(ring, ev))
+		goto unlock;
+
+	slot = &ring->events[(ring->first + ring->count) & mask];
+	*slot = *ev;
+	slot->sequence = ring->sequence++;
+	ring->count++;
+
+	if (!ring->ready) {
+		if (ring->count >= ring->batch)
+			ev_ring_wake(ring);
+		else if (ring->count == 1 && ring->window_ns)
+			hrtimer_start(&ring->timer, ns_to_ktime(ring->window_ns),
+				      HRTIMER_MODE_REL);
+	}
+
+unlock:
+	spin_unlock_irqrestore(&ring->lock, flags);
+}
+EXPORT_SYMBOL(v4l2_ctrl_ev_ring_queue);
+
+int v4l2_ctrl_ev_ring_dequeue(struct v4l2_ctrl_ev_ring *ring,
+			      struct v4l2_event *evs, unsigned int max,
+			      bool nonblocking)
+{
+	unsigned int mask = ring->depth - 1;
+	unsigned int i, n;
+	int ret;
+
+	spin_lock_irq(&ring->lock);
+
+	while (!ring->ready) {
+		spin_unlock_irq(&ring->lock);
+		if (nonblocking)
+			return -EAGAIN;
+		ret = wait_event_interruptible(ring->wait, READ_ONCE(ring->ready));
+		if (ret)
+			return ret;
+		spin_lock_irq(&ring->lock);
+	}
+
+	n = min(max, ring->count);
+	for (i = 0; i < n; i++) {
+		evs[i] = ring->events[(ring->first + i) & mask];
+		evs[i].pending = ring->count - i - 1;
+	}
+	ring->first = (ring->first + n) & mask;
+	ring->count -= n;
+
+	/* Leftovers stay ready, a new batch starts on an empty ring */
+	if (!ring->count) {
+		ring->ready = false;
+		hrtimer_try_to_cancel(&ring->timer);
+	}
+
+	spin_unlock_irq(&ring->lock);
+
+	return n;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ev_ring_dequeue);
+
+__poll_t v4l2_ctrl_ev_ring_poll(struct v4l2_ctrl_ev_ring *ring,
+				struct file *file,
+				struct poll_table_struct *wait)
+{
+	poll_wait(file, &ring->wait, wait);
+
+	return READ_ONCE(ring->ready) ? EPOLLPRI : 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ev_ring_poll);
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: scalar controls read without the handler lock.
+ *
+ * The current value of such a control is only stored under its cur_seq
+ * write side, with the handler lock held, so readers can copy it out and
+ * retry when they raced with a store.
+ */
+
+#include <media/v4l2-ctrls.h>
+#include <media/v4l2-event.h>
+
+void v4l2_ctrl_cur_changed(struct v4l2_ctrl *ctrl)
+{
+	struct v4l2_subscribed_event *sev;
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_CTRL,
+		.id = ctrl->id,
+		.u.ctrl = {
+			.changes = V4L2_EVENT_CTRL_CH_VALUE,
+			.type = ctrl->type,
+			.flags = ctrl->flags,
+			.minimum = ctrl->minimum,
+			.maximum = ctrl->maximum,
+			.step = ctrl->step,
+			.default_value = ctrl->default_value,
+		},
+	};
+
+	lockdep_assert_held(ctrl->handler->lock);
+
+	if (ctrl->call_notify && ctrl->handler->notify)
+		ctrl->handler->notify(ctrl, ctrl->handler->notify_priv);
+
+	if (list_empty(&ctrl->ev_subs))
+		return;
+
+	if (ctrl->is_ptr)
+		ev.u.ctrl.flags |= V4L2_CTRL_FLAG_HAS_PAYLOAD;
+	else if (ctrl->type == V4L2_CTRL_TYPE_INTEGER64)
+		ev.u.ctrl.value64 = *ctrl->p_cur.p_s64;
+	else
+		ev.u.ctrl.value = *ctrl->p_cur.p_s32;
+
+	list_for_each_entry(sev, &ctrl->ev_subs, node)
+		v4l2_event_queue_fh(sev->fh, &ev);
+}
+EXPORT_SYMBOL(v4l2_ctrl_cur_changed);
+
+int v4l2_ctrl_enable_lockless(struct v4l2_ctrl *ctrl)
+{
+	if (ctrl->is_ptr || ctrl->type == V4L2_CTRL_TYPE_BUTTON ||
+	    ctrl->type == V4L2_CTRL_TYPE_CTRL_CLASS ||
+	    !(ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY) ||
+	    (ctrl->flags & V4L2_CTRL_FLAG_VOLATILE) ||
+	    ctrl->cluster[0] != ctrl || ctrl->ncontrols != 1)
+		return -EINVAL;
+
+	v4l2_ctrl_lock(ctrl);
+	if (!ctrl->has_lockless) {
+		seqcount_mutex_init(&ctrl->cur_seq, ctrl->handler->lock);
+		ctrl->has_lockless = 1;
+	}
+	v4l2_ctrl_unlock(ctrl);
+
+	return 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_enable_lockless);
+
+int __v4l2_ctrl_s_ctrl_seq(struct v4l2_ctrl *ctrl, s64 val)
+{
+	bool is_int64 = ctrl->type == V4L2_CTRL_TYPE_INTEGER64;
+	int ret;
+
+	lockdep_assert_held(ctrl->handler->lock);
+
+	if (!ctrl->has_lockless)
+		return -EINVAL;
+
+	if (is_int64)
+		*ctrl->p_new.p_s64 = val;
+	else
+		*ctrl->p_new.p_s32 = val;
+
+	ret = ctrl->type_ops->validate(ctrl, 0, ctrl->p_new);
+	if (ret)
+		return ret;
+
+	ctrl->is_new = 1;
+	if (ctrl->ops && ctrl->ops->try_ctrl)
+		ret = ctrl->ops->try_ctrl(ctrl);
+	if (!ret && ctrl->ops && ctrl->ops->s_ctrl)
+		ret = ctrl->ops->s_ctrl(ctrl);
+	ctrl->is_new = 0;
+	if (ret)
+		return ret;
+
+	v4l2_ctrl_cur_write_begin(ctrl);
+	if (is_int64)
+		*ctrl->p_cur.p_s64 = *ctrl->p_new.p_s64;
+	else
+		*ctrl->p_cur.p_s32 = *ctrl->p_new.p_s32;
+	v4l2_ctrl_cur_write_end(ctrl);
+
+	v4l2_ctrl_cur_changed(ctrl);
+
+	return 0;
+}
+EXPORT_SYMBOL(__v4l2_ctrl_s_ctrl_seq);
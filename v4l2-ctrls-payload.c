@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: refcounted copy-on-write compound payloads.
+ *
+ * The current value of a control with a payload and the values of the
+ * requests that have not modified it all point to the same payload. The
+ * first writer copies it, every other user keeps reading the old one.
+ */
+
+#include <linux/mm.h>
+#include <linux/overflow.h>
+#include <linux/slab.h>
+#include <media/v4l2-ctrls.h>
+
+struct v4l2_ctrl_payload *v4l2_ctrl_payload_alloc(size_t size)
+{
+	struct v4l2_ctrl_payload *payload;
+
+	payload = kvmalloc(struct_size(payload, data, size), GFP_KERNEL);
+	if (!payload)
+		return NULL;
+
+	refcount_set(&payload->ref, 1);
+	payload->size = size;
+
+	return payload;
+}
+EXPORT_SYMBOL(v4l2_ctrl_payload_alloc);
+
+void v4l2_ctrl_payload_put(struct v4l2_ctrl_payload *payload)
+{
+	if (payload && refcount_dec_and_test(&payload->ref))
+		kvfree(payload);
+}
+EXPORT_SYMBOL(v4l2_ctrl_payload_put);
+
+void *v4l2_ctrl_payload_make_writable(struct v4l2_ctrl_payload **pp)
+{
+	struct v4l2_ctrl_payload *old = *pp, *new;
+
+	if (refcount_read(&old->ref) == 1)
+		return old->data;
+
+	new = v4l2_ctrl_payload_alloc(old->size);
+	if (!new)
+		return NULL;
+
+	memcpy(new->data, old->data, old->size);
+	*pp = new;
+	v4l2_ctrl_payload_put(old);
+
+	return new->data;
+}
+EXPORT_SYMBOL(v4l2_ctrl_payload_make_writable);
+
+int v4l2_ctrl_enable_payload(struct v4l2_ctrl *ctrl)
+{
+	struct v4l2_ctrl_payload *payload;
+	size_t size;
+
+	if (!ctrl->is_ptr || ctrl->is_string)
+		return -EINVAL;
+	if (ctrl->has_payload)
+		return 0;
+
+	size = array_size(ctrl->elems, ctrl->elem_size);
+	payload = v4l2_ctrl_payload_alloc(size);
+	if (!payload)
+		return -ENOMEM;
+
+	v4l2_ctrl_lock(ctrl);
+	memcpy(payload->data, ctrl->p_cur.p, size);
+	ctrl->cur_payload = payload;
+	ctrl->p_cur.p = payload->data;
+	ctrl->has_payload = 1;
+	v4l2_ctrl_unlock(ctrl);
+
+	return 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_enable_payload);
+
+void *v4l2_ctrl_cur_writable(struct v4l2_ctrl *ctrl)
+{
+	void *p;
+
+	lockdep_assert_held(ctrl->handler->lock);
+
+	if (!ctrl->has_payload)
+		return ctrl->p_cur.p;
+
+	p = v4l2_ctrl_payload_make_writable(&ctrl->cur_payload);
+	if (p)
+		ctrl->p_cur.p = p;
+
+	return p;
+}
+EXPORT_SYMBOL(v4l2_ctrl_cur_writable);
+
+int __v4l2_ctrl_s_ctrl_payload(struct v4l2_ctrl *ctrl,
+			       struct v4l2_ctrl_payload *payload)
+{
+	union v4l2_ctrl_ptr ptr = { .p = payload->data };
+	union v4l2_ctrl_ptr p_new = ctrl->p_new;
+	struct v4l2_ctrl_payload *old;
+	u32 idx;
+	int ret = 0;
+
+	lockdep_assert_held(ctrl->handler->lock);
+
+	if (!ctrl->has_payload || ctrl->cluster[0] != ctrl ||
+	    ctrl->ncontrols != 1 ||
+	    payload->size != array_size(ctrl->elems, ctrl->elem_size))
+		return -EINVAL;
+	if (ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY)
+		return -EACCES;
+	if (ctrl->flags & V4L2_CTRL_FLAG_GRABBED)
+		return -EBUSY;
+	if (ctrl->cur_payload == payload)
+		return 0;
+
+	for (idx = 0; idx < ctrl->elems && !ret; idx++)
+		ret = ctrl->type_ops->validate(ctrl, idx, ptr);
+	if (ret)
+		return ret;
+
+	/* The driver ops read the new value from @payload, nothing is copied */
+	ctrl->p_new = ptr;
+	ctrl->is_new = 1;
+	if (ctrl->ops && ctrl->ops->try_ctrl)
+		ret = ctrl->ops->try_ctrl(ctrl);
+	if (!ret && ctrl->ops && ctrl->ops->s_ctrl)
+		ret = ctrl->ops->s_ctrl(ctrl);
+	ctrl->is_new = 0;
+	ctrl->p_new = p_new;
+	if (ret)
+		return ret;
+
+	/*
+	 * Requests still hold their own reference to the old payload, so it
+	 * is replaced rather than written to.
+	 */
+	old = ctrl->cur_payload;
+	v4l2_ctrl_cur_write_begin(ctrl);
+	ctrl->cur_payload = v4l2_ctrl_payload_get(payload);
+	ctrl->p_cur.p = payload->data;
+	v4l2_ctrl_cur_write_end(ctrl);
+	v4l2_ctrl_payload_put(old);
+
+	v4l2_ctrl_cur_changed(ctrl);
+
+	return 0;
+}
+EXPORT_SYMBOL(__v4l2_ctrl_s_ctrl_payload);
+
+void v4l2_ctrl_ref_share_payload(struct v4l2_ctrl_ref *ref)
+{
+	struct v4l2_ctrl *ctrl = ref->ctrl;
+
+	lockdep_assert_held(ctrl->handler->lock);
+
+	if (!ctrl->has_payload)
+		return;
+
+	v4l2_ctrl_payload_put(ref->req_payload);
+	ref->req_payload = v4l2_ctrl_payload_get(ctrl->cur_payload);
+	ref->p_req.p = ref->req_payload->data;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ref_share_payload);
+
+void *v4l2_ctrl_ref_writable(struct v4l2_ctrl_ref *ref)
+{
+	void *p;
+
+	if (!ref->req_payload)
+		return ref->p_req.p;
+
+	p = v4l2_ctrl_payload_make_writable(&ref->req_payload);
+	if (p)
+		ref->p_req.p = p;
+
+	return p;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ref_writable);
+
+void v4l2_ctrl_ref_release_payload(struct v4l2_ctrl_ref *ref)
+{
+	if (!ref->req_payload)
+		return;
+
+	v4l2_ctrl_payload_put(ref->req_payload);
+	ref->req_payload = NULL;
+	ref->p_req.p = NULL;
+}
+EXPORT_SYMBOL(v4l2_ctrl_ref_release_payload);
+
+void v4l2_ctrl_handler_release_payloads(struct v4l2_ctrl_handler *hdl)
+{
+	struct v4l2_ctrl *ctrl;
+
+	if (!hdl || !hdl->lock)
+		return;
+
+	mutex_lock(hdl->lock);
+	list_for_each_entry(ctrl, &hdl->ctrls, node) {
+		if (!ctrl->has_payload)
+			continue;
+
+		v4l2_ctrl_payload_put(ctrl->cur_payload);
+		ctrl->cur_payload = NULL;
+		ctrl->p_cur.p = NULL;
+		ctrl->has_payload = 0;
+	}
+	mutex_unlock(hdl->lock);
+}
+EXPORT_SYMBOL(v4l2_ctrl_handler_release_payloads);
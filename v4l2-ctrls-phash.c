@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: collision-free control lookup.
+ *
+ * A finalized handler resolves a control ID with the "compress, hash and
+ * displace" scheme: the ID selects a group through hash_32(), the group
+ * stores a displacement, and jhash_1word() of the ID seeded with that
+ * displacement selects a slot that no other control of the handler uses.
+ * The table is built once, largest groups first, after the handler has
+ * been fully populated.
+ */
+
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <media/v4l2-ctrls.h>
+
+/* Average number of controls per displacement group */
+#define PHASH_GROUP_LOAD	4
+/* Number of times the slot table is doubled before giving up */
+#define PHASH_MAX_GROWS		3
+
+struct phash_group {
+	u32 first;
+	u32 count;
+};
+
+static int phash_group_cmp(const void *a, const void *b)
+{
+	const struct phash_group *ga = a, *gb = b;
+
+	return (int)gb->count - (int)ga->count;
+}
+
+/*
+ * Place the controls of every group, largest group first, into the
+ * empty slots of @table. @keys holds the controls sorted by group.
+ */
+static int phash_place(struct v4l2_ctrl_ref **keys,
+		       struct phash_group *groups, u32 nr_groups,
+		       u32 disp_bits, struct v4l2_ctrl_ref **table,
+		       u32 mask, u16 *disp, u32 *slots)
+{
+	u32 g, i, j;
+
+	for (g = 0; g < nr_groups && groups[g].count; g++) {
+		struct v4l2_ctrl_ref **k = keys + groups[g].first;
+		u32 n = groups[g].count;
+		u32 d;
+
+		for (d = 0; d <= U16_MAX; d++) {
+			for (i = 0; i < n; i++) {
+				slots[i] = jhash_1word(k[i]->ctrl->id, d) & mask;
+				if (table[slots[i]])
+					break;
+				for (j = 0; j < i; j++)
+					if (slots[j] == slots[i])
+						break;
+				if (j < i)
+					break;
+			}
+			if (i == n)
+				break;
+		}
+		if (d > U16_MAX)
+			return -EAGAIN;
+
+		for (i = 0; i < n; i++)
+			table[slots[i]] = k[i];
+		disp[hash_32(k[0]->ctrl->id, disp_bits)] = d;
+	}
+
+	return 0;
+}
+
+/**
+ * phash_build() - Build the lookup table for the references of @hdl
+ * @hdl: The control handler, its lock must be held.
+ * @n: Number of references in @hdl->ctrl_refs.
+ * @ptable: Returns the slot table.
+ * @pdisp: Returns the displacement table.
+ * @pmask: Returns the slot mask.
+ * @pdisp_bits: Returns log2 of the number of displacement groups.
+ *
+ * Return: 0 on success, -ENOMEM or -E2BIG if no collision-free placement
+ * was found.
+ */
+static int phash_build(struct v4l2_ctrl_handler *hdl, u32 n,
+		       struct v4l2_ctrl_ref ***ptable, u16 **pdisp,
+		       u32 *pmask, u32 *pdisp_bits)
+{
+	struct v4l2_ctrl_ref **keys = NULL, **table = NULL;
+	struct phash_group *groups = NULL;
+	struct v4l2_ctrl_ref *ref;
+	u32 nr_groups, disp_bits, nr_slots, max_count = 0;
+	u32 *slots = NULL;
+	u16 *disp = NULL;
+	int ret = -ENOMEM;
+	u32 i, grow;
+
+	nr_groups = roundup_pow_of_two(max_t(u32, DIV_ROUND_UP(n, PHASH_GROUP_LOAD), 2));
+	disp_bits = ilog2(nr_groups);
+
+	keys = kvmalloc_array(n, sizeof(*keys), GFP_KERNEL);
+	groups = kvcalloc(nr_groups, sizeof(*groups), GFP_KERNEL);
+	disp = kvcalloc(nr_groups, sizeof(*disp), GFP_KERNEL);
+	if (!keys || !groups || !disp)
+		goto out;
+
+	/* Counting sort of the references by group */
+	list_for_each_entry(ref, &hdl->ctrl_refs, node)
+		groups[hash_32(ref->ctrl->id, disp_bits)].count++;
+	for (i = 0; i < nr_groups; i++) {
+		if (i)
+			groups[i].first = groups[i - 1].first + groups[i - 1].count;
+		max_count = max(max_count, groups[i].count);
+	}
+	list_for_each_entry(ref, &hdl->ctrl_refs, node) {
+		struct phash_group *g = &groups[hash_32(ref->ctrl->id, disp_bits)];
+
+		keys[g->first++] = ref;
+	}
+	for (i = 0; i < nr_groups; i++)
+		groups[i].first -= groups[i].count;
+	sort(groups, nr_groups, sizeof(*groups), phash_group_cmp, NULL);
+
+	slots = kmalloc_array(max_count, sizeof(*slots), GFP_KERNEL);
+	if (!slots)
+		goto out;
+
+	nr_slots = roundup_pow_of_two(n) * 2;
+	for (grow = 0; grow <= PHASH_MAX_GROWS; grow++, nr_slots *= 2) {
+		table = kvcalloc(nr_slots, sizeof(*table), GFP_KERNEL);
+		if (!table) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = phash_place(keys, groups, nr_groups, disp_bits, table,
+				  nr_slots - 1, disp, slots);
+		if (!ret)
+			break;
+		kvfree(table);
+		table = NULL;
+		memset(disp, 0, nr_groups * sizeof(*disp));
+	}
+	if (ret) {
+		ret = -E2BIG;
+		goto out;
+	}
+
+	*ptable = table;
+	*pdisp = disp;
+	*pmask = nr_slots - 1;
+	*pdisp_bits = disp_bits;
+	disp = NULL;
+
+out:
+	kfree(slots);
+	kvfree(disp);
+	kvfree(groups);
+	kvfree(keys);
+	return ret;
+}
+
+int v4l2_ctrl_handler_finalize(struct v4l2_ctrl_handler *hdl)
+{
+	struct v4l2_ctrl_ref **table;
+	struct v4l2_ctrl_ref *ref;
+	u32 mask, disp_bits;
+	u16 *disp;
+	u32 n = 0;
+	int ret;
+
+	if (!hdl)
+		return -EINVAL;
+
+	mutex_lock(hdl->lock);
+	if (hdl->error) {
+		ret = hdl->error;
+		goto unlock;
+	}
+
+	list_for_each_entry(ref, &hdl->ctrl_refs, node)
+		n++;
+
+	v4l2_ctrl_handler_unfinalize(hdl);
+	if (!n) {
+		ret = 0;
+		goto unlock;
+	}
+
+	ret = phash_build(hdl, n, &table, &disp, &mask, &disp_bits);
+	if (ret)
+		goto unlock;
+
+	hdl->phash = table;
+	hdl->phash_disp = disp;
+	hdl->phash_mask = mask;
+	hdl->phash_disp_bits = disp_bits;
+
+unlock:
+	mutex_unlock(hdl->lock);
+	return ret;
+}
+EXPORT_SYMBOL(v4l2_ctrl_handler_finalize);
+
+void v4l2_ctrl_handler_unfinalize(struct v4l2_ctrl_handler *hdl)
+{
+	lockdep_assert_held(hdl->lock);
+
+	kvfree(hdl->phash);
+	kvfree(hdl->phash_disp);
+	hdl->phash = NULL;
+	hdl->phash_disp = NULL;
+	hdl->phash_mask = 0;
+	hdl->phash_disp_bits = 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_handler_unfinalize);
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * V4L2 controls framework: pooled request objects.
+ *
+ * Every pooled object holds, in one allocation, the request handler, one
+ * control reference per control of the parent, the bucket array and the
+ * request value of every control:
+ *
+ *	struct v4l2_ctrl_req_obj | refs[nr_refs] | buckets | values
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <media/v4l2-ctrls.h>
+
+struct v4l2_ctrl_req_obj {
+	struct list_head node;
+	struct v4l2_ctrl_req_pool *pool;
+	struct v4l2_ctrl_handler hdl;
+};
+
+static struct v4l2_ctrl_req_obj *req_obj_alloc(struct v4l2_ctrl_req_pool *pool)
+{
+	struct v4l2_ctrl_req_obj *obj;
+
+	obj = kvzalloc(pool->obj_size, GFP_KERNEL);
+	if (!obj)
+		return NULL;
+
+	obj->pool = pool;
+	atomic_long_inc(&pool->allocs);
+	return obj;
+}
+
+int v4l2_ctrl_req_pool_init(struct v4l2_ctrl_handler *hdl,
+			    unsigned int prealloc, unsigned int max_free)
+{
+	struct v4l2_ctrl_req_pool *pool;
+	struct v4l2_ctrl_ref *ref;
+	unsigned int i = 0;
+	size_t off;
+
+	if (!hdl || hdl->req_pool)
+		return -EINVAL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return -ENOMEM;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free);
+	pool->max_free = max(prealloc, max_free);
+	atomic_long_set(&pool->allocs, 0);
+	atomic_long_set(&pool->recycles, 0);
+
+	mutex_lock(hdl->lock);
+	list_for_each_entry(ref, &hdl->ctrl_refs, node)
+		pool->nr_refs++;
+
+	pool->data_offs = kcalloc(pool->nr_refs, sizeof(*pool->data_offs),
+				  GFP_KERNEL);
+	if (pool->nr_refs && !pool->data_offs) {
+		mutex_unlock(hdl->lock);
+		kfree(pool);
+		return -ENOMEM;
+	}
+
+	pool->nr_of_buckets = hdl->nr_of_buckets;
+	pool->refs_off = ALIGN(sizeof(struct v4l2_ctrl_req_obj),
+			       __alignof__(struct v4l2_ctrl_ref));
+	pool->buckets_off = ALIGN(pool->refs_off +
+				  pool->nr_refs * sizeof(struct v4l2_ctrl_ref),
+				  sizeof(void *));
+	pool->data_off = ALIGN(pool->buckets_off +
+			       pool->nr_of_buckets * sizeof(*hdl->buckets),
+			       sizeof(u64));
+
+	off = pool->data_off;
+	list_for_each_entry(ref, &hdl->ctrl_refs, node) {
+		pool->data_offs[i++] = off;
+		off += ALIGN(ref->ctrl->elems * ref->ctrl->elem_size,
+			     sizeof(u64));
+	}
+	pool->obj_size = off;
+	mutex_unlock(hdl->lock);
+
+	for (i = 0; i < prealloc; i++) {
+		struct v4l2_ctrl_req_obj *obj = req_obj_alloc(pool);
+
+		if (!obj)
+			break;
+		list_add(&obj->node, &pool->free);
+		pool->nr_free++;
+	}
+
+	mutex_lock(hdl->lock);
+	hdl->req_pool = pool;
+	mutex_unlock(hdl->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(v4l2_ctrl_req_pool_init);
+
+void v4l2_ctrl_req_pool_free(struct v4l2_ctrl_handler *hdl)
+{
+	struct v4l2_ctrl_req_pool *pool;
+	struct v4l2_ctrl_req_obj *obj, *next;
+
+	if (!hdl || !hdl->req_pool)
+		return;
+
+	mutex_lock(hdl->lock);
+	pool = hdl->req_pool;
+	hdl->req_pool = NULL;
+	mutex_unlock(hdl->lock);
+
+	list_for_each_entry_safe(obj, next, &pool->free, node)
+		kvfree(obj);
+	kfree(pool->data_offs);
+	kfree(pool);
+}
+EXPORT_SYMBOL(v4l2_ctrl_req_pool_free);
+
+struct v4l2_ctrl_handler *
+v4l2_ctrl_req_pool_get(struct v4l2_ctrl_handler *parent)
+{
+	struct v4l2_ctrl_req_pool *pool = parent->req_pool;
+	struct v4l2_ctrl_req_obj *obj;
+
+	if (!pool)
+		return NULL;
+
+	spin_lock(&pool->lock);
+	obj = list_first_entry_or_null(&pool->free, struct v4l2_ctrl_req_obj,
+				       node);
+	if (obj) {
+		list_del(&obj->node);
+		pool->nr_free--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (obj) {
+		/* The values are only read once valid_p_req is set */
+		memset(&obj->hdl, 0,
+		       pool->data_off - offsetof(struct v4l2_ctrl_req_obj, hdl));
+		atomic_long_inc(&pool->recycles);
+	} else {
+		obj = req_obj_alloc(pool);
+		if (!obj)
+			return NULL;
+	}
+
+	obj->hdl.buckets = (void *)obj + pool->buckets_off;
+	obj->hdl.nr_of_buckets = pool->nr_of_buckets;
+
+	return &obj->hdl;
+}
+EXPORT_SYMBOL(v4l2_ctrl_req_pool_get);
+
+struct v4l2_ctrl_ref *v4l2_ctrl_req_pool_ref(struct v4l2_ctrl_handler *hdl,
+					     unsigned int idx)
+{
+	struct v4l2_ctrl_req_obj *obj =
+		container_of(hdl, struct v4l2_ctrl_req_obj, hdl);
+	struct v4l2_ctrl_req_pool *pool = obj->pool;
+	struct v4l2_ctrl_ref *ref;
+
+	if (idx >= pool->nr_refs)
+		return NULL;
+
+	ref = (struct v4l2_ctrl_ref *)((void *)obj + pool->refs_off) + idx;
+	ref->p_req.p = (void *)obj + pool->data_offs[idx];
+
+	return ref;
+}
+EXPORT_SYMBOL(v4l2_ctrl_req_pool_ref);
+
+void v4l2_ctrl_req_pool_put(struct v4l2_ctrl_handler *hdl)
+{
+	struct v4l2_ctrl_req_obj *obj =
+		container_of(hdl, struct v4l2_ctrl_req_obj, hdl);
+	struct v4l2_ctrl_req_pool *pool = obj->pool;
+
+	spin_lock(&pool->lock);
+	if (pool->nr_free < pool->max_free) {
+		list_add(&obj->node, &pool->free);
+		pool->nr_free++;
+		obj = NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	kvfree(obj);
+}
+EXPORT_SYMBOL(v4l2_ctrl_req_pool_put);
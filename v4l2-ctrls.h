@@ -8,9 +8,16 @@
 #ifndef _V4L2_CTRLS_H
 #define _V4L2_CTRLS_H
 
+#include <linux/hash.h>
+#include <linux/hrtimer.h>
+#include <linux/jhash.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/refcount.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <linux/videodev2.h>
+#include <linux/wait.h>
 #include <media/media-request.h>
 
 /*
@@ -25,6 +32,7 @@ struct poll_table_struct;
 struct v4l2_ctrl;
 struct v4l2_ctrl_handler;
 struct v4l2_ctrl_helper;
+struct v4l2_ctrl_req_pool;
 struct v4l2_fh;
 struct v4l2_fwnode_device_properties;
 struct v4l2_subdev;
@@ -116,11 +124,23 @@ static inline union v4l2_ctrl_ptr v4l2_ctrl_ptr_create(void *ptr)
  * @s_ctrl:	Actually set the new control value. s_ctrl is compulsory. The
  *		ctrl->handler->lock is held when these ops are called, so no
  *		one else can access controls owned by that handler.
+ * @batch_begin: Optional. Called once per handler before the first @s_ctrl
+ *		of a VIDIOC_S_EXT_CTRLS call or of a request being applied,
+ *		so that the driver can start collecting the hardware writes
+ *		(e.g. open a sensor group hold). @hdl is the handler owning
+ *		the controls, its lock is held. If this returns an error no
+ *		@s_ctrl is called and @batch_end is not called either.
+ * @batch_end:	Optional, but required if @batch_begin is set. Called once
+ *		per handler after the last @s_ctrl of the same call, with
+ *		the first error returned by @s_ctrl or 0, so that the driver
+ *		can commit the collected writes in one transaction.
  */
 struct v4l2_ctrl_ops {
 	int (*g_volatile_ctrl)(struct v4l2_ctrl *ctrl);
 	int (*try_ctrl)(struct v4l2_ctrl *ctrl);
 	int (*s_ctrl)(struct v4l2_ctrl *ctrl);
+	int (*batch_begin)(struct v4l2_ctrl_handler *hdl);
+	void (*batch_end)(struct v4l2_ctrl_handler *hdl, int error);
 };
 
 /**
@@ -156,6 +176,21 @@ struct v4l2_ctrl_type_ops {
  */
 typedef void (*v4l2_ctrl_notify_fnc)(struct v4l2_ctrl *ctrl, void *priv);
 
+/**
+ * struct v4l2_ctrl_payload - Refcounted value of a compound control.
+ *
+ * @ref:	Reference count. The payload is shared between the current
+ *		value and requests, and must not be modified, while the count
+ *		is above one.
+ * @size:	Size of @data in bytes.
+ * @data:	The control value.
+ */
+struct v4l2_ctrl_payload {
+	refcount_t ref;
+	size_t size;
+	u8 data[] __aligned(8);
+};
+
 /**
  * struct v4l2_ctrl - The control structure.
  *
@@ -189,6 +224,14 @@ typedef void (*v4l2_ctrl_notify_fnc)(struct v4l2_ctrl *ctrl, void *priv);
  *		Drivers should never touch this flag.
  * @call_notify: If set, then call the handler's notify function whenever the
  *		control's value changes.
+ * @has_payload: If set, then @p_cur points into @cur_payload, which requests
+ *		share until one side is modified. Set by
+ *		v4l2_ctrl_enable_payload(), drivers should never set this flag
+ *		directly.
+ * @has_lockless: If set, then @cur_seq is initialized and every update of
+ *		the current value goes through its write side. Set by
+ *		v4l2_ctrl_enable_lockless(), drivers should never set this
+ *		flag directly.
  * @manual_mode_value: If the is_auto flag is set, then this is the value
  *		of the auto control that determines if that control is in
  *		manual mode. So if the value of the auto control equals this
@@ -226,6 +269,12 @@ typedef void (*v4l2_ctrl_notify_fnc)(struct v4l2_ctrl *ctrl, void *priv);
  * @cur:	Structure to store the current value.
  * @cur.val:	The control's current value, if the @type is represented via
  *		a u32 integer (see &enum v4l2_ctrl_type).
+ * @cur_seq:	Sequence counter bumped around every update of the current
+ *		value, associated with the handler lock. Initialized by
+ *		v4l2_ctrl_enable_lockless(), and lets
+ *		v4l2_ctrl_g_ctrl_lockless() and
+ *		v4l2_ctrl_g_ctrl_int64_lockless() read the control without
+ *		taking the handler lock once @has_lockless is set.
  * @val:	The control's new s32 value.
  * @priv:	The control's private pointer. For use by the driver. It is
  *		untouched by the control framework. Note that this pointer is
@@ -241,6 +290,8 @@ typedef void (*v4l2_ctrl_notify_fnc)(struct v4l2_ctrl *ctrl, void *priv);
  * @p_new:	The control's new value represented via a union which provides
  *		a standard way of accessing control types
  *		through a pointer.
+ * @cur_payload: The refcounted storage of the current value if @has_payload
+ *		is set, NULL otherwise.
  */
 struct v4l2_ctrl {
 	/* Administrative fields */
@@ -262,6 +313,8 @@ struct v4l2_ctrl {
 	unsigned int is_array:1;
 	unsigned int has_volatiles:1;
 	unsigned int call_notify:1;
+	unsigned int has_payload:1;
+	unsigned int has_lockless:1;
 	unsigned int manual_mode_value:8;
 
 	const struct v4l2_ctrl_ops *ops;
@@ -288,10 +341,12 @@ struct v4l2_ctrl {
 	struct {
 		s32 val;
 	} cur;
+	seqcount_mutex_t cur_seq;
 
 	union v4l2_ctrl_ptr p_def;
 	union v4l2_ctrl_ptr p_new;
 	union v4l2_ctrl_ptr p_cur;
+	struct v4l2_ctrl_payload *cur_payload;
 };
 
 /**
@@ -317,6 +372,9 @@ struct v4l2_ctrl {
  *		that the request was completed. If @valid_p_req is false,
  *		then this control was never set for this request and the
  *		control will not be updated when this request is applied.
+ * @req_payload: If the control has a payload, the refcounted storage @p_req
+ *		points into, shared with the current value or other requests
+ *		until modified.
  *
  * Each control handler has a list of these refs. The list_head is used to
  * keep a sorted-by-control-ID list of all controls, while the next pointer
@@ -331,6 +389,7 @@ struct v4l2_ctrl_ref {
 	bool req_done;
 	bool valid_p_req;
 	union v4l2_ctrl_ptr p_req;
+	struct v4l2_ctrl_payload *req_payload;
 };
 
 /**
@@ -353,6 +412,13 @@ struct v4l2_ctrl_ref {
  *		is called!
  * @notify_priv: Passed as argument to the v4l2_ctrl notify callback.
  * @nr_of_buckets: Total number of buckets in the array.
+ * @phash:	Collision-free lookup table built by
+ *		v4l2_ctrl_handler_finalize(), NULL if the handler is not
+ *		finalized. Only v4l2_ctrl_phash_find() uses it, other
+ *		lookups keep going through @buckets.
+ * @phash_disp: Per-group displacements of @phash.
+ * @phash_mask: Number of slots in @phash minus one.
+ * @phash_disp_bits: log2 of the number of entries in @phash_disp.
  * @error:	The error code of the first failed control addition.
  * @request_is_queued: True if the request was queued.
  * @requests:	List to keep track of open control handler request objects.
@@ -365,6 +431,8 @@ struct v4l2_ctrl_ref {
  *		completed it is removed from this list.
  * @req_obj:	The &struct media_request_object, used to link into a
  *		&struct media_request. This request object has a refcount.
+ * @req_pool:	Pool of pre-sized request objects for this parent handler,
+ *		NULL if v4l2_ctrl_req_pool_init() was not called.
  */
 struct v4l2_ctrl_handler {
 	struct mutex _lock;
@@ -376,11 +444,59 @@ struct v4l2_ctrl_handler {
 	v4l2_ctrl_notify_fnc notify;
 	void *notify_priv;
 	u16 nr_of_buckets;
+	struct v4l2_ctrl_ref **phash;
+	u16 *phash_disp;
+	u32 phash_mask;
+	u32 phash_disp_bits;
 	int error;
 	bool request_is_queued;
 	struct list_head requests;
 	struct list_head requests_queued;
 	struct media_request_object req_obj;
+	struct v4l2_ctrl_req_pool *req_pool;
+};
+
+/**
+ * struct v4l2_ctrl_req_pool - Pool of recycled request control handlers.
+ *
+ * @lock:	Protects @free and @nr_free.
+ * @free:	List of idle request objects.
+ * @nr_free:	Number of objects on @free.
+ * @max_free:	Number of idle objects kept, released objects beyond that
+ *		are freed.
+ * @nr_refs:	Number of control references of the parent handler when the
+ *		pool was created. Every object has room for that many.
+ * @nr_of_buckets: Number of lookup buckets of every object.
+ * @refs_off:	Offset of the &struct v4l2_ctrl_ref array in an object.
+ * @buckets_off: Offset of the bucket array in an object.
+ * @data_off:	Offset of the request value storage in an object. Everything
+ *		before it is cleared when an object is recycled.
+ * @obj_size:	Size of one object.
+ * @data_offs:	Offset in an object of the value storage of each reference.
+ * @allocs:	Number of objects allocated since the pool was created.
+ * @recycles:	Number of requests served from @free.
+ *
+ * A request bound to a parent handler needs a handler of its own, one
+ * reference per control and a copy of every control value. The pool carves
+ * all of that out of one allocation, sized from the parent, and recycles
+ * it when the request is released, so that per-frame requests do not hit
+ * the allocator. Comparing @allocs and @recycles with the number of frames
+ * gives the allocations per frame.
+ */
+struct v4l2_ctrl_req_pool {
+	spinlock_t lock;
+	struct list_head free;
+	unsigned int nr_free;
+	unsigned int max_free;
+	unsigned int nr_refs;
+	u16 nr_of_buckets;
+	size_t refs_off;
+	size_t buckets_off;
+	size_t data_off;
+	size_t obj_size;
+	size_t *data_offs;
+	atomic_long_t allocs;
+	atomic_long_t recycles;
 };
 
 /**
@@ -535,6 +651,61 @@ int v4l2_ctrl_handler_init_class(struct v4l2_ctrl_handler *hdl,
  */
 void v4l2_ctrl_handler_free(struct v4l2_ctrl_handler *hdl);
 
+/**
+ * v4l2_ctrl_handler_finalize() - Build a collision-free control lookup table
+ * @hdl:	The control handler.
+ *
+ * Once all controls and inherited handlers have been added to @hdl, this
+ * builds a perfect hash over the control IDs so that every lookup costs
+ * one displacement load and one table load, no matter how many controls
+ * were aggregated through v4l2_ctrl_add_handler(). The table is only
+ * consulted by v4l2_ctrl_phash_find(); v4l2_ctrl_find() and the ioctl
+ * paths keep using the buckets.
+ *
+ * The table is not updated when controls are added, so the handler must be
+ * complete. Call v4l2_ctrl_handler_unfinalize() before adding controls to
+ * @hdl or freeing it with v4l2_ctrl_handler_free(), which does not know
+ * about the table.
+ *
+ * Return: 0 on success, a negative error code if the table could not be
+ * built. The handler keeps working with the buckets in that case.
+ */
+int v4l2_ctrl_handler_finalize(struct v4l2_ctrl_handler *hdl);
+
+/**
+ * v4l2_ctrl_handler_unfinalize() - Drop the table built by
+ *	v4l2_ctrl_handler_finalize().
+ * @hdl:	The control handler.
+ *
+ * Must be called with the handler lock held before a control reference is
+ * added to a finalized @hdl, and before a finalized @hdl is freed. Does
+ * nothing if @hdl is not finalized.
+ */
+void v4l2_ctrl_handler_unfinalize(struct v4l2_ctrl_handler *hdl);
+
+/**
+ * v4l2_ctrl_phash_find() - Look up a control reference in the table built by
+ *	v4l2_ctrl_handler_finalize().
+ * @hdl:	The finalized control handler, @hdl->phash must be set.
+ * @id:	The control ID to find.
+ *
+ * The handler lock must be held.
+ *
+ * Return: the control reference or NULL if @hdl has no control @id.
+ */
+static inline struct v4l2_ctrl_ref *
+v4l2_ctrl_phash_find(struct v4l2_ctrl_handler *hdl, u32 id)
+{
+	struct v4l2_ctrl_ref *ref;
+	u16 disp;
+
+	id &= V4L2_CTRL_ID_MASK;
+	disp = hdl->phash_disp[hash_32(id, hdl->phash_disp_bits)];
+	ref = hdl->phash[jhash_1word(id, disp) & hdl->phash_mask];
+
+	return ref && ref->ctrl->id == id ? ref : NULL;
+}
+
 /**
  * v4l2_ctrl_lock() - Helper function to lock the handler
  * associated with the control.
@@ -998,6 +1169,131 @@ const s64 *v4l2_ctrl_get_int_menu(u32 id, u32 *len);
  */
 s32 v4l2_ctrl_g_ctrl(struct v4l2_ctrl *ctrl);
 
+/**
+ * v4l2_ctrl_cur_write_begin() - Start updating the current value of a control.
+ *
+ * @ctrl:	The control.
+ *
+ * Used around every store to @ctrl->p_cur, so that lockless readers retry
+ * instead of seeing a torn value. Does nothing unless @ctrl->has_lockless
+ * is set. The control's handler must be locked.
+ */
+static inline void v4l2_ctrl_cur_write_begin(struct v4l2_ctrl *ctrl)
+{
+	if (ctrl->has_lockless)
+		write_seqcount_begin(&ctrl->cur_seq);
+}
+
+/**
+ * v4l2_ctrl_cur_write_end() - Finish updating the current value of a control.
+ *
+ * @ctrl:	The control.
+ */
+static inline void v4l2_ctrl_cur_write_end(struct v4l2_ctrl *ctrl)
+{
+	if (ctrl->has_lockless)
+		write_seqcount_end(&ctrl->cur_seq);
+}
+
+/**
+ * v4l2_ctrl_cur_changed() - Report an update of the current value of a
+ *	control.
+ *
+ * @ctrl:	The control, its handler must be locked.
+ *
+ * Calls the notify callback of the handler if @ctrl asked for it and sends
+ * a value change event to every subscriber of @ctrl. Used by the setters
+ * that store the current value themselves instead of going through the
+ * framework.
+ */
+void v4l2_ctrl_cur_changed(struct v4l2_ctrl *ctrl);
+
+/**
+ * v4l2_ctrl_enable_lockless() - Let a control be read without the handler
+ *	lock.
+ *
+ * @ctrl:	The control.
+ *
+ * Initializes @ctrl->cur_seq with the handler lock and sets
+ * @ctrl->has_lockless. To be called by drivers right after creating the
+ * control, before it is read or set.
+ *
+ * The framework's own set path does not go through @ctrl->cur_seq, so only
+ * read-only, non-volatile scalar controls that are not part of a cluster
+ * qualify, and the driver must update them with __v4l2_ctrl_s_ctrl_seq()
+ * or v4l2_ctrl_s_ctrl_seq() only.
+ *
+ * Return: 0 on success, -EINVAL if @ctrl does not qualify.
+ */
+int v4l2_ctrl_enable_lockless(struct v4l2_ctrl *ctrl);
+
+/**
+ * __v4l2_ctrl_s_ctrl_seq() - Set the value of a control read locklessly.
+ *
+ * @ctrl:	The control, set up with v4l2_ctrl_enable_lockless().
+ * @val:	The new value.
+ *
+ * Validates @val, applies it with the &v4l2_ctrl_ops.try_ctrl and
+ * &v4l2_ctrl_ops.s_ctrl ops and stores it as the current value under
+ * @ctrl->cur_seq, then reports it like the framework does. The control's
+ * handler must be locked.
+ *
+ * Return: 0 on success, -EINVAL if @ctrl is not read locklessly, or the
+ * error of the validation or of the ops.
+ */
+int __v4l2_ctrl_s_ctrl_seq(struct v4l2_ctrl *ctrl, s64 val);
+
+/**
+ * v4l2_ctrl_s_ctrl_seq() - Locked variant of __v4l2_ctrl_s_ctrl_seq().
+ *
+ * @ctrl:	The control, set up with v4l2_ctrl_enable_lockless().
+ * @val:	The new value.
+ *
+ * This function will lock the control's handler, so it cannot be used from
+ * within the &v4l2_ctrl_ops functions.
+ */
+static inline int v4l2_ctrl_s_ctrl_seq(struct v4l2_ctrl *ctrl, s64 val)
+{
+	int rval;
+
+	v4l2_ctrl_lock(ctrl);
+	rval = __v4l2_ctrl_s_ctrl_seq(ctrl, val);
+	v4l2_ctrl_unlock(ctrl);
+
+	return rval;
+}
+
+/**
+ * v4l2_ctrl_g_ctrl_lockless() - Get a control's value without locking the
+ *	handler.
+ *
+ * @ctrl:	The control.
+ *
+ * Same as v4l2_ctrl_g_ctrl(), but controls set up with
+ * v4l2_ctrl_enable_lockless() are read under @ctrl->cur_seq and the read is
+ * retried if it raced with an update, so that frequent readers do not
+ * contend with writers on the handler lock. Other controls fall back to
+ * v4l2_ctrl_g_ctrl(). Like v4l2_ctrl_g_ctrl(), it cannot be used from within
+ * the &v4l2_ctrl_ops functions.
+ *
+ * This function is for integer type controls only.
+ */
+static inline s32 v4l2_ctrl_g_ctrl_lockless(struct v4l2_ctrl *ctrl)
+{
+	unsigned int seq;
+	s32 val;
+
+	if (!ctrl->has_lockless)
+		return v4l2_ctrl_g_ctrl(ctrl);
+
+	do {
+		seq = read_seqcount_begin(&ctrl->cur_seq);
+		val = *ctrl->p_cur.p_s32;
+	} while (read_seqcount_retry(&ctrl->cur_seq, seq));
+
+	return val;
+}
+
 /**
  * __v4l2_ctrl_s_ctrl() - Unlocked variant of v4l2_ctrl_s_ctrl().
  *
@@ -1049,6 +1345,33 @@ static inline int v4l2_ctrl_s_ctrl(struct v4l2_ctrl *ctrl, s32 val)
  */
 s64 v4l2_ctrl_g_ctrl_int64(struct v4l2_ctrl *ctrl);
 
+/**
+ * v4l2_ctrl_g_ctrl_int64_lockless() - Get a 64-bit control's value without
+ *	locking the handler.
+ *
+ * @ctrl:	The control.
+ *
+ * The 64-bit counterpart of v4l2_ctrl_g_ctrl_lockless(). The sequence
+ * counter also protects against torn reads on 32-bit architectures.
+ *
+ * This function is for 64-bit integer type controls only.
+ */
+static inline s64 v4l2_ctrl_g_ctrl_int64_lockless(struct v4l2_ctrl *ctrl)
+{
+	unsigned int seq;
+	s64 val;
+
+	if (!ctrl->has_lockless)
+		return v4l2_ctrl_g_ctrl_int64(ctrl);
+
+	do {
+		seq = read_seqcount_begin(&ctrl->cur_seq);
+		val = *ctrl->p_cur.p_s64;
+	} while (read_seqcount_retry(&ctrl->cur_seq, seq));
+
+	return val;
+}
+
 /**
  * __v4l2_ctrl_s_ctrl_int64() - Unlocked variant of v4l2_ctrl_s_ctrl_int64().
  *
@@ -1168,6 +1491,140 @@ static inline int v4l2_ctrl_s_ctrl_compound(struct v4l2_ctrl *ctrl,
 	return rval;
 }
 
+/**
+ * v4l2_ctrl_payload_alloc() - Allocate a compound control payload.
+ *
+ * @size: Size of the value in bytes.
+ *
+ * Return: the payload with one reference, or NULL if out of memory.
+ */
+struct v4l2_ctrl_payload *v4l2_ctrl_payload_alloc(size_t size);
+
+/**
+ * v4l2_ctrl_payload_get() - Take a reference to a compound control payload.
+ *
+ * @payload: The payload.
+ *
+ * Return: @payload.
+ */
+static inline struct v4l2_ctrl_payload *
+v4l2_ctrl_payload_get(struct v4l2_ctrl_payload *payload)
+{
+	refcount_inc(&payload->ref);
+	return payload;
+}
+
+/**
+ * v4l2_ctrl_payload_put() - Drop a reference to a compound control payload.
+ *
+ * @payload: The payload, may be NULL.
+ */
+void v4l2_ctrl_payload_put(struct v4l2_ctrl_payload *payload);
+
+/**
+ * v4l2_ctrl_payload_make_writable() - Unshare a compound control payload.
+ *
+ * @pp: Pointer to the payload reference of the caller.
+ *
+ * If the payload is shared, it is copied into a new payload that replaces
+ * *@pp, and the reference to the shared one is dropped.
+ *
+ * Return: the data of the payload, now owned by the caller alone, or NULL
+ * if out of memory, in which case *@pp is unchanged.
+ */
+void *v4l2_ctrl_payload_make_writable(struct v4l2_ctrl_payload **pp);
+
+/**
+ * v4l2_ctrl_enable_payload() - Switch a compound control to a refcounted
+ *	payload.
+ *
+ * @ctrl: The compound or array control.
+ *
+ * Moves the current value of @ctrl into a &struct v4l2_ctrl_payload, so
+ * that requests share it instead of copying it. To be called by drivers
+ * right after creating large compound controls such as LUTs or defect maps.
+ *
+ * Return: 0 on success, -EINVAL if @ctrl is not a pointer control, -ENOMEM
+ * otherwise.
+ */
+int v4l2_ctrl_enable_payload(struct v4l2_ctrl *ctrl);
+
+/**
+ * v4l2_ctrl_cur_writable() - Get the current value of a control with a
+ *	payload for modification.
+ *
+ * @ctrl: The control, its handler must be locked.
+ *
+ * Unshares @ctrl->cur_payload from the requests still referencing it and
+ * updates @ctrl->p_cur. Used by the framework before it stores a new value.
+ *
+ * Return: the writable current value, or NULL if out of memory.
+ */
+void *v4l2_ctrl_cur_writable(struct v4l2_ctrl *ctrl);
+
+/**
+ * __v4l2_ctrl_s_ctrl_payload() - Set the value of a control with a payload
+ *	and share the payload as the current value.
+ *
+ * @ctrl: The control, its handler must be locked.
+ * @payload: The new value. A reference is taken if @payload becomes the
+ *	current value, the caller keeps its own and must not modify @payload
+ *	afterwards.
+ *
+ * @payload is validated and handed to the &v4l2_ctrl_ops.try_ctrl and
+ * &v4l2_ctrl_ops.s_ctrl ops through @ctrl->p_new without being copied.
+ * On success it replaces @ctrl->cur_payload, under @ctrl->cur_seq, and a
+ * value change is reported to subscribers without comparing it to the old
+ * value. Requests sharing the old payload keep it. Only controls that are
+ * not part of a cluster are supported.
+ *
+ * Return: 0 on success, -EINVAL if @ctrl has no payload, is clustered or
+ * the size of @payload does not match, -EACCES or -EBUSY if @ctrl is
+ * read-only or grabbed, or the error of the validation or of the ops.
+ */
+int __v4l2_ctrl_s_ctrl_payload(struct v4l2_ctrl *ctrl,
+			       struct v4l2_ctrl_payload *payload);
+
+/**
+ * v4l2_ctrl_ref_share_payload() - Let a request share the current value.
+ *
+ * @ref: The control reference of the request handler. The handler of
+ *	@ref->ctrl must be locked.
+ *
+ * Replaces the copy of the current value into @ref->p_req by a reference
+ * to the current payload.
+ */
+void v4l2_ctrl_ref_share_payload(struct v4l2_ctrl_ref *ref);
+
+/**
+ * v4l2_ctrl_ref_writable() - Get the request value of a control with a
+ *	payload for modification.
+ *
+ * @ref: The control reference of the request handler.
+ *
+ * Return: the writable request value, or NULL if out of memory.
+ */
+void *v4l2_ctrl_ref_writable(struct v4l2_ctrl_ref *ref);
+
+/**
+ * v4l2_ctrl_ref_release_payload() - Drop the payload of a request.
+ *
+ * @ref: The control reference of the request handler.
+ */
+void v4l2_ctrl_ref_release_payload(struct v4l2_ctrl_ref *ref);
+
+/**
+ * v4l2_ctrl_handler_release_payloads() - Drop the current payloads of the
+ *	controls of a handler.
+ *
+ * @hdl: The control handler.
+ *
+ * v4l2_ctrl_handler_free() does not know about payloads. Drivers that
+ * called v4l2_ctrl_enable_payload() must call this right before freeing
+ * @hdl. The controls of @hdl have no current value afterwards.
+ */
+void v4l2_ctrl_handler_release_payloads(struct v4l2_ctrl_handler *hdl);
+
 /* Helper defines for area type controls */
 #define __v4l2_ctrl_s_ctrl_area(ctrl, area) \
 	__v4l2_ctrl_s_ctrl_compound((ctrl), V4L2_CTRL_TYPE_AREA, (area))
@@ -1199,6 +1656,117 @@ void v4l2_ctrl_replace(struct v4l2_event *old, const struct v4l2_event *new);
  */
 void v4l2_ctrl_merge(const struct v4l2_event *old, struct v4l2_event *new);
 
+/**
+ * struct v4l2_ctrl_ev_ring - Coalescing control event queue of one subscriber
+ *
+ * @lock:	Protects all fields below.
+ * @wait:	Readers waiting for a batch of events.
+ * @timer:	Fires @window_ns after the first event of a batch was queued.
+ * @events:	Ring of @depth events.
+ * @depth:	Number of entries in @events, a power of two.
+ * @first:	Index of the oldest queued event.
+ * @count:	Number of queued events.
+ * @batch:	Number of queued events that wakes up readers.
+ * @window_ns:	Longest time an event waits for its batch to fill up, 0 to
+ *		wait for full batches only.
+ * @ready:	Set when readers have been woken up for the queued events.
+ * @sequence:	Sequence number given to the next queued event.
+ * @coalesced:	Number of events merged into a queued event of the same
+ *		control because the ring was full.
+ * @lost:	Number of events dropped because the ring was full and held
+ *		no other event of their control.
+ *
+ * A subscriber that watches controls changing every frame can use a ring
+ * much deeper than the single-entry queue of v4l2_ctrl_subscribe_event(),
+ * be woken up once per @batch events or per @window_ns instead of once per
+ * change, and dequeue everything in one call. When the ring is full a new
+ * event is merged into the newest queued event of the same control, or
+ * else the oldest event into the next one of its control, with
+ * v4l2_ctrl_merge() semantics, so no change flag is lost and values are
+ * never credited to another control. Events are only lost when the ring
+ * is shallower than the number of controls changing.
+ */
+struct v4l2_ctrl_ev_ring {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct hrtimer timer;
+	struct v4l2_event *events;
+	unsigned int depth;
+	unsigned int first;
+	unsigned int count;
+	unsigned int batch;
+	u64 window_ns;
+	bool ready;
+	u32 sequence;
+	unsigned long coalesced;
+	unsigned long lost;
+};
+
+/**
+ * v4l2_ctrl_ev_ring_init - Initialize a control event ring
+ *
+ * @ring: The ring.
+ * @depth: Number of events the ring holds, rounded up to a power of two.
+ * @batch: Number of events that wakes up readers, clamped to [1, @depth].
+ * @window_us: Longest time in microseconds an event waits for its batch,
+ *	0 for no limit.
+ *
+ * Return: 0 on success, -EINVAL or -ENOMEM otherwise.
+ */
+int v4l2_ctrl_ev_ring_init(struct v4l2_ctrl_ev_ring *ring, unsigned int depth,
+			   unsigned int batch, unsigned int window_us);
+
+/**
+ * v4l2_ctrl_ev_ring_release - Free the events of a control event ring
+ *
+ * @ring: The ring.
+ */
+void v4l2_ctrl_ev_ring_release(struct v4l2_ctrl_ev_ring *ring);
+
+/**
+ * v4l2_ctrl_ev_ring_queue - Queue a control event
+ *
+ * @ring: The ring.
+ * @ev: The %V4L2_EVENT_CTRL event, as sent to the subscribers of a control.
+ *
+ * Called by the control framework instead of queueing @ev on the file
+ * handle for subscriptions that use a ring. Can be called from atomic
+ * context.
+ */
+void v4l2_ctrl_ev_ring_queue(struct v4l2_ctrl_ev_ring *ring,
+			     const struct v4l2_event *ev);
+
+/**
+ * v4l2_ctrl_ev_ring_dequeue - Dequeue a batch of control events
+ *
+ * @ring: The ring.
+ * @evs: Array the events are copied to, oldest first.
+ * @max: Number of entries of @evs.
+ * @nonblocking: Return -EAGAIN instead of waiting for a batch.
+ *
+ * Waits until readers are woken up for a batch and copies up to @max
+ * queued events, with the number of events left in the ring in
+ * &v4l2_event.pending.
+ *
+ * Return: the number of events copied, -EAGAIN or -ERESTARTSYS.
+ */
+int v4l2_ctrl_ev_ring_dequeue(struct v4l2_ctrl_ev_ring *ring,
+			      struct v4l2_event *evs, unsigned int max,
+			      bool nonblocking);
+
+/**
+ * v4l2_ctrl_ev_ring_poll - Poll a control event ring
+ *
+ * @ring: The ring.
+ * @file: pointer to struct file
+ * @wait: pointer to struct poll_table_struct
+ *
+ * Return: %EPOLLPRI once a batch can be dequeued.
+ */
+__poll_t v4l2_ctrl_ev_ring_poll(struct v4l2_ctrl_ev_ring *ring,
+				struct file *file,
+				struct poll_table_struct *wait);
+
 /**
  * v4l2_ctrl_log_status - helper function to implement %VIDIOC_LOG_STATUS ioctl
  *
@@ -1264,6 +1832,69 @@ int v4l2_ctrl_request_setup(struct media_request *req,
 void v4l2_ctrl_request_complete(struct media_request *req,
 				struct v4l2_ctrl_handler *parent);
 
+/**
+ * v4l2_ctrl_req_pool_init - Create a pool of request objects for a handler
+ *
+ * @hdl: The parent control handler
+ * @prealloc: Number of objects allocated up front
+ * @max_free: Number of idle objects kept for reuse, at least @prealloc
+ *
+ * Must be called once all controls have been added to @hdl. Requests are
+ * then cloned from the parent into pooled objects instead of separately
+ * allocated handlers, references and values.
+ *
+ * Return: 0 on success or a negative error code.
+ */
+int v4l2_ctrl_req_pool_init(struct v4l2_ctrl_handler *hdl,
+			    unsigned int prealloc, unsigned int max_free);
+
+/**
+ * v4l2_ctrl_req_pool_free - Free the request object pool of a handler
+ *
+ * @hdl: The parent control handler
+ *
+ * All requests bound to @hdl must have been released. Does nothing if @hdl
+ * has no pool.
+ */
+void v4l2_ctrl_req_pool_free(struct v4l2_ctrl_handler *hdl);
+
+/**
+ * v4l2_ctrl_req_pool_get - Get a request handler from the pool
+ *
+ * @parent: The parent control handler
+ *
+ * The returned handler is zeroed except for @buckets and @nr_of_buckets,
+ * which point into the pooled object. Its control references are obtained
+ * with v4l2_ctrl_req_pool_ref().
+ *
+ * Return: the request handler, or NULL if @parent has no pool or the
+ * allocation failed.
+ */
+struct v4l2_ctrl_handler *
+v4l2_ctrl_req_pool_get(struct v4l2_ctrl_handler *parent);
+
+/**
+ * v4l2_ctrl_req_pool_ref - Get a pre-sized control reference
+ *
+ * @hdl: A request handler returned by v4l2_ctrl_req_pool_get()
+ * @idx: Index of the reference in the parent's @ctrl_refs list
+ *
+ * Return: the zeroed reference with @p_req pointing to storage sized for
+ * the parent's control at @idx, or NULL if @idx is out of range.
+ */
+struct v4l2_ctrl_ref *v4l2_ctrl_req_pool_ref(struct v4l2_ctrl_handler *hdl,
+					     unsigned int idx);
+
+/**
+ * v4l2_ctrl_req_pool_put - Return a request handler to its pool
+ *
+ * @hdl: A request handler returned by v4l2_ctrl_req_pool_get()
+ *
+ * Called instead of kfree() when the request object is released after
+ * v4l2_ctrl_request_complete().
+ */
+void v4l2_ctrl_req_pool_put(struct v4l2_ctrl_handler *hdl);
+
 /**
  * v4l2_ctrl_request_hdl_find - Find the control handler in the request
  *
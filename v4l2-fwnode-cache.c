@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * V4L2 fwnode binding parsing library: shared endpoint descriptions
+ *
+ * Endpoint descriptions are parsed once per (fwnode, bus type) pair and
+ * kept in a hash table for as long as someone holds a reference.
+ */
+
+#include <linux/err.h>
+#include <linux/hashtable.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+
+#include <media/v4l2-fwnode.h>
+
+#define V4L2_FWNODE_EP_CACHE_BITS	6
+
+/**
+ * struct v4l2_fwnode_ep_entry - shared endpoint description
+ * @vep: the parsed endpoint, immutable once the entry is hashed
+ * @fwnode: the endpoint fwnode, a reference is held on it
+ * @bus_type: the bus type the endpoint was parsed for
+ * @kref: reference count
+ * @node: entry in v4l2_fwnode_ep_cache
+ */
+struct v4l2_fwnode_ep_entry {
+	struct v4l2_fwnode_endpoint vep;
+	struct fwnode_handle *fwnode;
+	enum v4l2_mbus_type bus_type;
+	struct kref kref;
+	struct hlist_node node;
+};
+
+static DEFINE_HASHTABLE(v4l2_fwnode_ep_cache, V4L2_FWNODE_EP_CACHE_BITS);
+static DEFINE_MUTEX(v4l2_fwnode_ep_cache_lock);
+
+const struct v4l2_fwnode_endpoint *
+v4l2_fwnode_endpoint_get(struct fwnode_handle *fwnode,
+			 enum v4l2_mbus_type bus_type)
+{
+	struct v4l2_fwnode_ep_entry *entry;
+	int ret;
+
+	mutex_lock(&v4l2_fwnode_ep_cache_lock);
+
+	hash_for_each_possible(v4l2_fwnode_ep_cache, entry, node,
+			       (unsigned long)fwnode) {
+		if (entry->fwnode == fwnode && entry->bus_type == bus_type) {
+			kref_get(&entry->kref);
+			goto out;
+		}
+	}
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry) {
+		entry = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+
+	entry->vep.bus_type = bus_type;
+	ret = v4l2_fwnode_endpoint_alloc_parse(fwnode, &entry->vep);
+	if (ret) {
+		kfree(entry);
+		entry = ERR_PTR(ret);
+		goto out;
+	}
+
+	entry->fwnode = fwnode_handle_get(fwnode);
+	entry->bus_type = bus_type;
+	kref_init(&entry->kref);
+	hash_add(v4l2_fwnode_ep_cache, &entry->node, (unsigned long)fwnode);
+
+out:
+	mutex_unlock(&v4l2_fwnode_ep_cache_lock);
+
+	return IS_ERR(entry) ? ERR_CAST(entry) : &entry->vep;
+}
+EXPORT_SYMBOL_GPL(v4l2_fwnode_endpoint_get);
+
+const struct v4l2_fwnode_endpoint *
+v4l2_fwnode_endpoint_get_remote(struct fwnode_handle *fwnode,
+				enum v4l2_mbus_type bus_type)
+{
+	const struct v4l2_fwnode_endpoint *vep;
+	struct fwnode_handle *remote;
+
+	remote = fwnode_graph_get_remote_endpoint(fwnode);
+	if (!remote)
+		return ERR_PTR(-ENOLINK);
+
+	vep = v4l2_fwnode_endpoint_get(remote, bus_type);
+	fwnode_handle_put(remote);
+
+	return vep;
+}
+EXPORT_SYMBOL_GPL(v4l2_fwnode_endpoint_get_remote);
+
+static void v4l2_fwnode_ep_entry_release(struct kref *kref)
+	__releases(&v4l2_fwnode_ep_cache_lock)
+{
+	struct v4l2_fwnode_ep_entry *entry =
+		container_of(kref, struct v4l2_fwnode_ep_entry, kref);
+
+	hash_del(&entry->node);
+	mutex_unlock(&v4l2_fwnode_ep_cache_lock);
+
+	v4l2_fwnode_endpoint_free(&entry->vep);
+	fwnode_handle_put(entry->fwnode);
+	kfree(entry);
+}
+
+void v4l2_fwnode_endpoint_put(const struct v4l2_fwnode_endpoint *vep)
+{
+	struct v4l2_fwnode_ep_entry *entry;
+
+	if (IS_ERR_OR_NULL(vep))
+		return;
+
+	entry = container_of(vep, struct v4l2_fwnode_ep_entry, vep);
+	kref_put_mutex(&entry->kref, v4l2_fwnode_ep_entry_release,
+		       &v4l2_fwnode_ep_cache_lock);
+}
+EXPORT_SYMBOL_GPL(v4l2_fwnode_endpoint_put);
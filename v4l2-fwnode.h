@@ -290,6 +290,55 @@ void v4l2_fwnode_endpoint_free(struct v4l2_fwnode_endpoint *vep);
 int v4l2_fwnode_endpoint_alloc_parse(struct fwnode_handle *fwnode,
 				     struct v4l2_fwnode_endpoint *vep);
 
+/**
+ * v4l2_fwnode_endpoint_get() - get the shared, parsed description of an
+ *				endpoint
+ * @fwnode: pointer to the endpoint's fwnode handle
+ * @bus_type: the bus type to parse the endpoint for, or V4L2_MBUS_UNKNOWN
+ *	      to use the "bus-type" property as for
+ *	      v4l2_fwnode_endpoint_alloc_parse()
+ *
+ * Parses the endpoint with v4l2_fwnode_endpoint_alloc_parse() the first
+ * time it is requested and returns the same object to every later caller
+ * with the same @fwnode and @bus_type, until the last reference is dropped.
+ * Sensor and receiver drivers, and repeated binds of the same driver, thus
+ * share one parse and one link frequency array.
+ *
+ * The returned object is immutable and must be released with
+ * v4l2_fwnode_endpoint_put().
+ *
+ * Return: the endpoint description or an ERR_PTR() with the error codes of
+ *	   v4l2_fwnode_endpoint_alloc_parse().
+ */
+const struct v4l2_fwnode_endpoint *
+v4l2_fwnode_endpoint_get(struct fwnode_handle *fwnode,
+			 enum v4l2_mbus_type bus_type);
+
+/**
+ * v4l2_fwnode_endpoint_get_remote() - get the shared, parsed description of
+ *				       the remote endpoint
+ * @fwnode: pointer to the local endpoint's fwnode handle
+ * @bus_type: as for v4l2_fwnode_endpoint_get()
+ *
+ * Lets a receiver use the description of the transmitter's endpoint that
+ * the transmitter's driver already has.
+ *
+ * Return: the endpoint description, ERR_PTR(-ENOLINK) if @fwnode has no
+ *	   remote endpoint, or the error codes of v4l2_fwnode_endpoint_get().
+ */
+const struct v4l2_fwnode_endpoint *
+v4l2_fwnode_endpoint_get_remote(struct fwnode_handle *fwnode,
+				enum v4l2_mbus_type bus_type);
+
+/**
+ * v4l2_fwnode_endpoint_put() - release an endpoint description obtained
+ *				with v4l2_fwnode_endpoint_get()
+ * @vep: the endpoint description
+ *
+ * It is safe to call this function with a NULL or ERR_PTR() argument.
+ */
+void v4l2_fwnode_endpoint_put(const struct v4l2_fwnode_endpoint *vep);
+
 /**
  * v4l2_fwnode_parse_link() - parse a link between two endpoints
  * @fwnode: pointer to the endpoint's fwnode at the local end of the link
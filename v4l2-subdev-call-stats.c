@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * V4L2 sub-device call latency statistics
+ *
+ * When enabled through debugfs, every v4l2_subdev_call() that reaches a
+ * subdev op is timed and accounted to that subdev and op, so that the
+ * subdev making e.g. stream on slow can be found without patching drivers.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include <media/v4l2-subdev.h>
+
+/* Distinct ops tracked per subdev, further ops are not accounted */
+#define V4L2_SUBDEV_CALL_STATS_MAX_OPS	16
+/* Longest "ops.op" name kept, e.g. "pad.enum_frame_interval" */
+#define V4L2_SUBDEV_CALL_STATS_OP_LEN	32
+/* Bucket 0 counts calls under 1 us, bucket i > 0 calls in [2^(i-1), 2^i) us */
+#define V4L2_SUBDEV_CALL_HIST_BUCKETS	24
+
+/**
+ * struct v4l2_subdev_op_stats - statistics of one op of one subdev
+ * @op: "ops.op" name of the op, copied as the caller's string literal goes
+ *	away with its module
+ * @count: number of calls
+ * @total_ns: total time spent in the op
+ * @max_ns: longest call
+ * @hist: log2 histogram of the call latencies in microseconds
+ */
+struct v4l2_subdev_op_stats {
+	char op[V4L2_SUBDEV_CALL_STATS_OP_LEN];
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+	u32 hist[V4L2_SUBDEV_CALL_HIST_BUCKETS];
+};
+
+/**
+ * struct v4l2_subdev_call_stats - call statistics of one subdev
+ * @node: entry in v4l2_subdev_call_stats_list
+ * @name: name of the subdev, copied as the statistics stay listed when a
+ *	subdev goes away without v4l2_subdev_call_stats_free()
+ * @lock: protects @nr_ops and @ops
+ * @nr_ops: number of used entries in @ops
+ * @ops: per-op statistics
+ */
+struct v4l2_subdev_call_stats {
+	struct list_head node;
+	char name[V4L2_SUBDEV_NAME_SIZE];
+	spinlock_t lock;
+	unsigned int nr_ops;
+	struct v4l2_subdev_op_stats ops[V4L2_SUBDEV_CALL_STATS_MAX_OPS];
+};
+
+DEFINE_STATIC_KEY_FALSE(v4l2_subdev_call_stats_key);
+EXPORT_SYMBOL_GPL(v4l2_subdev_call_stats_key);
+
+static LIST_HEAD(v4l2_subdev_call_stats_list);
+static DEFINE_SPINLOCK(v4l2_subdev_call_stats_list_lock);
+static struct dentry *v4l2_subdev_call_stats_dir;
+
+static struct v4l2_subdev_call_stats *
+v4l2_subdev_call_stats_get(struct v4l2_subdev *sd)
+{
+	struct v4l2_subdev_call_stats *stats = READ_ONCE(sd->call_stats);
+	unsigned long flags;
+
+	if (likely(stats))
+		return stats;
+
+	/* Subdev ops may be called in atomic context */
+	stats = kzalloc(sizeof(*stats), GFP_ATOMIC);
+	if (!stats)
+		return NULL;
+
+	strscpy(stats->name, sd->name, sizeof(stats->name));
+	spin_lock_init(&stats->lock);
+
+	spin_lock_irqsave(&v4l2_subdev_call_stats_list_lock, flags);
+	if (sd->call_stats) {
+		spin_unlock_irqrestore(&v4l2_subdev_call_stats_list_lock, flags);
+		kfree(stats);
+		return sd->call_stats;
+	}
+	list_add_tail(&stats->node, &v4l2_subdev_call_stats_list);
+	WRITE_ONCE(sd->call_stats, stats);
+	spin_unlock_irqrestore(&v4l2_subdev_call_stats_list_lock, flags);
+
+	return stats;
+}
+
+void __v4l2_subdev_call_stats_record(struct v4l2_subdev *sd, const char *op,
+				     u64 start_ns)
+{
+	struct v4l2_subdev_call_stats *stats;
+	struct v4l2_subdev_op_stats *ops;
+	u64 ns = ktime_get_ns() - start_ns;
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	unsigned int bucket;
+	unsigned long flags;
+	unsigned int i;
+
+	stats = v4l2_subdev_call_stats_get(sd);
+	if (!stats)
+		return;
+
+	bucket = min_t(unsigned int, us ? ilog2(us) + 1 : 0,
+		       V4L2_SUBDEV_CALL_HIST_BUCKETS - 1);
+
+	spin_lock_irqsave(&stats->lock, flags);
+
+	for (i = 0; i < stats->nr_ops; i++)
+		if (!strncmp(stats->ops[i].op, op, sizeof(stats->ops[i].op)))
+			break;
+	if (i == stats->nr_ops) {
+		if (i == V4L2_SUBDEV_CALL_STATS_MAX_OPS)
+			goto unlock;
+		strscpy(stats->ops[stats->nr_ops++].op, op,
+			sizeof(stats->ops[i].op));
+	}
+
+	ops = &stats->ops[i];
+	ops->count++;
+	ops->total_ns += ns;
+	ops->max_ns = max(ops->max_ns, ns);
+	ops->hist[bucket]++;
+
+unlock:
+	spin_unlock_irqrestore(&stats->lock, flags);
+}
+EXPORT_SYMBOL_GPL(__v4l2_subdev_call_stats_record);
+
+void v4l2_subdev_call_stats_free(struct v4l2_subdev *sd)
+{
+	struct v4l2_subdev_call_stats *stats;
+
+	spin_lock_irq(&v4l2_subdev_call_stats_list_lock);
+	stats = sd->call_stats;
+	if (stats)
+		list_del(&stats->node);
+	sd->call_stats = NULL;
+	spin_unlock_irq(&v4l2_subdev_call_stats_list_lock);
+
+	kfree(stats);
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_call_stats_free);
+
+static int v4l2_subdev_call_stats_show(struct seq_file *s, void *unused)
+{
+	struct v4l2_subdev_call_stats *stats;
+	unsigned int i, j;
+
+	seq_puts(s, "# subdev op count total_us max_us hist(<1us,<2us,<4us,...)\n");
+
+	spin_lock_irq(&v4l2_subdev_call_stats_list_lock);
+	list_for_each_entry(stats, &v4l2_subdev_call_stats_list, node) {
+		spin_lock(&stats->lock);
+		for (i = 0; i < stats->nr_ops; i++) {
+			struct v4l2_subdev_op_stats *ops = &stats->ops[i];
+
+			seq_printf(s, "%s %s %llu %llu %llu", stats->name,
+				   ops->op, ops->count,
+				   div_u64(ops->total_ns, NSEC_PER_USEC),
+				   div_u64(ops->max_ns, NSEC_PER_USEC));
+			for (j = 0; j < V4L2_SUBDEV_CALL_HIST_BUCKETS; j++)
+				seq_printf(s, "%c%u", j ? ',' : ' ',
+					   ops->hist[j]);
+			seq_putc(s, '\n');
+		}
+		spin_unlock(&stats->lock);
+	}
+	spin_unlock_irq(&v4l2_subdev_call_stats_list_lock);
+
+	return 0;
+}
+
+static int v4l2_subdev_call_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, v4l2_subdev_call_stats_show, NULL);
+}
+
+static ssize_t v4l2_subdev_call_stats_reset(struct file *file,
+					    const char __user *buf,
+					    size_t count, loff_t *ppos)
+{
+	struct v4l2_subdev_call_stats *stats;
+
+	spin_lock_irq(&v4l2_subdev_call_stats_list_lock);
+	list_for_each_entry(stats, &v4l2_subdev_call_stats_list, node) {
+		spin_lock(&stats->lock);
+		stats->nr_ops = 0;
+		memset(stats->ops, 0, sizeof(stats->ops));
+		spin_unlock(&stats->lock);
+	}
+	spin_unlock_irq(&v4l2_subdev_call_stats_list_lock);
+
+	return count;
+}
+
+static const struct file_operations v4l2_subdev_call_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = v4l2_subdev_call_stats_open,
+	.read = seq_read,
+	.write = v4l2_subdev_call_stats_reset,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t v4l2_subdev_call_stats_enable_read(struct file *file,
+						  char __user *buf,
+						  size_t count, loff_t *ppos)
+{
+	char val[2] = {
+		static_key_enabled(&v4l2_subdev_call_stats_key) ? '1' : '0',
+		'\n',
+	};
+
+	return simple_read_from_buffer(buf, count, ppos, val, sizeof(val));
+}
+
+static ssize_t v4l2_subdev_call_stats_enable_write(struct file *file,
+						   const char __user *buf,
+						   size_t count, loff_t *ppos)
+{
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, count, &enable);
+	if (ret)
+		return ret;
+
+	if (enable)
+		static_branch_enable(&v4l2_subdev_call_stats_key);
+	else
+		static_branch_disable(&v4l2_subdev_call_stats_key);
+
+	return count;
+}
+
+static const struct file_operations v4l2_subdev_call_stats_enable_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = v4l2_subdev_call_stats_enable_read,
+	.write = v4l2_subdev_call_stats_enable_write,
+	.llseek = default_llseek,
+};
+
+void v4l2_subdev_call_stats_init(void)
+{
+	v4l2_subdev_call_stats_dir = debugfs_create_dir("v4l2-subdev-calls",
+							NULL);
+	debugfs_create_file("enable", 0600, v4l2_subdev_call_stats_dir, NULL,
+			    &v4l2_subdev_call_stats_enable_fops);
+	debugfs_create_file("stats", 0600, v4l2_subdev_call_stats_dir, NULL,
+			    &v4l2_subdev_call_stats_fops);
+}
+
+void v4l2_subdev_call_stats_exit(void)
+{
+	debugfs_remove_recursive(v4l2_subdev_call_stats_dir);
+	static_branch_disable(&v4l2_subdev_call_stats_key);
+}
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * V4L2 sub-device dynamically sized frame descriptors
+ */
+
+#include <linux/overflow.h>
+#include <linux/slab.h>
+#include <media/v4l2-subdev.h>
+
+/* Highest CSI-2 virtual channel number, with the VCX extension */
+#define CSI2_MAX_VC	31
+
+struct v4l2_mbus_frame_desc_ext *
+v4l2_subdev_frame_desc_alloc(unsigned int max_entries)
+{
+	struct v4l2_mbus_frame_desc_ext *fd;
+
+	fd = kzalloc(struct_size(fd, entry, max_entries), GFP_KERNEL);
+	if (fd)
+		fd->max_entries = max_entries;
+
+	return fd;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_frame_desc_alloc);
+
+static int get_frame_desc_legacy(struct v4l2_subdev *sd, unsigned int pad,
+				 struct v4l2_mbus_frame_desc_ext **pfd)
+{
+	struct v4l2_mbus_frame_desc legacy = { 0 };
+	struct v4l2_mbus_frame_desc_ext *fd;
+	int ret;
+
+	ret = v4l2_subdev_call(sd, pad, get_frame_desc, pad, &legacy);
+	if (ret)
+		return ret;
+
+	if (WARN_ON(legacy.num_entries > V4L2_FRAME_DESC_ENTRY_MAX))
+		return -EINVAL;
+
+	fd = v4l2_subdev_frame_desc_alloc(legacy.num_entries);
+	if (!fd)
+		return -ENOMEM;
+
+	fd->type = legacy.type;
+	fd->num_entries = legacy.num_entries;
+	memcpy(fd->entry, legacy.entry,
+	       legacy.num_entries * sizeof(*legacy.entry));
+
+	*pfd = fd;
+	return 0;
+}
+
+int v4l2_subdev_get_frame_desc_ext(struct v4l2_subdev *sd, unsigned int pad,
+				   struct v4l2_mbus_frame_desc_ext **pfd)
+{
+	struct v4l2_mbus_frame_desc_ext *fd;
+	unsigned int max_entries = V4L2_FRAME_DESC_ENTRY_MAX;
+	int ret;
+
+	if (!v4l2_subdev_has_op(sd, pad, get_frame_desc_ext))
+		return get_frame_desc_legacy(sd, pad, pfd);
+
+	for (;;) {
+		fd = v4l2_subdev_frame_desc_alloc(max_entries);
+		if (!fd)
+			return -ENOMEM;
+
+		ret = v4l2_subdev_call(sd, pad, get_frame_desc_ext, pad, fd);
+		if (ret != -ENOSPC)
+			break;
+
+		/* The subdev reports how many entries it needs */
+		if (WARN_ON(fd->num_entries <= max_entries)) {
+			ret = -EINVAL;
+			break;
+		}
+		max_entries = fd->num_entries;
+		kfree(fd);
+	}
+
+	if (!ret && WARN_ON(fd->num_entries > fd->max_entries))
+		ret = -EINVAL;
+
+	if (ret) {
+		kfree(fd);
+		return ret;
+	}
+
+	*pfd = fd;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_get_frame_desc_ext);
+
+int v4l2_subdev_get_frame_desc_compat(struct v4l2_subdev *sd, unsigned int pad,
+				      struct v4l2_mbus_frame_desc *fd)
+{
+	struct v4l2_mbus_frame_desc_ext *ext;
+	int ret;
+
+	ext = v4l2_subdev_frame_desc_alloc(V4L2_FRAME_DESC_ENTRY_MAX);
+	if (!ext)
+		return -ENOMEM;
+
+	ret = v4l2_subdev_call(sd, pad, get_frame_desc_ext, pad, ext);
+	if (ret == -ENOSPC)
+		ret = -E2BIG;
+	if (ret)
+		goto out;
+
+	fd->type = ext->type;
+	fd->num_entries = ext->num_entries;
+	memcpy(fd->entry, ext->entry, ext->num_entries * sizeof(*ext->entry));
+
+out:
+	kfree(ext);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_get_frame_desc_compat);
+
+int v4l2_subdev_frame_desc_validate(const struct v4l2_mbus_frame_desc_ext *fd)
+{
+	const struct v4l2_mbus_frame_desc_entry *a, *b;
+	unsigned int i, j;
+
+	for (i = 0; i < fd->num_entries; i++) {
+		a = &fd->entry[i];
+
+		if (fd->type == V4L2_MBUS_FRAME_DESC_TYPE_CSI2 &&
+		    a->bus.csi2.vc > CSI2_MAX_VC)
+			return -EINVAL;
+
+		for (j = i + 1; j < fd->num_entries; j++) {
+			b = &fd->entry[j];
+
+			if (a->stream == b->stream && a->sink_pad != b->sink_pad)
+				return -EINVAL;
+
+			if (fd->type == V4L2_MBUS_FRAME_DESC_TYPE_CSI2 &&
+			    a->bus.csi2.vc == b->bus.csi2.vc &&
+			    a->bus.csi2.dt == b->bus.csi2.dt)
+				return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_frame_desc_validate);
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * V4L2 sub-device per-pad state locking
+ */
+
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <media/v4l2-subdev.h>
+
+int v4l2_subdev_state_init_pad_locks(struct v4l2_subdev_state *state,
+				     unsigned int num_pads)
+{
+	static struct lock_class_key key;
+	unsigned int i;
+
+	state->pad_locks = kcalloc(num_pads, sizeof(*state->pad_locks),
+				   GFP_KERNEL);
+	if (!state->pad_locks)
+		return -ENOMEM;
+
+	/* All pad locks share one class, nested under the state lock */
+	for (i = 0; i < num_pads; i++)
+		__mutex_init(&state->pad_locks[i], "state->pad_locks[]", &key);
+	state->num_pads = num_pads;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_state_init_pad_locks);
+
+void v4l2_subdev_state_free_pad_locks(struct v4l2_subdev_state *state)
+{
+	unsigned int i;
+
+	if (!state->pad_locks)
+		return;
+
+	for (i = 0; i < state->num_pads; i++)
+		mutex_destroy(&state->pad_locks[i]);
+	kfree(state->pad_locks);
+	state->pad_locks = NULL;
+	state->num_pads = 0;
+}
+EXPORT_SYMBOL_GPL(v4l2_subdev_state_free_pad_locks);
@@ -8,6 +8,8 @@
 #ifndef _V4L2_SUBDEV_H
 #define _V4L2_SUBDEV_H
 
+#include <linux/jump_label.h>
+#include <linux/timekeeping.h>
 #include <linux/types.h>
 #include <linux/v4l2-subdev.h>
 #include <media/media-entity.h>
@@ -38,6 +40,8 @@ struct v4l2_subdev;
 struct v4l2_subdev_fh;
 struct tuner_setup;
 struct v4l2_mbus_frame_desc;
+struct v4l2_mbus_frame_desc_ext;
+struct v4l2_subdev_call_stats;
 
 /**
  * struct v4l2_decode_vbi_line - used to decode_vbi_line
@@ -346,6 +350,10 @@ enum v4l2_mbus_frame_desc_flags {
  *		%FRAME_DESC_FL_BLOB is not set.
  * @length:	number of octets per frame, valid if @flags
  *		%V4L2_MBUS_FRAME_DESC_FL_LEN_MAX is set.
+ * @stream:	stream on the source pad carrying this data, for subdevs
+ *		that multiplex several streams over one pad. 0 otherwise.
+ * @sink_pad:	sink pad the stream is routed from, for bridges that
+ *		aggregate several inputs. 0 otherwise.
  * @bus:	Bus-specific frame descriptor parameters
  * @bus.csi2:	CSI-2-specific bus configuration
  */
@@ -353,6 +361,8 @@ struct v4l2_mbus_frame_desc_entry {
 	enum v4l2_mbus_frame_desc_flags flags;
 	u32 pixelcode;
 	u32 length;
+	u32 stream;
+	u32 sink_pad;
 	union {
 		struct v4l2_mbus_frame_desc_entry_csi2 csi2;
 	} bus;
@@ -390,6 +400,27 @@ struct v4l2_mbus_frame_desc {
 	unsigned short num_entries;
 };
 
+/**
+ * struct v4l2_mbus_frame_desc_ext - dynamically sized media bus data frame
+ *				     description
+ * @type: type of the bus (enum v4l2_mbus_frame_desc_type)
+ * @num_entries: number of valid entries in @entry array. If the subdev has
+ *		 more than @max_entries entries, it sets this to the number
+ *		 it needs and returns -ENOSPC.
+ * @max_entries: number of entries allocated for @entry array
+ * @entry: frame descriptors array
+ *
+ * Unlike &struct v4l2_mbus_frame_desc, the number of entries is not bounded
+ * by %V4L2_FRAME_DESC_ENTRY_MAX. Allocate it with
+ * v4l2_subdev_frame_desc_alloc().
+ */
+struct v4l2_mbus_frame_desc_ext {
+	enum v4l2_mbus_frame_desc_type type;
+	unsigned int num_entries;
+	unsigned int max_entries;
+	struct v4l2_mbus_frame_desc_entry entry[];
+};
+
 /**
  * enum v4l2_subdev_pre_streamon_flags - Flags for pre_streamon subdev core op
  *
@@ -697,16 +728,26 @@ struct v4l2_subdev_pad_config {
  * @_lock: default for 'lock'
  * @lock: mutex for the state. May be replaced by the user.
  * @pads: &struct v4l2_subdev_pad_config array
+ * @pad_locks: Optional array of one mutex per entry of @pads, NULL unless
+ *	the subdev sets %V4L2_SUBDEV_FL_PAD_LOCKS.
+ * @num_pads: Number of entries in @pads and @pad_locks
  *
  * This structure only needs to be passed to the pad op if the 'which' field
  * of the main argument is set to %V4L2_SUBDEV_FORMAT_TRY. For
  * %V4L2_SUBDEV_FORMAT_ACTIVE it is safe to pass %NULL.
+ *
+ * With @pad_locks, locking the whole state takes @lock and then every pad
+ * lock, while v4l2_subdev_lock_state_pad() only takes the lock of one pad.
+ * Operations on different pads then run concurrently, and operations that
+ * touch more than one pad still lock the whole state.
  */
 struct v4l2_subdev_state {
 	/* lock for the struct v4l2_subdev_state fields */
 	struct mutex _lock;
 	struct mutex *lock;
 	struct v4l2_subdev_pad_config *pads;
+	struct mutex *pad_locks;
+	unsigned int num_pads;
 };
 
 /**
@@ -744,6 +785,11 @@ struct v4l2_subdev_state {
  *
  * @get_frame_desc: get the current low level media bus frame parameters.
  *
+ * @get_frame_desc_ext: get the current low level media bus frame parameters
+ *		     of a source pad with more than %V4L2_FRAME_DESC_ENTRY_MAX
+ *		     entries. Callers should use v4l2_subdev_get_frame_desc_ext(),
+ *		     which falls back to @get_frame_desc.
+ *
  * @set_frame_desc: set the low level media bus frame parameters, @fd array
  *                  may be adjusted by the subdev driver to device capabilities.
  *
@@ -797,6 +843,8 @@ struct v4l2_subdev_pad_ops {
 #endif /* CONFIG_MEDIA_CONTROLLER */
 	int (*get_frame_desc)(struct v4l2_subdev *sd, unsigned int pad,
 			      struct v4l2_mbus_frame_desc *fd);
+	int (*get_frame_desc_ext)(struct v4l2_subdev *sd, unsigned int pad,
+				  struct v4l2_mbus_frame_desc_ext *fd);
 	int (*set_frame_desc)(struct v4l2_subdev *sd, unsigned int pad,
 			      struct v4l2_mbus_frame_desc *fd);
 	int (*get_mbus_config)(struct v4l2_subdev *sd, unsigned int pad,
@@ -875,6 +923,11 @@ struct v4l2_subdev_internal_ops {
  * should set this flag.
  */
 #define V4L2_SUBDEV_FL_HAS_EVENTS		(1U << 3)
+/*
+ * Set this flag if the pads of this subdev can be configured independently.
+ * Its states then get one lock per pad, see v4l2_subdev_lock_state_pad().
+ */
+#define V4L2_SUBDEV_FL_PAD_LOCKS		(1U << 4)
 
 struct regulator_bulk_data;
 
@@ -906,7 +959,9 @@ struct v4l2_subdev_platform_data {
  *   %V4L2_SUBDEV_FL_HAS_DEVNODE - Set this flag if this subdev needs a
  *   device node;
  *   %V4L2_SUBDEV_FL_HAS_EVENTS -  Set this flag if this subdev generates
- *   events.
+ *   events;
+ *   %V4L2_SUBDEV_FL_PAD_LOCKS - Set this flag if the states of this subdev
+ *   need one lock per pad.
  *
  * @v4l2_dev: pointer to struct &v4l2_device
  * @ops: pointer to struct &v4l2_subdev_ops
@@ -935,6 +990,9 @@ struct v4l2_subdev_platform_data {
  * @active_state: Active state for the subdev (NULL for subdevs tracking the
  *		  state internally). Initialized by calling
  *		  v4l2_subdev_init_finalize().
+ * @call_stats: Per-op call counts and latencies, allocated on the first
+ *		v4l2_subdev_call() after call statistics are enabled in
+ *		debugfs.
  *
  * Each instance of a subdev driver should create this struct, either
  * stand-alone or embedded in a larger struct.
@@ -980,6 +1038,7 @@ struct v4l2_subdev {
 	 * doesn't support it.
 	 */
 	struct v4l2_subdev_state *active_state;
+	struct v4l2_subdev_call_stats *call_stats;
 };
 
 
@@ -1266,7 +1325,12 @@ void v4l2_subdev_cleanup(struct v4l2_subdev *sd);
  */
 static inline void v4l2_subdev_lock_state(struct v4l2_subdev_state *state)
 {
+	unsigned int i;
+
 	mutex_lock(state->lock);
+	if (state->pad_locks)
+		for (i = 0; i < state->num_pads; i++)
+			mutex_lock_nest_lock(&state->pad_locks[i], state->lock);
 }
 
 /**
@@ -1277,9 +1341,86 @@ static inline void v4l2_subdev_lock_state(struct v4l2_subdev_state *state)
  */
 static inline void v4l2_subdev_unlock_state(struct v4l2_subdev_state *state)
 {
+	unsigned int i;
+
+	if (state->pad_locks)
+		for (i = state->num_pads; i-- > 0;)
+			mutex_unlock(&state->pad_locks[i]);
 	mutex_unlock(state->lock);
 }
 
+/**
+ * v4l2_subdev_state_init_pad_locks() - Allocates the per-pad locks of a state
+ * @state: The subdevice state
+ * @num_pads: The number of pads of the subdevice
+ *
+ * Called when allocating the state of a subdev that sets
+ * %V4L2_SUBDEV_FL_PAD_LOCKS. Not to be called directly by the drivers.
+ *
+ * Returns 0 on success, -ENOMEM otherwise.
+ */
+int v4l2_subdev_state_init_pad_locks(struct v4l2_subdev_state *state,
+				     unsigned int num_pads);
+
+/**
+ * v4l2_subdev_state_free_pad_locks() - Frees the per-pad locks of a state
+ * @state: The subdevice state
+ *
+ * Not to be called directly by the drivers.
+ */
+void v4l2_subdev_state_free_pad_locks(struct v4l2_subdev_state *state);
+
+/**
+ * v4l2_subdev_lock_state_pad() - Locks the part of the state of one pad
+ * @state: The subdevice state
+ * @pad: The pad whose configuration is accessed
+ *
+ * Takes only the lock of @pad if the state has per-pad locks, and the
+ * whole state otherwise. Only &struct v4l2_subdev_state->pads[@pad] may be
+ * accessed with this lock held.
+ *
+ * The state must be unlocked with v4l2_subdev_unlock_state_pad() after use.
+ */
+static inline void v4l2_subdev_lock_state_pad(struct v4l2_subdev_state *state,
+					      unsigned int pad)
+{
+	if (state->pad_locks && !WARN_ON(pad >= state->num_pads))
+		mutex_lock(&state->pad_locks[pad]);
+	else
+		v4l2_subdev_lock_state(state);
+}
+
+/**
+ * v4l2_subdev_unlock_state_pad() - Unlocks the part of the state of one pad
+ * @state: The subdevice state
+ * @pad: The pad passed to v4l2_subdev_lock_state_pad()
+ */
+static inline void v4l2_subdev_unlock_state_pad(struct v4l2_subdev_state *state,
+						unsigned int pad)
+{
+	if (state->pad_locks && pad < state->num_pads)
+		mutex_unlock(&state->pad_locks[pad]);
+	else
+		v4l2_subdev_unlock_state(state);
+}
+
+/**
+ * v4l2_subdev_assert_pad_locked() - Checks that the state of a pad is locked
+ * @state: The subdevice state
+ * @pad: The pad
+ *
+ * Issues a lockdep warning if neither the lock of @pad nor, for states
+ * without per-pad locks, the state lock is held.
+ */
+static inline void v4l2_subdev_assert_pad_locked(struct v4l2_subdev_state *state,
+						 unsigned int pad)
+{
+	if (state->pad_locks && pad < state->num_pads)
+		lockdep_assert_held(&state->pad_locks[pad]);
+	else
+		lockdep_assert_held(state->lock);
+}
+
 /**
  * v4l2_subdev_get_unlocked_active_state() - Checks that the active subdev state
  *					     is unlocked and returns it
@@ -1362,6 +1503,64 @@ int v4l2_subdev_get_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_state *state,
 
 #endif /* CONFIG_MEDIA_CONTROLLER */
 
+/**
+ * v4l2_subdev_frame_desc_alloc - allocates a dynamically sized frame descriptor
+ *
+ * @max_entries: number of entries to allocate
+ *
+ * The descriptor must be freed with kfree().
+ *
+ * Returns the zeroed descriptor or NULL if out of memory.
+ */
+struct v4l2_mbus_frame_desc_ext *
+v4l2_subdev_frame_desc_alloc(unsigned int max_entries);
+
+/**
+ * v4l2_subdev_get_frame_desc_ext - get the frame descriptor of a source pad
+ *
+ * @sd: pointer to &struct v4l2_subdev
+ * @pad: the source pad
+ * @fd: returns the descriptor, to be freed with kfree()
+ *
+ * Calls the get_frame_desc_ext pad op, growing the descriptor until all
+ * entries fit, or the get_frame_desc pad op for subdevs that only
+ * implement that one.
+ *
+ * Returns 0 on success, error value otherwise.
+ */
+int v4l2_subdev_get_frame_desc_ext(struct v4l2_subdev *sd, unsigned int pad,
+				   struct v4l2_mbus_frame_desc_ext **fd);
+
+/**
+ * v4l2_subdev_get_frame_desc_compat - get_frame_desc for ext-only subdevs
+ *
+ * @sd: pointer to &struct v4l2_subdev
+ * @pad: the source pad
+ * @fd: the fixed size descriptor to fill
+ *
+ * Subdevs implementing get_frame_desc_ext can use this as their
+ * get_frame_desc pad op, so that existing callers keep working as long as
+ * the descriptor has at most %V4L2_FRAME_DESC_ENTRY_MAX entries.
+ *
+ * Returns 0 on success, -E2BIG if the descriptor does not fit, or another
+ * error value.
+ */
+int v4l2_subdev_get_frame_desc_compat(struct v4l2_subdev *sd, unsigned int pad,
+				      struct v4l2_mbus_frame_desc *fd);
+
+/**
+ * v4l2_subdev_frame_desc_validate - validate a frame descriptor
+ *
+ * @fd: the descriptor
+ *
+ * Checks that all entries of a stream are routed from the same sink pad
+ * and, for CSI-2, that the virtual channels are in range and that no two
+ * entries share a virtual channel and data type.
+ *
+ * Returns 0 if the descriptor is valid, -EINVAL otherwise.
+ */
+int v4l2_subdev_frame_desc_validate(const struct v4l2_mbus_frame_desc_ext *fd);
+
 /**
  * v4l2_subdev_init - initializes the sub-device struct
  *
@@ -1373,6 +1572,52 @@ void v4l2_subdev_init(struct v4l2_subdev *sd,
 
 extern const struct v4l2_subdev_ops v4l2_subdev_call_wrappers;
 
+DECLARE_STATIC_KEY_FALSE(v4l2_subdev_call_stats_key);
+
+/**
+ * v4l2_subdev_call_stats_init - create the subdev call statistics debugfs
+ *				 files
+ *
+ * The statistics are off until enabled by writing 1 to
+ * v4l2-subdev-calls/enable in debugfs, and cost one patched-out branch per
+ * v4l2_subdev_call() until then. v4l2-subdev-calls/stats lists the call
+ * count, total and maximum latency and a log2 latency histogram of every op
+ * called on every subdev; writing to it resets the counters.
+ */
+void v4l2_subdev_call_stats_init(void);
+
+/**
+ * v4l2_subdev_call_stats_exit - remove the subdev call statistics debugfs
+ *				 files
+ */
+void v4l2_subdev_call_stats_exit(void);
+
+/**
+ * v4l2_subdev_call_stats_free - free the call statistics of a subdev
+ *
+ * @sd: pointer to the &struct v4l2_subdev
+ *
+ * Called when the subdev is unregistered.
+ */
+void v4l2_subdev_call_stats_free(struct v4l2_subdev *sd);
+
+void __v4l2_subdev_call_stats_record(struct v4l2_subdev *sd, const char *op,
+				     u64 start_ns);
+
+static inline u64 v4l2_subdev_call_stats_start(void)
+{
+	if (static_branch_unlikely(&v4l2_subdev_call_stats_key))
+		return ktime_get_ns();
+	return 0;
+}
+
+static inline void v4l2_subdev_call_stats_end(struct v4l2_subdev *sd,
+					      const char *op, u64 start_ns)
+{
+	if (static_branch_unlikely(&v4l2_subdev_call_stats_key) && start_ns)
+		__v4l2_subdev_call_stats_record(sd, op, start_ns);
+}
+
 /**
  * v4l2_subdev_call - call an operation of a v4l2_subdev.
  *
@@ -1385,6 +1630,9 @@ extern const struct v4l2_subdev_ops v4l2_subdev_call_wrappers;
  * @args: arguments for @f.
  *
  * Example: err = v4l2_subdev_call(sd, video, s_std, norm);
+ *
+ * The latency of the call is accounted to "@o.@f" of @sd when call
+ * statistics are enabled, see v4l2_subdev_call_stats_init().
  */
 #define v4l2_subdev_call(sd, o, f, args...)				\
 	({								\
@@ -1394,12 +1642,17 @@ extern const struct v4l2_subdev_ops v4l2_subdev_call_wrappers;
 			__result = -ENODEV;				\
 		else if (!(__sd->ops->o && __sd->ops->o->f))		\
 			__result = -ENOIOCTLCMD;			\
-		else if (v4l2_subdev_call_wrappers.o &&			\
-			 v4l2_subdev_call_wrappers.o->f)		\
-			__result = v4l2_subdev_call_wrappers.o->f(	\
+		else {							\
+			u64 __start = v4l2_subdev_call_stats_start();	\
+			if (v4l2_subdev_call_wrappers.o &&		\
+			    v4l2_subdev_call_wrappers.o->f)		\
+				__result = v4l2_subdev_call_wrappers.o->f( \
 							__sd, ##args);	\
-		else							\
-			__result = __sd->ops->o->f(__sd, ##args);	\
+			else						\
+				__result = __sd->ops->o->f(__sd, ##args); \
+			v4l2_subdev_call_stats_end(__sd, #o "." #f,	\
+						   __start);		\
+		}							\
 		__result;						\
 	})
 
@@ -1433,6 +1686,40 @@ extern const struct v4l2_subdev_ops v4l2_subdev_call_wrappers;
 		__result;						\
 	})
 
+/**
+ * v4l2_subdev_call_state_active_pad - call an operation of a v4l2_subdev
+ *				       which takes state as a parameter and
+ *				       only accesses one pad, passing the
+ *				       subdev its active state.
+ *
+ * @sd: pointer to the &struct v4l2_subdev
+ * @pad: the pad the operation accesses
+ * @o: name of the element at &struct v4l2_subdev_ops that contains @f.
+ *     Each element there groups a set of callbacks functions.
+ * @f: callback function to be called.
+ *     The callback functions are defined in groups, according to
+ *     each element at &struct v4l2_subdev_ops.
+ * @args: arguments for @f.
+ *
+ * This is similar to v4l2_subdev_call_state_active(), except that only the
+ * lock of @pad is held around the call when the subdev sets
+ * %V4L2_SUBDEV_FL_PAD_LOCKS, so that calls on different pads, such as
+ * get_fmt or get_selection, do not serialize.
+ */
+#define v4l2_subdev_call_state_active_pad(sd, pad, o, f, args...)	\
+	({								\
+		int __result;						\
+		unsigned int __pad = (pad);				\
+		struct v4l2_subdev_state *state;			\
+		state = v4l2_subdev_get_unlocked_active_state(sd);	\
+		if (state)						\
+			v4l2_subdev_lock_state_pad(state, __pad);	\
+		__result = v4l2_subdev_call(sd, o, f, state, ##args);	\
+		if (state)						\
+			v4l2_subdev_unlock_state_pad(state, __pad);	\
+		__result;						\
+	})
+
 /**
  * v4l2_subdev_has_op - Checks if a subdev defines a certain operation.
  *
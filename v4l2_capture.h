@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Streaming capture from a V4L2 video node with a recycled buffer pool
+ *
+ * Buffers are either driver allocated (MMAP) or allocated from a DMA heap
+ * and imported (DMABUF), and are mapped once. Dequeued frames are handed
+ * out by reference; a buffer goes back to the driver when its last
+ * reference is dropped, from any thread.
+ */
+#ifndef _V4L2_CAPTURE_H
+#define _V4L2_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define V4L2_CAPTURE_MAX_BUFFERS	32
+
+enum v4l2_capture_memory {
+	V4L2_CAPTURE_MMAP,
+	V4L2_CAPTURE_DMABUF,
+};
+
+/**
+ * struct v4l2_capture_cfg - capture configuration
+ * @path: video node
+ * @memory: buffer memory type
+ * @heap: DMA heap for V4L2_CAPTURE_DMABUF, NULL for the system heap
+ * @num_buffers: buffers in the pool
+ * @width, @height, @pixelformat: format to set, the current format is
+ *	kept if @width is 0
+ */
+struct v4l2_capture_cfg {
+	const char *path;
+	enum v4l2_capture_memory memory;
+	const char *heap;
+	unsigned int num_buffers;
+	unsigned int width, height;
+	uint32_t pixelformat;
+};
+
+/**
+ * struct v4l2_capture_frame - a dequeued frame
+ * @data: mapping of the buffer
+ * @bytesused: bytes of @data holding the frame
+ * @sequence: driver sequence number
+ * @timestamp_ns: CLOCK_MONOTONIC time of the frame
+ * @dequeue_ns: CLOCK_MONOTONIC time the frame was dequeued
+ * @index: buffer index
+ * @refs: references, the buffer is requeued when they drop to 0
+ */
+struct v4l2_capture_frame {
+	void *data;
+	size_t bytesused;
+	uint32_t sequence;
+	uint64_t timestamp_ns;
+	uint64_t dequeue_ns;
+	unsigned int index;
+	unsigned int refs;
+};
+
+/**
+ * struct v4l2_capture_latency - distribution of one latency or interval
+ * @count: samples
+ * @sum_ns, @sum_sq: sum and sum of squares of the samples, in ns
+ * @max_ns: largest sample
+ */
+struct v4l2_capture_latency {
+	uint64_t count;
+	double sum_ns;
+	double sum_sq;
+	uint64_t max_ns;
+};
+
+/**
+ * struct v4l2_capture_stats - streaming statistics
+ * @frames: dequeued frames
+ * @dropped_seq: frames missing from the sequence numbers
+ * @dropped_ts: frames missing from timestamp gaps, whether or not the
+ *	sequence numbers show them
+ * @errors: buffers dequeued with V4L2_BUF_FLAG_ERROR
+ * @interval: time between consecutive frame timestamps
+ * @dequeue: time from the frame timestamp to its dequeue
+ * @hold: time from dequeue to the release of the last reference
+ */
+struct v4l2_capture_stats {
+	uint64_t frames;
+	uint64_t dropped_seq;
+	uint64_t dropped_ts;
+	uint64_t errors;
+	struct v4l2_capture_latency interval;
+	struct v4l2_capture_latency dequeue;
+	struct v4l2_capture_latency hold;
+};
+
+struct v4l2_capture;
+
+/* Open, configure and allocate; returns NULL with errno set on failure */
+struct v4l2_capture *v4l2_capture_open(const struct v4l2_capture_cfg *cfg);
+/*
+ * Stop and free everything. Fails with -EBUSY, leaving @cap untouched, while
+ * a consumer still holds a frame, since that would unmap its data.
+ */
+int v4l2_capture_close(struct v4l2_capture *cap);
+
+/* Negotiated format */
+void v4l2_capture_get_format(const struct v4l2_capture *cap,
+			     unsigned int *width, unsigned int *height,
+			     uint32_t *pixelformat, unsigned int *stride);
+
+/*
+ * Start queues every buffer not held by a consumer. Frames still held
+ * across a stop stay valid; their buffers are queued again when the last
+ * reference is dropped while streaming.
+ */
+int v4l2_capture_start(struct v4l2_capture *cap);
+int v4l2_capture_stop(struct v4l2_capture *cap);
+
+/*
+ * Wait up to @timeout_ms for the next frame, -1 to wait forever. Returns
+ * the frame with one reference, or NULL with errno set to ETIMEDOUT,
+ * ENODATA once the stream is stopped, or the error. Only one thread may
+ * dequeue.
+ */
+struct v4l2_capture_frame *v4l2_capture_dequeue(struct v4l2_capture *cap,
+						int timeout_ms);
+
+void v4l2_capture_frame_get(struct v4l2_capture_frame *frame);
+/* Drop a reference, requeueing the buffer on the last one */
+int v4l2_capture_frame_put(struct v4l2_capture *cap,
+			   struct v4l2_capture_frame *frame);
+
+/* Copy the statistics, and reset them if @reset */
+void v4l2_capture_get_stats(struct v4l2_capture *cap,
+			    struct v4l2_capture_stats *stats, bool reset);
+
+#endif
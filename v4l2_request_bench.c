@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Request API latency benchmark for V4L2 capture devices
+ *
+ * Runs frames through media requests the way a per-frame control client
+ * does: every request gets new values for the -c controls through
+ * VIDIOC_S_EXT_CTRLS, one capture buffer, and is queued. The driver
+ * applies it with v4l2_ctrl_request_setup() and completes it with
+ * v4l2_ctrl_request_complete(), then the request is dequeued and
+ * reinitialised for the next frame. -q requests are in flight at a time.
+ *
+ * Three latencies are sampled per frame. The setup figure is the first
+ * S_EXT_CTRLS on a request, which clones the control handler of the
+ * device into it. The release figure is the REINIT that frees the clone.
+ * The complete figure runs from MEDIA_REQUEST_IOC_QUEUE to the request
+ * signalling completion. One JSON object reports p50/p99/max of each.
+ *
+ * Whether the clone comes from a v4l2_ctrl_req_pool_init() pool is up to
+ * the driver, so compare runs against kernels with and without the pool,
+ * told apart by -l. vivid with supports_requests=1 exercises the whole
+ * path.
+ *
+ * Build: gcc -O2 -o v4l2_request_bench v4l2_request_bench.c
+ *
+ * Examples:
+ *   v4l2_request_bench -m /dev/media0 -d /dev/video0 -l baseline
+ *   v4l2_request_bench -m /dev/media0 -d /dev/video0 -n 2400 -q 3 -l pool
+ *   v4l2_request_bench -m /dev/media0 -d /dev/video0 -c 0x00980900,0x00980901
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+#include <linux/videodev2.h>
+
+#define BENCH_MAX_CTRLS		16
+#define BENCH_MAX_DEPTH		16
+/* Longest wait for one request, covers the slowest emulated frame rates */
+#define BENCH_TIMEOUT_MS	2000
+
+/**
+ * struct bench_ctrl - control set in every request
+ * @id: Control ID
+ * @is_int64: The control is a V4L2_CTRL_TYPE_INTEGER64 one
+ * @min: Minimum value, set on even frames
+ * @max: Maximum value, set on odd frames
+ */
+struct bench_ctrl {
+	uint32_t id;
+	bool is_int64;
+	int64_t min;
+	int64_t max;
+};
+
+/**
+ * struct bench_req - one request slot
+ * @fd: Request file descriptor
+ * @queued: Time the request was queued
+ */
+struct bench_req {
+	int fd;
+	uint64_t queued;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int bench_xioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret && errno == EINTR);
+
+	return ret ? -errno : 0;
+}
+
+static int bench_query_ctrls(int fd, struct bench_ctrl *ctrls,
+			     unsigned int nr_ctrls)
+{
+	struct v4l2_query_ext_ctrl q;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nr_ctrls; i++) {
+		memset(&q, 0, sizeof(q));
+		q.id = ctrls[i].id;
+		ret = bench_xioctl(fd, VIDIOC_QUERY_EXT_CTRL, &q);
+		if (ret) {
+			fprintf(stderr, "control 0x%08x: %s\n", ctrls[i].id,
+				strerror(-ret));
+			return ret;
+		}
+		if (q.flags & (V4L2_CTRL_FLAG_READ_ONLY |
+			       V4L2_CTRL_FLAG_HAS_PAYLOAD)) {
+			fprintf(stderr, "control 0x%08x is not a writable scalar\n",
+				ctrls[i].id);
+			return -EINVAL;
+		}
+		ctrls[i].is_int64 = q.type == V4L2_CTRL_TYPE_INTEGER64;
+		ctrls[i].min = q.minimum;
+		ctrls[i].max = q.maximum;
+	}
+
+	return 0;
+}
+
+/* Store the values of @frame in request @req_fd */
+static int bench_set_ctrls(int fd, int req_fd, const struct bench_ctrl *ctrls,
+			   unsigned int nr_ctrls, unsigned int frame)
+{
+	struct v4l2_ext_control c[BENCH_MAX_CTRLS] = { 0 };
+	struct v4l2_ext_controls cs = {
+		.which = V4L2_CTRL_WHICH_REQUEST_VAL,
+		.count = nr_ctrls,
+		.request_fd = req_fd,
+		.controls = c,
+	};
+	unsigned int i;
+	int64_t val;
+
+	for (i = 0; i < nr_ctrls; i++) {
+		val = frame & 1 ? ctrls[i].max : ctrls[i].min;
+		c[i].id = ctrls[i].id;
+		if (ctrls[i].is_int64)
+			c[i].value64 = val;
+		else
+			c[i].value = val;
+	}
+
+	return bench_xioctl(fd, VIDIOC_S_EXT_CTRLS, &cs);
+}
+
+static int bench_queue(int fd, struct bench_req *req, unsigned int index)
+{
+	struct v4l2_buffer buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+		.index = index,
+		.flags = V4L2_BUF_FLAG_REQUEST_FD,
+		.request_fd = req->fd,
+	};
+	int ret;
+
+	ret = bench_xioctl(fd, VIDIOC_QBUF, &buf);
+	if (ret)
+		return ret;
+
+	req->queued = bench_now();
+
+	return bench_xioctl(req->fd, MEDIA_REQUEST_IOC_QUEUE, NULL);
+}
+
+/* Wait for @req to complete and dequeue its buffer */
+static int bench_complete(int fd, struct bench_req *req, uint64_t *ns)
+{
+	struct pollfd pfd = { .fd = req->fd, .events = POLLPRI };
+	struct v4l2_buffer buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, BENCH_TIMEOUT_MS);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+	if (!ret)
+		return -ETIMEDOUT;
+	*ns = bench_now() - req->queued;
+
+	return bench_xioctl(fd, VIDIOC_DQBUF, &buf);
+}
+
+static void bench_print_lat(const char *name, uint64_t *samples,
+			    unsigned int n, bool last)
+{
+	qsort(samples, n, sizeof(*samples), bench_cmp_u64);
+	printf("\"%s_p50_us\":%.1f,\"%s_p99_us\":%.1f,\"%s_max_us\":%.1f%s",
+	       name, samples[n / 2] / 1e3,
+	       name, samples[(uint64_t)n * 99 / 100] / 1e3,
+	       name, samples[n - 1] / 1e3, last ? "" : ",");
+}
+
+static int bench_parse_ctrls(const char *arg, struct bench_ctrl *ctrls)
+{
+	unsigned int n = 0;
+	char *end;
+
+	while (*arg) {
+		if (n == BENCH_MAX_CTRLS)
+			return -1;
+		ctrls[n].id = strtoul(arg, &end, 0);
+		if (end == arg || (*end && *end != ','))
+			return -1;
+		n++;
+		arg = *end ? end + 1 : end;
+	}
+
+	return n;
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -m MEDIA -d VIDEO [options]\n"
+		"  -m MEDIA    media device node the requests come from\n"
+		"  -d VIDEO    capture video node of the same device\n"
+		"  -c CIDS     comma-separated controls set in every request\n"
+		"              (default V4L2_CID_BRIGHTNESS)\n"
+		"  -n FRAMES   requests to run (default 1200)\n"
+		"  -q DEPTH    requests in flight (default 2)\n"
+		"  -l LABEL    label of the run in the output (default none)\n"
+		"  -h          this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctrl ctrls[BENCH_MAX_CTRLS] = { { .id = V4L2_CID_BRIGHTNESS } };
+	struct bench_req reqs[BENCH_MAX_DEPTH];
+	struct v4l2_requestbuffers rb = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	const char *media = NULL, *video = NULL, *label = "";
+	unsigned int frames = 1200, depth = 2, nr_ctrls = 1, f, i;
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	uint64_t *setup, *release, *complete, start;
+	int media_fd, fd, opt, n, ret;
+
+	while ((opt = getopt(argc, argv, "m:d:c:n:q:l:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			media = optarg;
+			break;
+		case 'd':
+			video = optarg;
+			break;
+		case 'c':
+			n = bench_parse_ctrls(optarg, ctrls);
+			if (n <= 0) {
+				fprintf(stderr, "invalid control list '%s'\n", optarg);
+				return 1;
+			}
+			nr_ctrls = n;
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			if (!frames) {
+				fprintf(stderr, "invalid frame count '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'q':
+			depth = strtoul(optarg, NULL, 0);
+			if (!depth || depth > BENCH_MAX_DEPTH) {
+				fprintf(stderr, "invalid depth '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!media || !video) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	media_fd = open(media, O_RDWR);
+	if (media_fd < 0) {
+		perror(media);
+		return 1;
+	}
+	fd = open(video, O_RDWR);
+	if (fd < 0) {
+		perror(video);
+		close(media_fd);
+		return 1;
+	}
+
+	setup = calloc(frames, sizeof(*setup));
+	release = calloc(frames, sizeof(*release));
+	complete = calloc(frames, sizeof(*complete));
+	if (!setup || !release || !complete) {
+		fprintf(stderr, "out of memory\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = bench_query_ctrls(fd, ctrls, nr_ctrls);
+	if (ret)
+		goto out;
+
+	rb.count = depth;
+	ret = bench_xioctl(fd, VIDIOC_REQBUFS, &rb);
+	if (!ret && (!(rb.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS) ||
+		     rb.count < depth))
+		ret = -EOPNOTSUPP;
+	if (ret) {
+		fprintf(stderr, "%s: cannot get %u request buffers: %s\n",
+			video, depth, strerror(-ret));
+		goto out;
+	}
+
+	for (i = 0; i < depth; i++) {
+		reqs[i].fd = -1;
+		ret = bench_xioctl(media_fd, MEDIA_IOC_REQUEST_ALLOC,
+				   &reqs[i].fd);
+		if (ret) {
+			fprintf(stderr, "%s: cannot allocate requests: %s\n",
+				media, strerror(-ret));
+			goto out_reqs;
+		}
+	}
+
+	ret = bench_xioctl(fd, VIDIOC_STREAMON, &type);
+	if (ret) {
+		fprintf(stderr, "%s: STREAMON: %s\n", video, strerror(-ret));
+		goto out_reqs;
+	}
+
+	/* Frame f uses slot f % depth, reused once frame f - depth completed */
+	for (f = 0; f < frames + depth; f++) {
+		struct bench_req *req = &reqs[f % depth];
+
+		if (f >= depth) {
+			ret = bench_complete(fd, req, &complete[f - depth]);
+			if (ret)
+				break;
+
+			start = bench_now();
+			ret = bench_xioctl(req->fd, MEDIA_REQUEST_IOC_REINIT,
+					   NULL);
+			release[f - depth] = bench_now() - start;
+			if (ret)
+				break;
+		}
+		if (f >= frames)
+			continue;
+
+		start = bench_now();
+		ret = bench_set_ctrls(fd, req->fd, ctrls, nr_ctrls, f);
+		setup[f] = bench_now() - start;
+		if (!ret)
+			ret = bench_queue(fd, req, f % depth);
+		if (ret)
+			break;
+	}
+
+	bench_xioctl(fd, VIDIOC_STREAMOFF, &type);
+	if (ret) {
+		fprintf(stderr, "frame %u: %s\n", f, strerror(-ret));
+		goto out_reqs;
+	}
+
+	printf("{\"label\":\"%s\",\"frames\":%u,\"depth\":%u,\"ctrls\":%u,",
+	       label, frames, depth, nr_ctrls);
+	bench_print_lat("setup", setup, frames, false);
+	bench_print_lat("release", release, frames, false);
+	bench_print_lat("complete", complete, frames, true);
+	printf("}\n");
+
+out_reqs:
+	for (i = 0; i < depth && reqs[i].fd >= 0; i++)
+		close(reqs[i].fd);
+out:
+	free(setup);
+	free(release);
+	free(complete);
+	close(fd);
+	close(media_fd);
+
+	return ret ? 1 : 0;
+}